@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "cellmap.h"
+#include "tilemap.h"
+#include "ltlmap.h"
+#include "gridmap.h"
+#include "rle.h"
+#include "jsonpattern.h"
+#include "points.h"
+#include "nlohmann/json.hpp"
+#if Windows
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+using json = nlohmann::json;
+
+// Runs CellMap frames without a window: the surface is a plain pixel
+// buffer, there is no SDL_Init, no event loop and no frame delay. Every
+// pattern runs from a fresh CellMap and the results go to stdout as JSON.
+//
+//   ./bench [--engine=quadtree|hashlife|tile|morton|ltl] [--threads=N]
+//           [--rule=B3/S23] [--torus=WxH|--bounded=WxH] [--generations=N]
+//           [--soup=SIDE]... [--still=SIDE]... [pattern.json]...
+//
+// A Larger than Life --rule (R5,C0,M1,S34..58,B34..45,NM) runs on the ltl
+// engine, an isotropic one (B2-a/S12) on the tile engine. --torus=WxH and
+// --bounded=WxH run on the grid engine in a fixed size universe.
+//
+// Patterns are JSON or, with a .rle extension, RLE files. An RLE header
+// rule is used unless --rule is given, a pattern whose rule the engine
+// cannot run is reported on stderr and skipped. Without
+// patterns it runs examples/*.json and examples/*.rle, without soups it runs random
+// soups of side 64 and 256. Soups are seeded by their side, so every run
+// sees the same cells. --still=SIDE runs a side x side field of blocks with
+// one pulsar, which is where skipping settled regions pays off.
+
+// Same view as the game
+constexpr int kCellSize = 5;
+constexpr int kWindowWidth = 1080;
+constexpr int kWindowHeight = 720;
+
+// Cells of a pattern file, rule gets the rule an RLE header names
+std::vector<XY> loadPattern(const std::string& path, std::string& rule) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    if (std::filesystem::path(path).extension() == ".rle") {
+        RleReader reader(f);
+        std::vector<XY> cells;
+        while (reader.read(cells)) {
+        }
+        rule = reader.rule();
+        return cells;
+    }
+    if (std::filesystem::path(path).extension() == ".txt") {
+        // The "(x, y)" list the CIN build reads
+        PointReader reader(f);
+        std::vector<XY> cells;
+        while (reader.read(cells)) {
+        }
+        return cells;
+    }
+    std::vector<XY> cells;
+    ReadJsonPattern(f, [&cells](const std::vector<XY>& batch) {
+        cells.insert(cells.end(), batch.begin(), batch.end());
+    });
+    return cells;
+}
+
+// Half of the cells of a side x side square centered on the origin
+std::vector<XY> randomSoup(Coord side) {
+    std::mt19937_64 rng(side);
+    std::vector<XY> cells;
+    for (Coord y = 0; y < side; y++) {
+        for (Coord x = 0; x < side; x++) {
+            if (rng() & 1) {
+                cells.emplace_back(x - side / 2, y - side / 2);
+            }
+        }
+    }
+    return cells;
+}
+
+// A side x side square of blocks, one every 4 cells, with a pulsar at
+// the origin in a gap of a few blocks: a still-life field where almost
+// every cell is settled
+std::vector<XY> stillField(Coord side) {
+    // Pulsar, period 3 so its blocks are recomputed every generation
+    std::vector<XY> cells;
+    for (Coord sy : {-1, 1}) {
+        for (Coord sx : {-1, 1}) {
+            for (Coord k = 2; k <= 4; k++) {
+                cells.emplace_back(sx * k, sy);
+                cells.emplace_back(sx * k, sy * 6);
+                cells.emplace_back(sx, sy * k);
+                cells.emplace_back(sx * 6, sy * k);
+            }
+        }
+    }
+    for (Coord y = 0; y + 1 < side; y += 4) {
+        for (Coord x = 0; x + 1 < side; x += 4) {
+            Coord left = x - side / 2;
+            Coord top = y - side / 2;
+            if (left > -16 && left < 16 && top > -16 && top < 16) {
+                continue;
+            }
+            cells.emplace_back(left, top);
+            cells.emplace_back(left + 1, top);
+            cells.emplace_back(left, top + 1);
+            cells.emplace_back(left + 1, top + 1);
+        }
+    }
+    return cells;
+}
+
+// Largest resident set of the process so far, in kilobytes
+uint64_t peakRssKb() {
+#if Windows
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    // Bytes on macOS, kilobytes elsewhere
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// Fixed size universe to run in, a width of 0 leaves the engine's own
+class Universe {
+public:
+    Coord width = 0;
+    Coord height = 0;
+    bool torus = false;
+};
+
+json runPattern(const std::string& name, const std::vector<XY>& cells, EngineKind engine,
+                unsigned threads, int generations, const Rule& rule, const LtlRule* ltlRule,
+                const IsotropicRule* isotropicRule, const Universe& universe,
+                const std::string& patternRule = "") {
+    std::vector<uint8_t> pixels(kWindowWidth * kWindowHeight * 4);
+    SDL_Surface surface = {};
+    surface.w = kWindowWidth;
+    surface.h = kWindowHeight;
+    surface.pitch = kWindowWidth * 4;
+    surface.pixels = pixels.data();
+
+    CellMap map(&surface, kWindowWidth, kWindowHeight, kCellSize, -1, engine);
+    if (universe.width) {
+        map.setEngine(std::make_unique<GridEngine>(universe.width, universe.height, universe.torus));
+    }
+    map.engine().setThreadCount(threads);
+    if (ltlRule) {
+        static_cast<LtlEngine&>(map.engine()).setLtlRule(*ltlRule);
+    } else if (isotropicRule) {
+        static_cast<TileEngine&>(map.engine()).setIsotropicRule(*isotropicRule);
+    } else {
+        map.engine().setRule(rule);
+    }
+    // Throws for a rule the engine cannot run
+    if (!patternRule.empty()) {
+        SetRleRule(patternRule, map.engine());
+    }
+    map.engine().addCells(cells);
+    size_t initialCells = map.engine().cellCount();
+
+    // Cells alive at the start of each generation, i.e. the work done
+    uint64_t cellGenerations = 0;
+    double seconds = 0;
+    for (int i = 0; i < generations; i++) {
+        cellGenerations += map.engine().cellCount();
+        auto start = std::chrono::steady_clock::now();
+        map.update();
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    const FrameTimes& times = map.frameTimes();
+    json result;
+    result["pattern"] = name;
+    if (!patternRule.empty()) {
+        result["rule"] = patternRule;
+    }
+    result["initial_cells"] = initialCells;
+    result["final_cells"] = map.engine().cellCount();
+    result["seconds"] = seconds;
+    result["generations_per_sec"] = seconds > 0 ? generations / seconds : 0.0;
+    result["cells_per_sec"] = seconds > 0 ? cellGenerations / seconds : 0.0;
+    result["phases"] = {
+        {"query", times.query},
+        {"draw", times.draw},
+        {"update", times.update}
+    };
+    result["peak_rss_kb"] = peakRssKb();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    EngineKind engine = EngineKind::QuadTree;
+    std::string engineName = "quadtree";
+    unsigned threads = 1;
+    Rule rule = kConwayRule;
+    bool ruled = false;
+    LtlRule ltlRule;
+    bool largerThanLife = false;
+    IsotropicRule isotropicRule;
+    bool isotropic = false;
+    Universe universe;
+    int generations = 1000;
+    std::vector<Coord> soups;
+    std::vector<Coord> stills;
+    std::vector<std::string> patterns;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--engine=", 0) == 0) {
+            engineName = arg.substr(9);
+            if (!ParseEngineKind(engineName, engine)) {
+                std::cerr << "Unknown engine: " << engineName << "\n";
+                return -1;
+            }
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            threads = (unsigned)std::atoi(arg.substr(10).c_str());
+        } else if (arg.rfind("--rule=R", 0) == 0 || arg.rfind("--rule=r", 0) == 0) {
+            if (!ParseLtlRule(arg.substr(7), ltlRule)) {
+                std::cerr << "Unsupported rule: " << arg.substr(7) << "\n";
+                return -1;
+            }
+            largerThanLife = true;
+            engine = EngineKind::LargerThanLife;
+            engineName = "ltl";
+        } else if (arg.rfind("--rule=", 0) == 0) {
+            if (ParseRule(arg.substr(7), rule)) {
+                ruled = true;
+                continue;
+            }
+            if (!ParseIsotropicRule(arg.substr(7), isotropicRule)) {
+                std::cerr << "Unsupported rule: " << arg.substr(7) << "\n";
+                return -1;
+            }
+            isotropic = true;
+            engine = EngineKind::Tile;
+            engineName = "tile";
+        } else if (arg.rfind("--torus=", 0) == 0 || arg.rfind("--bounded=", 0) == 0) {
+            universe.torus = arg.rfind("--torus=", 0) == 0;
+            std::string size = arg.substr(arg.find('=') + 1);
+            if (!ParseGridSize(size, universe.width, universe.height)) {
+                std::cerr << "Unsupported universe size: " << size << "\n";
+                return -1;
+            }
+        } else if (arg.rfind("--generations=", 0) == 0) {
+            generations = std::atoi(arg.substr(14).c_str());
+        } else if (arg.rfind("--soup=", 0) == 0) {
+            soups.push_back(std::atoll(arg.substr(7).c_str()));
+        } else if (arg.rfind("--still=", 0) == 0) {
+            stills.push_back(std::atoll(arg.substr(8).c_str()));
+        } else {
+            patterns.push_back(arg);
+        }
+    }
+
+    if (patterns.empty()) {
+        for (auto& entry : std::filesystem::directory_iterator("examples")) {
+            if (entry.path().extension() == ".json" || entry.path().extension() == ".rle") {
+                patterns.push_back(entry.path().generic_string());
+            }
+        }
+        std::sort(patterns.begin(), patterns.end());
+    }
+    if (soups.empty() && stills.empty()) {
+        soups = {64, 256};
+    }
+
+    json report;
+    report["engine"] = universe.width ? "grid" : engineName;
+    if (universe.width) {
+        report["universe"] = (universe.torus ? "torus " : "bounded ") + std::to_string(universe.width) + "x" +
+                             std::to_string(universe.height);
+    }
+    report["threads"] = threads;
+    report["rule"] = largerThanLife ? ltlRule.toString() : (isotropic ? isotropicRule.toString() : rule.toString());
+    report["generations"] = generations;
+    report["runs"] = json::array();
+    for (auto& path : patterns) {
+        try {
+            std::string patternRule;
+            std::vector<XY> cells = loadPattern(path, patternRule);
+            if (ruled || largerThanLife || isotropic) {
+                patternRule.clear();
+            }
+            report["runs"].push_back(runPattern(path, cells, engine, threads, generations, rule,
+                                                largerThanLife ? &ltlRule : nullptr,
+                                                isotropic ? &isotropicRule : nullptr, universe, patternRule));
+        } catch (const std::exception& e) {
+            std::cerr << "Skipping " << path << ": " << e.what() << "\n";
+        }
+    }
+    for (Coord side : soups) {
+        std::string name = "soup" + std::to_string(side);
+        report["runs"].push_back(runPattern(name, randomSoup(side), engine, threads, generations, rule,
+                                            largerThanLife ? &ltlRule : nullptr,
+                                            isotropic ? &isotropicRule : nullptr, universe));
+    }
+    for (Coord side : stills) {
+        std::string name = "still" + std::to_string(side);
+        report["runs"].push_back(runPattern(name, stillField(side), engine, threads, generations, rule,
+                                            largerThanLife ? &ltlRule : nullptr,
+                                            isotropic ? &isotropicRule : nullptr, universe));
+    }
+    report["peak_rss_kb"] = peakRssKb();
+
+    std::cout << report.dump(2) << std::endl;
+    return 0;
+}
@@ -1,7 +1,18 @@
 #include "cellmap.h"
+#include "hashlife.h"
+#include "tilemap.h"
+#include "morton.h"
+#include "mortonmap.h"
+#include "ltlmap.h"
+#include <algorithm>
+#include <chrono>
 #include <limits>
 #include <iostream>
 #include <unordered_set>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define CELLMAP_SSE2 1
+#endif
 
 static Coord MAX = std::numeric_limits<Coord>::max();
 static Coord MIN = std::numeric_limits<Coord>::min();
@@ -68,9 +79,56 @@ void clearSurface(void* pixels, int len) {
 }
 
 
-CellMap::CellMap(SDL_Surface* surface, int hpixels, int vpixels, int pixelsPerCell, int printAtIteration)
+// Writes count copies of pixel
+static inline void fillSpan(uint32_t* row, int count, uint32_t pixel) {
+    int x = 0;
+#ifdef CELLMAP_SSE2
+    __m128i value = _mm_set1_epi32((int)pixel);
+    for (; x + 4 <= count; x += 4) {
+        _mm_storeu_si128((__m128i*)(row + x), value);
+    }
+#endif
+    for (; x < count; x++) {
+        row[x] = pixel;
+    }
+}
+
+// Writes count pixels, on where bit x of bits is set and off elsewhere
+static void fillBits(uint32_t* row, const uint64_t* bits, int count, uint32_t on, uint32_t off) {
+#ifdef CELLMAP_SSE2
+    __m128i onValue = _mm_set1_epi32((int)on);
+    __m128i offValue = _mm_set1_epi32((int)off);
+    __m128i select = _mm_set_epi32(8, 4, 2, 1);
+#endif
+    for (int word = 0; word * 64 < count; word++) {
+        uint32_t* out = row + word * 64;
+        int length = std::min(64, count - word * 64);
+        uint64_t cells = bits[word];
+        if (cells == 0) {
+            // Most words are empty
+            fillSpan(out, length, off);
+            continue;
+        }
+        int x = 0;
+#ifdef CELLMAP_SSE2
+        for (; x + 4 <= length; x += 4) {
+            // Spread four bits over four lanes
+            __m128i nibble = _mm_set1_epi32((int)((cells >> x) & 0xf));
+            __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(nibble, select), select);
+            __m128i value = _mm_or_si128(_mm_and_si128(mask, onValue), _mm_andnot_si128(mask, offValue));
+            _mm_storeu_si128((__m128i*)(out + x), value);
+        }
+#endif
+        for (; x < length; x++) {
+            out[x] = ((cells >> x) & 1) ? on : off;
+        }
+    }
+}
+
+CellMap::CellMap(SDL_Surface* surface, int hpixels, int vpixels, int pixelsPerCell, int printAtIteration,
+                 EngineKind engine)
     : m_surface(surface),
-      m_celltree(nullptr),
+      m_engine(CreateEngine(engine)),
       m_pixelsPerCell(pixelsPerCell),
       m_hpixels(hpixels),
       m_vpixels(vpixels),
@@ -79,80 +137,597 @@ CellMap::CellMap(SDL_Surface* surface, int hpixels, int vpixels, int pixelsPerCe
       m_hoff(-(hpixels / pixelsPerCell / 2)),
       m_voff(-(vpixels / pixelsPerCell / 2)),
       m_queryBox(XY(0, 0), -m_hcells/2, m_hcells/2, -m_vcells/2, m_vcells/2),
-      m_printAtIteration(printAtIteration) {
-    m_celltree = CellTreeNode::createRoot();
+      m_printAtIteration(printAtIteration),
+      m_iteration(0) {
     // m_queryBox = AABB();        //
+    if (m_surface->format && m_surface->format->BytesPerPixel != 4) {
+        throw std::runtime_error("Only 32-bit surfaces are supported");
+    }
+    // Plain pixel buffers may leave the pitch out
+    m_pitch = m_surface->pitch ? m_surface->pitch / 4 : m_hpixels;
+    m_onPixel = mapColor(kOnColor);
+    m_offPixel = mapColor(kOffColor);
+    // Decaying cells fade from kDecayColor towards the background
+    m_statePixels[kCellClear] = m_offPixel;
+    m_statePixels[kCellLit] = m_onPixel;
+    for (int stage = 1; stage <= kMaxRuleStates - 2; stage++) {
+        int weight = kMaxRuleStates - 1 - stage;
+        RGBA color(kDecayColor.r * weight / (kMaxRuleStates - 1), kDecayColor.g * weight / (kMaxRuleStates - 1),
+                   kDecayColor.b * weight / (kMaxRuleStates - 1), kDecayColor.a);
+        m_statePixels[kCellLit + stage] = mapColor(color);
+    }
+    updateDrawArea();
+}
+
+void CellMap::setScaledOutput(bool scaled) {
+    m_scaledOutput = scaled;
+    m_redrawAll = true;
+    updateDrawArea();
 }
 
-void CellMap::drawCell(XY xy, RGBA color) {
-    uint8_t* pixel_ptr = (uint8_t*)m_surface->pixels + (xy.y * m_pixelsPerCell * m_hpixels + xy.x * m_pixelsPerCell) * 4;
+void CellMap::updateDrawArea() {
+    m_cellPixels = m_scaledOutput ? 1 : m_pixelsPerCell;
+    m_drawWidth = m_scaledOutput ? m_hcells : m_hpixels;
+    m_drawHeight = m_scaledOutput ? m_vcells : m_vpixels;
+}
+
+uint32_t CellMap::mapColor(const RGBA& color) const {
+    const SDL_PixelFormat* format = m_surface->format;
+    if (!format) {
+        // Plain pixel buffers, e.g. the bench, take bytes in r, g, b, a order
+        return color.r | (color.g << 8) | (color.b << 16) | (color.a << 24);
+    }
+    return (((color.r >> format->Rloss) << format->Rshift) & format->Rmask) |
+           (((color.g >> format->Gloss) << format->Gshift) & format->Gmask) |
+           (((color.b >> format->Bloss) << format->Bshift) & format->Bmask) |
+           (((color.a >> format->Aloss) << format->Ashift) & format->Amask);
+}
 
-	for (unsigned int i = 0; i < m_pixelsPerCell; i++)
-	{
-		for (unsigned int j = 0; j < m_pixelsPerCell; j++)
-		{
-			*(pixel_ptr + j * 4) = color.r;
-			*(pixel_ptr + j * 4 + 1) = color.g;
-			*(pixel_ptr + j * 4 + 2) = color.b;
-		}
-		pixel_ptr += m_hpixels * 4;
-	}
+void CellMap::drawCell(XY xy, uint32_t pixel) {
+    uint32_t* row = (uint32_t*)m_surface->pixels + xy.y * m_cellPixels * m_pitch + xy.x * m_cellPixels;
+    if (m_cellPixels == 1) {
+        *row = pixel;
+        return;
+    }
+    for (int i = 0; i < m_cellPixels; i++) {
+        fillSpan(row, m_cellPixels, pixel);
+        row += m_pitch;
+    }
 }
 
 void CellMap::clearSurface() {
-    uint8_t* pixel_ptr = (uint8_t*)m_surface->pixels;
-    memset(pixel_ptr, 0, m_hpixels * m_vpixels * 4);
+    uint32_t* row = (uint32_t*)m_surface->pixels;
+    for (int i = 0; i < m_drawHeight; i++) {
+        fillSpan(row, m_drawWidth, m_offPixel);
+        row += m_pitch;
+    }
+}
+
+void CellMap::drawBitmap() {
+    int words = (m_hcells + 63) / 64;
+    m_rowBits.assign((size_t)words * m_vcells, 0);
+    for (size_t i = 0; i < m_litCount; i++) {
+        const XY& xy = m_visible[i];
+        m_rowBits[xy.y * words + (xy.x >> 6)] |= 1ULL << (xy.x & 63);
+    }
+    uint32_t* row = (uint32_t*)m_surface->pixels;
+    for (int y = 0; y < m_vcells; y++) {
+        fillBits(row, &m_rowBits[(size_t)y * words], m_hcells, m_onPixel, m_offPixel);
+        row += m_pitch;
+    }
+    // Columns and rows left over past the last whole cell
+    if (m_hcells < m_drawWidth) {
+        row = (uint32_t*)m_surface->pixels + m_hcells;
+        for (int y = 0; y < m_vcells; y++) {
+            fillSpan(row, m_drawWidth - m_hcells, m_offPixel);
+            row += m_pitch;
+        }
+    }
+    row = (uint32_t*)m_surface->pixels + m_vcells * m_pitch;
+    for (int y = m_vcells; y < m_drawHeight; y++) {
+        fillSpan(row, m_drawWidth, m_offPixel);
+        row += m_pitch;
+    }
 }
 
 std::pair<XY, bool> CellMap::worldXY2WindowXY(XY worldXY) {
-    Coord x = big_int_subtraction(worldXY.x, m_hoff);
-    Coord y = big_int_subtraction(worldXY.y, m_voff);
-    if (x < m_hcells && x >= 0 && y < m_vcells && y >= 0) {
-        return std::make_pair(XY(x, y), true);
+    Len x = (Len)big_int_subtraction(worldXY.x, m_hoff) >> m_cellShift;
+    Len y = (Len)big_int_subtraction(worldXY.y, m_voff) >> m_cellShift;
+    if (x < (Len)m_hcells && y < (Len)m_vcells) {
+        return std::make_pair(XY((Coord)x, (Coord)y), true);
     } else {
         return std::make_pair(XY(0, 0), false);
     }
 }
 
 void CellMap::move(const XY& xy) {
-    m_queryBox.left = big_int_addition(m_queryBox.left, xy.x);
-    m_queryBox.right = big_int_addition(m_queryBox.right, xy.x);
-    m_queryBox.top = big_int_addition(m_queryBox.top, xy.y);
-    m_queryBox.bottom = big_int_addition(m_queryBox.bottom, xy.y);
+    // Every cell on the surface shifts
+    m_redrawAll = true;
+
+    Coord dx = (Coord)((Len)xy.x << m_cellShift);
+    Coord dy = (Coord)((Len)xy.y << m_cellShift);
+    m_queryBox.left = big_int_addition(m_queryBox.left, dx);
+    m_queryBox.right = big_int_addition(m_queryBox.right, dx);
+    m_queryBox.top = big_int_addition(m_queryBox.top, dy);
+    m_queryBox.bottom = big_int_addition(m_queryBox.bottom, dy);
     m_queryBox.center.x = big_int_average(m_queryBox.left, m_queryBox.right);
     m_queryBox.center.y = big_int_average(m_queryBox.top, m_queryBox.bottom);
 
-    m_hoff = big_int_addition(m_hoff, xy.x);
-    m_voff = big_int_addition(m_voff, xy.y);
+    m_hoff = big_int_addition(m_hoff, dx);
+    m_voff = big_int_addition(m_voff, dy);
 }
 
-void CellMap::update() {
-    // Query
-    std::vector<CellRef> cells;
-    m_celltree->query(m_queryBox, cells);
+void CellMap::zoomIn() {
+    if (m_cellShift > 0) {
+        setZoom(1, m_cellShift - 1);
+    } else if (m_pixelsPerCell < kMaxPixelsPerCell) {
+        int pixels = 1;
+        while (pixels <= m_pixelsPerCell) {
+            pixels *= 2;
+        }
+        setZoom(pixels, 0);
+    }
+}
+
+void CellMap::zoomOut() {
+    if (m_pixelsPerCell > 1) {
+        int pixels = 1;
+        while (pixels * 2 < m_pixelsPerCell) {
+            pixels *= 2;
+        }
+        setZoom(pixels, 0);
+    } else if (m_cellShift < kMaxCellShift) {
+        setZoom(1, m_cellShift + 1);
+    }
+}
+
+void CellMap::setZoom(int pixelsPerCell, unsigned cellShift) {
+    m_redrawAll = true;
+
+    // World cell at the window center
+    Coord centerX = big_int_addition(m_hoff, (Coord)(((Len)m_hcells << m_cellShift) / 2));
+    Coord centerY = big_int_addition(m_voff, (Coord)(((Len)m_vcells << m_cellShift) / 2));
 
-    // Clear
-    this->clearSurface();
+    m_pixelsPerCell = pixelsPerCell;
+    m_cellShift = cellShift;
+    m_hcells = m_hpixels / pixelsPerCell;
+    m_vcells = m_vpixels / pixelsPerCell;
+    updateDrawArea();
+    Len width = (Len)m_hcells << cellShift;
+    Len height = (Len)m_vcells << cellShift;
 
-    // Draw
-    for (auto& cell : cells) {
-        auto result = this->worldXY2WindowXY(cell->xy);
+    // Pixels start on multiples of their side, like the nodes of an
+    // aligned tree
+    Coord align = ~(Coord)(((Len)1 << cellShift) - 1);
+    m_hoff = big_int_subtraction(centerX, (Coord)(width / 2)) & align;
+    m_voff = big_int_subtraction(centerY, (Coord)(height / 2)) & align;
+
+    // The box cannot wrap, the far side is cut at the Coord limits
+    m_queryBox.left = m_hoff;
+    m_queryBox.top = m_voff;
+    m_queryBox.right = big_int_addition(m_hoff, (Coord)(width - 1));
+    m_queryBox.bottom = big_int_addition(m_voff, (Coord)(height - 1));
+    if (m_queryBox.right < m_queryBox.left) {
+        m_queryBox.right = MAX;
+    }
+    if (m_queryBox.bottom < m_queryBox.top) {
+        m_queryBox.bottom = MAX;
+    }
+    m_queryBox.center.x = big_int_average(m_queryBox.left, m_queryBox.right);
+    m_queryBox.center.y = big_int_average(m_queryBox.top, m_queryBox.bottom);
+}
+
+void CellMap::draw(const std::vector<XY>& cells) {
+    static const std::vector<XY> noDecaying;
+    static const std::vector<uint8_t> noStages;
+    draw(cells, noDecaying, noStages);
+}
+
+void CellMap::draw(const std::vector<XY>& cells, const std::vector<XY>& decaying,
+                   const std::vector<uint8_t>& stages) {
+    // Live cells first, then decaying ones, each with its value in
+    // m_cellStates
+    m_visible.clear();
+    m_visibleValues.clear();
+    for (auto& xy : cells) {
+        auto result = this->worldXY2WindowXY(xy);
         if (result.second) {
-            this->drawCell(result.first, kOnColor);
+            m_visible.push_back(result.first);
+        }
+    }
+    m_litCount = m_visible.size();
+    m_visibleValues.assign(m_litCount, kCellLit);
+    for (size_t i = 0; i < decaying.size(); i++) {
+        auto result = this->worldXY2WindowXY(decaying[i]);
+        if (result.second) {
+            m_visible.push_back(result.first);
+            m_visibleValues.push_back((uint8_t)(kCellLit + std::min<int>(stages[i], kMaxRuleStates - 2)));
+        }
+    }
+
+    m_dirtyRects.clear();
+    if (m_redrawAll || m_drawnDensity) {
+        m_drawnDensity = false;
+        m_cellStates.assign(m_hcells * m_vcells, kCellClear);
+        for (size_t i = 0; i < m_visible.size(); i++) {
+            m_cellStates[m_visible[i].y * m_hcells + m_visible[i].x] = m_visibleValues[i];
         }
+        if (m_cellPixels == 1) {
+            this->drawBitmap();
+            for (size_t i = m_litCount; i < m_visible.size(); i++) {
+                this->drawCell(m_visible[i], m_statePixels[m_visibleValues[i]]);
+            }
+        } else {
+            // Clear
+            this->clearSurface();
+
+            // Draw
+            for (size_t i = 0; i < m_visible.size(); i++) {
+                this->drawCell(m_visible[i], m_statePixels[m_visibleValues[i]]);
+            }
+        }
+        SDL_Rect all = {0, 0, m_drawWidth, m_drawHeight};
+        m_dirtyRects.push_back(all);
+        m_redrawAll = false;
+    } else {
+        // Paint the cells whose value changed only
+        int tiles = ((m_hcells + kDirtyTileCells - 1) / kDirtyTileCells) *
+                    ((m_vcells + kDirtyTileCells - 1) / kDirtyTileCells);
+        m_dirtyTiles.assign(tiles, 0);
+        for (size_t i = 0; i < m_visible.size(); i++) {
+            const XY& xy = m_visible[i];
+            uint8_t& state = m_cellStates[xy.y * m_hcells + xy.x];
+            if (state != m_visibleValues[i]) {
+                this->drawCell(xy, m_statePixels[m_visibleValues[i]]);
+                markDirty(xy);
+            }
+            state = m_visibleValues[i] | kCellKept;
+        }
+        for (auto& xy : m_drawn) {
+            uint8_t& state = m_cellStates[xy.y * m_hcells + xy.x];
+            if (state != kCellClear && !(state & kCellKept)) {
+                this->drawCell(xy, m_offPixel);
+                markDirty(xy);
+                state = kCellClear;
+            }
+        }
+        for (auto& xy : m_visible) {
+            m_cellStates[xy.y * m_hcells + xy.x] &= ~kCellKept;
+        }
+        collectDirtyRects();
+    }
+    m_drawn.swap(m_visible);
+}
+
+// Any live cell shows, brighter up to half of the pixel's cells alive
+static uint8_t densityShade(uint64_t count, unsigned shift) {
+    constexpr uint64_t kMinShade = 64;
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t area = 1ULL << (2 * shift);
+    return (uint8_t)(kMinShade + (255 - kMinShade) * std::min(count * 2, area) / area);
+}
+
+void CellMap::drawDensity(const DensityGrid& grid) {
+    if (grid.shift != m_cellShift) {
+        throw std::runtime_error("Density grid does not match the zoom");
+    }
+    size_t pixels = (size_t)m_hcells * m_vcells;
+    bool all = m_redrawAll || !m_drawnDensity || m_shades.size() != pixels;
+    m_dirtyRects.clear();
+    if (all) {
+        m_shades.assign(pixels, 0);
+        this->clearSurface();
+    } else {
+        int tiles = ((m_hcells + kDirtyTileCells - 1) / kDirtyTileCells) *
+                    ((m_vcells + kDirtyTileCells - 1) / kDirtyTileCells);
+        m_dirtyTiles.assign(tiles, 0);
+    }
+
+    for (int y = 0; y < m_vcells; y++) {
+        for (int x = 0; x < m_hcells; x++) {
+            // A grid cut at the Coord limits is narrower than the window
+            uint64_t count = (x < grid.columns && y < grid.rows) ? grid.counts[y * grid.columns + x] : 0;
+            uint8_t shade = densityShade(count, m_cellShift);
+            uint8_t& drawn = m_shades[y * m_hcells + x];
+            if (shade == drawn) {
+                continue;
+            }
+            drawn = shade;
+            RGBA color(kOnColor.r * shade / 255, kOnColor.g * shade / 255, kOnColor.b * shade / 255, kOnColor.a);
+            this->drawCell(XY(x, y), mapColor(color));
+            if (!all) {
+                markDirty(XY(x, y));
+            }
+        }
+    }
+
+    if (all) {
+        SDL_Rect rect = {0, 0, m_drawWidth, m_drawHeight};
+        m_dirtyRects.push_back(rect);
+        m_redrawAll = false;
+        m_drawnDensity = true;
+    } else {
+        collectDirtyRects();
+    }
+}
+
+void CellMap::markDirty(const XY& xy) {
+    int columns = (m_hcells + kDirtyTileCells - 1) / kDirtyTileCells;
+    m_dirtyTiles[(xy.y / kDirtyTileCells) * columns + xy.x / kDirtyTileCells] = 1;
+}
+
+void CellMap::collectDirtyRects() {
+    int columns = (m_hcells + kDirtyTileCells - 1) / kDirtyTileCells;
+    int rows = (m_vcells + kDirtyTileCells - 1) / kDirtyTileCells;
+    int tilePixels = kDirtyTileCells * m_cellPixels;
+    for (int row = 0; row < rows; row++) {
+        size_t rowStart = m_dirtyRects.size();
+        for (int column = 0; column < columns;) {
+            if (!m_dirtyTiles[row * columns + column]) {
+                column++;
+                continue;
+            }
+            // Runs of dirty tiles in a row become one rect
+            int end = column;
+            while (end < columns && m_dirtyTiles[row * columns + end]) {
+                end++;
+            }
+            SDL_Rect rect;
+            rect.x = column * tilePixels;
+            rect.y = row * tilePixels;
+            rect.w = std::min(end * tilePixels, m_drawWidth) - rect.x;
+            rect.h = std::min((row + 1) * tilePixels, m_drawHeight) - rect.y;
+            column = end;
+
+            // and extend a rect ending right above with the same span
+            // instead when there is one
+            bool merged = false;
+            for (size_t i = 0; i < rowStart; i++) {
+                SDL_Rect& above = m_dirtyRects[i];
+                if (above.x == rect.x && above.w == rect.w && above.y + above.h == rect.y) {
+                    above.h += rect.h;
+                    merged = true;
+                    break;
+                }
+            }
+            if (!merged) {
+                m_dirtyRects.push_back(rect);
+            }
+        }
+    }
+}
+
+void CellMap::update() {
+    auto start = std::chrono::steady_clock::now();
+
+    // Query, zoomed out by subtree populations rather than cells
+    std::vector<XY> cells;
+    if (m_cellShift > 0) {
+        m_density.reset(XY(m_hoff, m_voff), m_cellShift, m_hcells, m_vcells);
+        m_engine->queryDensity(m_density);
+    } else {
+        m_engine->query(m_queryBox, cells);
+        m_decaying.clear();
+        m_stages.clear();
+        m_engine->queryDecaying(m_queryBox, m_decaying, m_stages);
+    }
+    auto queried = std::chrono::steady_clock::now();
+
+    if (m_cellShift > 0) {
+        this->drawDensity(m_density);
+    } else {
+        this->draw(cells, m_decaying, m_stages);
     }
     if (m_iteration == m_printAtIteration) {
-        m_celltree->print(std::cout);
+        m_engine->print(std::cout);
     }
+    auto drawn = std::chrono::steady_clock::now();
 
     // Update celltree according to the rules
-    m_celltree->update();
+    m_engine->update();
+    auto updated = std::chrono::steady_clock::now();
 
+    m_frameTimes.query += std::chrono::duration<double>(queried - start).count();
+    m_frameTimes.draw += std::chrono::duration<double>(drawn - queried).count();
+    m_frameTimes.update += std::chrono::duration<double>(updated - drawn).count();
     m_iteration++;
 }
 
-CellTreeNode::CellTreeNode(AABB ibbox, bool root)
-    : m_bbox(ibbox), m_root(root) {}
+bool ParseEngineKind(const std::string& name, EngineKind& kind) {
+    if (name == "quadtree") {
+        kind = EngineKind::QuadTree;
+    } else if (name == "hashlife") {
+        kind = EngineKind::HashLife;
+    } else if (name == "tile") {
+        kind = EngineKind::Tile;
+    } else if (name == "morton") {
+        kind = EngineKind::Morton;
+    } else if (name == "ltl") {
+        kind = EngineKind::LargerThanLife;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+LifeEngineUniq CreateEngine(EngineKind kind) {
+    switch (kind) {
+    case EngineKind::HashLife:
+        return std::make_unique<HashLifeEngine>();
+    case EngineKind::Tile:
+        return std::make_unique<TileEngine>();
+    case EngineKind::Morton:
+        return std::make_unique<MortonEngine>();
+    case EngineKind::LargerThanLife:
+        return std::make_unique<LtlEngine>();
+    case EngineKind::QuadTree:
+    default:
+        return std::make_unique<CellTreeEngine>();
+    }
+}
+
+void LifeEngine::step(unsigned log2Generations) {
+    for (uint64_t i = 0; i < (1ULL << log2Generations); i++) {
+        update();
+    }
+}
+
+void LifeEngine::addCells(const std::vector<XY>& cells) {
+    for (auto& xy : cells) {
+        addCell(xy);
+    }
+}
+
+void CellTreeEngine::addCells(const std::vector<XY>& cells) {
+    std::vector<CellRef> refs;
+    refs.reserve(cells.size());
+    for (auto& xy : cells) {
+        refs.push_back(m_celltree->newCell(xy, 1));
+    }
+    m_celltree->insertBatch(refs);
+}
+
+void LifeEngine::queryDensity(DensityGrid& grid) {
+    std::fill(grid.counts.begin(), grid.counts.end(), 0);
+    if (grid.columns <= 0 || grid.rows <= 0) {
+        return;
+    }
+
+    // A grid straddling the Coord limits needs a box on either side
+    std::vector<std::pair<Coord, Coord>> columns;
+    std::vector<std::pair<Coord, Coord>> rows;
+    Coord right = big_int_addition(grid.origin.x, (Coord)(((Len)grid.columns << grid.shift) - 1));
+    Coord bottom = big_int_addition(grid.origin.y, (Coord)(((Len)grid.rows << grid.shift) - 1));
+    if (right < grid.origin.x) {
+        columns.emplace_back(grid.origin.x, MAX);
+        columns.emplace_back(MIN, right);
+    } else {
+        columns.emplace_back(grid.origin.x, right);
+    }
+    if (bottom < grid.origin.y) {
+        rows.emplace_back(grid.origin.y, MAX);
+        rows.emplace_back(MIN, bottom);
+    } else {
+        rows.emplace_back(grid.origin.y, bottom);
+    }
+
+    std::vector<XY> cells;
+    for (auto& column : columns) {
+        for (auto& row : rows) {
+            AABB box(XY(big_int_average(column.first, column.second), big_int_average(row.first, row.second)),
+                     column.first, column.second, row.first, row.second);
+            cells.clear();
+            query(box, cells);
+            for (auto& xy : cells) {
+                grid.add(xy, 1);
+            }
+        }
+    }
+}
+
+void CellTreeEngine::queryDensity(DensityGrid& grid) {
+    std::fill(grid.counts.begin(), grid.counts.end(), 0);
+    m_celltree->queryDensity(grid);
+}
+
+void LifeEngine::setRule(const Rule& rule) {
+    if (rule.states > 2 && !supportsGenerations()) {
+        throw std::runtime_error("Generations rule " + rule.toString() + " needs the quadtree engine");
+    }
+    m_rule = rule;
+}
+
+void CellTreeEngine::setRule(const Rule& rule) {
+    LifeEngine::setRule(rule);
+    m_celltree->unsettle();
+}
+
+void CellTreeEngine::query(const AABB& range, std::vector<XY>& output) {
+    std::vector<CellRef> cells;
+    m_celltree->query(range, cells);
+    for (auto& ref : cells) {
+        Cell& cell = m_celltree->cell(ref);
+        if (GetCellDecay(cell.state) == 0) {
+            output.push_back(cell.xy);
+        }
+    }
+}
+
+void CellTreeEngine::queryDecaying(const AABB& range, std::vector<XY>& output, std::vector<uint8_t>& stages) {
+    if (m_rule.states <= 2) {
+        return;
+    }
+    std::vector<CellRef> cells;
+    m_celltree->query(range, cells);
+    for (auto& ref : cells) {
+        Cell& cell = m_celltree->cell(ref);
+        if (GetCellDecay(cell.state) != 0) {
+            output.push_back(cell.xy);
+            stages.push_back(GetCellDecay(cell.state));
+        }
+    }
+}
+
+CellRef CellPool::allocate(const XY& xy, CellState state) {
+    if (m_free != kNullCell) {
+        CellRef ref = m_free;
+        m_free = m_cells[ref].next;
+        m_freeCount--;
+        m_cells[ref] = Cell(xy, state);
+        return ref;
+    }
+    if (m_cells.size() >= kNullCell) {
+        throw std::runtime_error("Cell pool exhausted");
+    }
+    m_cells.emplace_back(xy, state);
+    return (CellRef)(m_cells.size() - 1);
+}
+
+void CellPool::release(CellRef ref) {
+    m_cells[ref].next = m_free;
+    m_free = ref;
+    m_freeCount++;
+}
+
+void CellList::push(CellPool& pool, CellRef ref) {
+    pool[ref].next = m_head;
+    m_head = ref;
+    m_size++;
+}
+
+bool CellList::erase(CellPool& pool, CellRef ref) {
+    CellRef* link = &m_head;
+    while (*link != kNullCell) {
+        if (*link == ref) {
+            *link = pool[ref].next;
+            pool[ref].next = kNullCell;
+            m_size--;
+            return true;
+        }
+        link = &pool[*link].next;
+    }
+    return false;
+}
+
+CellTreeNode::CellTreeNode(AABB ibbox, bool root, CellTreeStore* store)
+    : m_bbox(ibbox), m_root(root), m_store(store) {
+    if (!m_store) {
+        m_ownedStore = std::make_unique<CellTreeStore>();
+        m_store = m_ownedStore.get();
+    }
+}
+
+CellTreeNode::~CellTreeNode() {
+    // Children go back to the store before the root drops it
+    if (m_nw) {
+        m_store->nodes.destroy(m_nw);
+        m_store->nodes.destroy(m_ne);
+        m_store->nodes.destroy(m_sw);
+        m_store->nodes.destroy(m_se);
+    }
+}
 
 CellTreeNodeRef CellTreeNode::createRoot() {
     AABB rootbb = AABB(XY(0,0), MIN, MAX, MIN, MAX);
@@ -162,10 +737,15 @@ CellTreeNodeRef CellTreeNode::createRoot() {
     return std::make_shared<CellTreeNode>(rootbb, true);
 }
 
+CellRef CellTreeNode::newCell(const XY& xy, CellState state) {
+    return m_store->cells.allocate(xy, state);
+}
+
 bool CellTreeNode::insert(CellRef cell) {
     // Insert a new cell
+    const XY xy = this->cell(cell).xy;
 
-    if (!m_bbox.contains(cell->xy)) {
+    if (!m_bbox.contains(xy)) {
         // Not within bounds
         return false;
     }
@@ -187,15 +767,15 @@ bool CellTreeNode::insert(CellRef cell) {
     }
 
     if (insert) {
-        auto result = m_cells.insert(cell);
-        if (!result.second) {
-            throw std::runtime_error("Unable to insert cell to node");
-        }
+        m_cells.push(m_store->cells, cell);
+        m_population++;
+        m_decaying += GetCellDecay(this->cell(cell).state) != 0;
         if (m_root) {
-            auto result = m_cells_map.insert(std::make_pair(cell->xy, cell));
+            auto result = m_cells_map.insert(std::make_pair(xy, cell));
             if (!result.second) {
                 throw std::runtime_error("Unable to insert cell to root node");
             }
+            touch(xy);
         }
         return true;
     }
@@ -204,13 +784,16 @@ bool CellTreeNode::insert(CellRef cell) {
         subdivide();
 
     // Before inserting this cell, inserting all existing cells to the new children
-    for (auto& old_cell : m_cells) {
+    for (CellRef old_cell = m_cells.head(); old_cell != kNullCell;) {
+        // Children relink the cell, step first
+        CellRef next = this->cell(old_cell).next;
         if (!m_nw->insert(old_cell)
             && !m_ne->insert(old_cell)
             && !m_sw->insert(old_cell)
             && !m_se->insert(old_cell)) {
             throw std::runtime_error("Unable to insert old cells to children");
         }
+        old_cell = next;
     }
     m_cells.clear();
 
@@ -219,11 +802,14 @@ bool CellTreeNode::insert(CellRef cell) {
         || m_ne->insert(cell)
         || m_sw->insert(cell)
         || m_se->insert(cell)) {
+        m_population++;
+        m_decaying += GetCellDecay(this->cell(cell).state) != 0;
         if (m_root){
-            auto result = m_cells_map.insert(std::make_pair(cell->xy, cell));
+            auto result = m_cells_map.insert(std::make_pair(xy, cell));
             if (!result.second) {
                 throw std::runtime_error("Unable to insert cell to root node");
             }
+            touch(xy);
         }
         return true;
     } else {
@@ -234,6 +820,231 @@ bool CellTreeNode::insert(CellRef cell) {
     return false;
 }
 
+void CellTreeNode::sortMorton(std::vector<CellRef>& cells) {
+    std::vector<std::pair<MortonKey, CellRef>> keyed;
+    keyed.reserve(cells.size());
+    for (auto& ref : cells) {
+        keyed.emplace_back(MortonEncode(this->cell(ref).xy), ref);
+    }
+    std::sort(keyed.begin(), keyed.end(),
+              [](const std::pair<MortonKey, CellRef>& a, const std::pair<MortonKey, CellRef>& b) {
+                  return a.first < b.first;
+              });
+    for (size_t i = 0; i < keyed.size(); i++) {
+        cells[i] = keyed[i].second;
+    }
+}
+
+// Part of box a inside box b, the two must overlap
+static AABB clipBox(const AABB& a, const AABB& b) {
+    return AABB(a.center, std::max(a.left, b.left), std::min(a.right, b.right),
+                std::max(a.top, b.top), std::min(a.bottom, b.bottom));
+}
+
+// Bounding box of a batch, which must not be empty
+AABB CellTreeNode::extentOf(const std::vector<CellRef>& cells) {
+    const XY& first = this->cell(cells.front()).xy;
+    AABB extent(first, first.x, first.x, first.y, first.y);
+    for (auto& ref : cells) {
+        const XY& xy = this->cell(ref).xy;
+        extent.left = std::min(extent.left, xy.x);
+        extent.right = std::max(extent.right, xy.x);
+        extent.top = std::min(extent.top, xy.y);
+        extent.bottom = std::max(extent.bottom, xy.y);
+    }
+    return extent;
+}
+
+size_t CellTreeNode::countDecaying(const CellRef* begin, const CellRef* end) {
+    size_t result = 0;
+    for (const CellRef* it = begin; it != end; it++) {
+        result += GetCellDecay(this->cell(*it).state) != 0;
+    }
+    return result;
+}
+
+void CellTreeNode::startDecay(const XY& xy) {
+    // Same quadrants as subdivide() and partitionChildren()
+    for (CellTreeNode* node = this; node; ) {
+        node->m_decaying++;
+        if (!node->m_nw) {
+            break;
+        }
+        bool south = xy.y > node->m_bbox.center.y;
+        bool east = xy.x > node->m_bbox.center.x;
+        node = south ? (east ? node->m_se : node->m_sw) : (east ? node->m_ne : node->m_nw);
+    }
+}
+
+void CellTreeNode::partitionChildren(CellRef* begin, CellRef* end, const AABB& extent, CellRef* split[5],
+                                     std::vector<CellRef>& scratch) {
+    const XY& center = m_bbox.center;
+    if ((extent.right <= center.x || extent.left > center.x) &&
+        (extent.bottom <= center.y || extent.top > center.y)) {
+        // Everything goes to one child, the order stays
+        int child = (extent.top > center.y) * 2 + (extent.left > center.x);
+        for (int q = 0; q <= 4; q++) {
+            split[q] = q <= child ? begin : end;
+        }
+        return;
+    }
+
+    // Stable counting sort into nw, ne, sw, se so each child keeps the
+    // Morton order of its cells. Quadrant borders are the subdivide() ones.
+    size_t n = end - begin;
+    if (scratch.size() < n) {
+        scratch.resize(n);
+    }
+    size_t count[4] = {0, 0, 0, 0};
+    for (CellRef* it = begin; it != end; it++) {
+        const XY& xy = this->cell(*it).xy;
+        count[(xy.y > m_bbox.center.y) * 2 + (xy.x > m_bbox.center.x)]++;
+    }
+    size_t offset[4] = {0, count[0], count[0] + count[1], count[0] + count[1] + count[2]};
+    for (int q = 0; q < 4; q++) {
+        split[q] = begin + offset[q];
+    }
+    split[4] = end;
+    for (CellRef* it = begin; it != end; it++) {
+        const XY& xy = this->cell(*it).xy;
+        scratch[offset[(xy.y > m_bbox.center.y) * 2 + (xy.x > m_bbox.center.x)]++] = *it;
+    }
+    std::copy(scratch.begin(), scratch.begin() + n, begin);
+}
+
+void CellTreeNode::insertRange(CellRef* begin, CellRef* end, const AABB& extent, std::vector<CellRef>& scratch) {
+    size_t n = end - begin;
+    size_t decaying = countDecaying(begin, end);
+    bool small = (big_int_distance(m_bbox.bottom, m_bbox.top)) < 2 || (big_int_distance(m_bbox.right, m_bbox.left)) < 2;
+
+    if (m_nw == nullptr && (small || m_cells.size() + n <= kNodeCapacity)) {
+        for (CellRef* it = begin; it != end; it++) {
+            m_cells.push(m_store->cells, *it);
+        }
+        m_population += n;
+        m_decaying += decaying;
+        return;
+    }
+
+    std::vector<CellRef> merged;
+    AABB bounds = extent;
+    if (m_nw == nullptr) {
+        // Overflowing leaf, its cells go down together with the batch
+        subdivide();
+        merged.assign(begin, end);
+        for (CellRef cell = m_cells.head(); cell != kNullCell; cell = this->cell(cell).next) {
+            merged.push_back(cell);
+            const XY& xy = this->cell(cell).xy;
+            bounds.left = std::min(bounds.left, xy.x);
+            bounds.right = std::max(bounds.right, xy.x);
+            bounds.top = std::min(bounds.top, xy.y);
+            bounds.bottom = std::max(bounds.bottom, xy.y);
+        }
+        m_cells.clear();
+        begin = merged.data();
+        end = merged.data() + merged.size();
+    }
+
+    CellRef* split[5];
+    partitionChildren(begin, end, bounds, split, scratch);
+    CellTreeNode* children[4] = {m_nw, m_ne, m_sw, m_se};
+    for (int q = 0; q < 4; q++) {
+        if (split[q] != split[q + 1]) {
+            children[q]->insertRange(split[q], split[q + 1], clipBox(bounds, children[q]->m_bbox), scratch);
+        }
+    }
+    m_population += n;
+    m_decaying += decaying;
+}
+
+void CellTreeNode::removeRange(CellRef* begin, CellRef* end, const AABB& extent, std::vector<CellRef>& scratch) {
+    size_t n = end - begin;
+    size_t decaying = countDecaying(begin, end);
+
+    if (m_nw == nullptr) {
+        for (CellRef* it = begin; it != end; it++) {
+            if (!m_cells.erase(m_store->cells, *it)) {
+                throw std::runtime_error("Unable to remove cell from a node, check the algorithm");
+            }
+        }
+        m_population -= n;
+        m_decaying -= decaying;
+        return;
+    }
+
+    CellRef* split[5];
+    partitionChildren(begin, end, extent, split, scratch);
+    CellTreeNode* children[4] = {m_nw, m_ne, m_sw, m_se};
+    for (int q = 0; q < 4; q++) {
+        if (split[q] != split[q + 1]) {
+            children[q]->removeRange(split[q], split[q + 1], clipBox(extent, children[q]->m_bbox), scratch);
+        }
+    }
+    m_population -= n;
+    m_decaying -= decaying;
+
+    // Children are done, merge bottom-up
+    if (m_population <= kNodeCapacity) {
+        merge();
+    }
+}
+
+void CellTreeNode::insertBatch(std::vector<CellRef>& cells) {
+    insertCells(cells);
+    if (m_root) {
+        for (auto& ref : cells) {
+            touch(this->cell(ref).xy);
+        }
+    }
+}
+
+void CellTreeNode::removeBatch(std::vector<CellRef>& cells) {
+    removeCells(cells);
+    if (m_root) {
+        for (auto& ref : cells) {
+            touch(this->cell(ref).xy);
+        }
+    }
+}
+
+void CellTreeNode::insertCells(std::vector<CellRef>& cells) {
+    if (cells.empty()) {
+        return;
+    }
+    for (auto& ref : cells) {
+        if (!m_bbox.contains(this->cell(ref).xy)) {
+            throw std::runtime_error("Unable to insert a cell");
+        }
+    }
+    if (m_root) {
+        for (auto& ref : cells) {
+            auto result = m_cells_map.insert(std::make_pair(this->cell(ref).xy, ref));
+            if (!result.second) {
+                throw std::runtime_error("Unable to insert cell to root node");
+            }
+        }
+    }
+
+    sortMorton(cells);
+    std::vector<CellRef> scratch(cells.size());
+    insertRange(cells.data(), cells.data() + cells.size(), extentOf(cells), scratch);
+}
+
+void CellTreeNode::removeCells(std::vector<CellRef>& cells) {
+    if (cells.empty()) {
+        return;
+    }
+    for (auto& ref : cells) {
+        if (!m_bbox.contains(this->cell(ref).xy)) {
+            throw std::runtime_error("Unable to remove cell from a node, check the algorithm");
+        }
+    }
+
+    sortMorton(cells);
+    std::vector<CellRef> scratch(cells.size());
+    removeRange(cells.data(), cells.data() + cells.size(), extentOf(cells), scratch);
+}
+
 void CellTreeNode::subdivide() {
     if (m_nw == nullptr) {
         {
@@ -243,7 +1054,7 @@ void CellTreeNode::subdivide() {
             Coord top = m_bbox.top;
             Coord bottom = m_bbox.center.y;
             XY center = XY(big_int_average(left, right), big_int_average(top, bottom));
-            m_nw = std::make_unique<CellTreeNode>(AABB(center, left, right, top, bottom));
+            m_nw = m_store->nodes.create(AABB(center, left, right, top, bottom), false, m_store);
         }
         {
             // North East
@@ -252,7 +1063,7 @@ void CellTreeNode::subdivide() {
             Coord top = m_bbox.top;
             Coord bottom = m_bbox.center.y;
             XY center = XY(big_int_average(left, right), big_int_average(top, bottom));
-            m_ne = std::make_unique<CellTreeNode>(AABB(center, left, right, top, bottom));
+            m_ne = m_store->nodes.create(AABB(center, left, right, top, bottom), false, m_store);
         }
         {
             // South West
@@ -261,7 +1072,7 @@ void CellTreeNode::subdivide() {
             Coord top = big_int_addition(m_bbox.center.y, 1);
             Coord bottom = m_bbox.bottom;
             XY center = XY(big_int_average(left, right), big_int_average(top, bottom));
-            m_sw = std::make_unique<CellTreeNode>(AABB(center, left, right, top, bottom));
+            m_sw = m_store->nodes.create(AABB(center, left, right, top, bottom), false, m_store);
         }
         {
             // South East
@@ -270,23 +1081,23 @@ void CellTreeNode::subdivide() {
             Coord top = big_int_addition(m_bbox.center.y, 1);
             Coord bottom = m_bbox.bottom;
             XY center = XY(big_int_average(left, right), big_int_average(top, bottom));
-            m_se = std::make_unique<CellTreeNode>(AABB(center, left, right, top, bottom));
+            m_se = m_store->nodes.create(AABB(center, left, right, top, bottom), false, m_store);
         }
     }
 }
 
 size_t CellTreeNode::cellCount() {
-    if (m_nw) {
-        return m_nw->cellCount()
-            + m_ne->cellCount()
-            + m_sw->cellCount()
-            + m_se->cellCount();
-    } else {
-        return m_cells.size();
-    }
+    return m_population;
 }
 
 bool CellTreeNode::remove(CellRef cell) {
+    if (!m_bbox.contains(this->cell(cell).xy)) {
+        return false;
+    }
+    if (m_root) {
+        touch(this->cell(cell).xy);
+    }
+
     if (m_nw) {
         // Subdivided, i.e. not a leaf node
         if (!m_nw->remove(cell)
@@ -295,25 +1106,22 @@ bool CellTreeNode::remove(CellRef cell) {
             && !m_se->remove(cell)) {
             return false;
         }
+        m_population--;
+        m_decaying -= GetCellDecay(this->cell(cell).state) != 0;
 
         // Merge
-        if ((m_nw->cellCount()
-             + m_ne->cellCount()
-             + m_sw->cellCount()
-             + m_se->cellCount()) <= kNodeCapacity) {
+        if (m_population <= kNodeCapacity) {
             merge();
         }
 
         return true;
 
     } else {
-        if (!m_bbox.contains(cell->xy)) {
-            return false;
-        }
-        auto result = m_cells.erase(cell);
-        if (result != 1) {
+        if (!m_cells.erase(m_store->cells, cell)) {
             throw std::runtime_error("Unable to remove cell from a node, check the algorithm");
         }
+        m_population--;
+        m_decaying -= GetCellDecay(this->cell(cell).state) != 0;
         return true;
     }
 
@@ -322,42 +1130,268 @@ bool CellTreeNode::remove(CellRef cell) {
 }
 
 void CellTreeNode::merge() {
-    CellTreeNode* children[4] = {m_nw.get(), m_ne.get(), m_sw.get(), m_se.get()};
+    CellTreeNode* children[4] = {m_nw, m_ne, m_sw, m_se};
     for (auto& child : children) {
-        for (auto& cell : child->m_cells) {
-            auto result = m_cells.insert(cell);
-            if (!result.second) {
-                throw std::runtime_error("Unable to transfer cells from child to parent");
-            }
+        if (child->m_nw) {
+            child->merge();
+        }
+        for (CellRef cell = child->m_cells.head(); cell != kNullCell;) {
+            CellRef next = this->cell(cell).next;
+            m_cells.push(m_store->cells, cell);
+            cell = next;
         }
+        child->m_cells.clear();
+        m_store->nodes.destroy(child);
     }
 
     m_nw = nullptr;
-    m_se = nullptr;
+    m_ne = nullptr;
     m_sw = nullptr;
     m_se = nullptr;
 }
 
-void CellTreeNode::update() {
+// Generations a block is recomputed after cells were added or removed
+// outside update(): one to leave the unknown state and two more before
+// both change lists describe real generations
+constexpr uint8_t kUnsettledGenerations = 3;
+
+enum BlockKind : uint8_t {
+    // Nothing nearby changed, stays as it is
+    kBlockSettled,
+    // Neighborhood repeats with period 2, undo the last change
+    kBlockReplay,
+    // Recompute cell by cell
+    kBlockCompute,
+    // Recompute, and so are all 8 neighbors
+    kBlockSurrounded
+};
+
+// Top left corner of the block holding xy
+static XY blockOf(const XY& xy) {
+    return XY(xy.x & ~(kActiveBlockSize - 1), xy.y & ~(kActiveBlockSize - 1));
+}
+
+static AABB blockBox(const XY& block) {
+    // Blocks are aligned, so the far edges never wrap
+    Coord right = block.x + (kActiveBlockSize - 1);
+    Coord bottom = block.y + (kActiveBlockSize - 1);
+    return AABB(XY(block.x + kActiveBlockSize / 2, block.y + kActiveBlockSize / 2),
+                block.x, right, block.y, bottom);
+}
+
+// The block and its 8 neighbors
+static void blockNeighborhood(const XY& block, XY around[9]) {
+    int i = 0;
+    for (Coord dy = -kActiveBlockSize; dy <= kActiveBlockSize; dy += kActiveBlockSize) {
+        for (Coord dx = -kActiveBlockSize; dx <= kActiveBlockSize; dx += kActiveBlockSize) {
+            around[i++] = XY(big_int_addition(block.x, dx), big_int_addition(block.y, dy));
+        }
+    }
+}
+
+// What a block's history rules out for the blocks around it. A cell only
+// sees its neighbors, so if a block's neighborhood is as it was one
+// generation ago the block is too, and if it is as it was two generations
+// ago the block goes back to the previous generation.
+constexpr uint8_t kBlockNotStill = 1;
+constexpr uint8_t kBlockNotPeriod2 = 2;
+
+static uint8_t blockConstraints(const ActiveBlock& history) {
+    if (history.unsettled > 0) {
+        return kBlockNotStill | kBlockNotPeriod2;
+    }
+    uint8_t constraints = 0;
+    if (!history.changes.empty()) {
+        constraints |= kBlockNotStill;
+    }
+    if (history.changes != history.prevChanges) {
+        constraints |= kBlockNotPeriod2;
+    }
+    return constraints;
+}
+
+static bool lessXY(const XY& a, const XY& b) {
+    return a.x < b.x || (a.x == b.x && a.y < b.y);
+}
+
+void CellTreeNode::touch(const XY& xy) {
+    auto result = m_activity.insert(std::make_pair(blockOf(xy), ActiveBlock()));
+    result.first->second.unsettled = kUnsettledGenerations;
+}
+
+void CellTreeNode::unsettle() {
+    for (auto it = m_cells_map.begin(); it != m_cells_map.end(); it++) {
+        touch(it->first);
+    }
+}
+
+// Steps 6 and 7 of update(), one loop per rule kernel
+template<class Kernel>
+static void applyRule(const Kernel& kernel, CellPool& pool, const std::vector<CellRef>& targets,
+                      CellIndex& newmap, ActivityMap& activity,
+                      std::vector<CellRef>& pendingRemoveCells, std::vector<CellRef>& births) {
+    // 6. Prune dead cells of recomputed blocks
+    for (auto& ref : targets) {
+        UpdateCellAliveness(pool[ref].state, kernel);
+        if (!GetCellAliveness(pool[ref].state)) {
+            pendingRemoveCells.push_back(ref);
+            const XY& xy = pool[ref].xy;
+            activity.find(blockOf(xy))->second.changes.push_back(xy);
+        }
+    }
+
+    // 7. Collect new cells
+    for (auto it = newmap.begin(); it != newmap.end(); it++) {
+        UpdateCellAliveness(pool[it->second].state, kernel);
+        if (GetCellAliveness(pool[it->second].state)) {
+            births.push_back(it->second);
+            activity.find(blockOf(it->first))->second.changes.push_back(it->first);
+        } else {
+            pool.release(it->second);
+        }
+    }
+}
+
+// Same for Generations rules: live cells that do not survive start to
+// decay and stay in the tree until the last stage is over
+template<class Kernel>
+static void applyGenerationsRule(const Kernel& kernel, uint8_t states, CellPool& pool,
+                                 const std::vector<CellRef>& targets, CellIndex& newmap, ActivityMap& activity,
+                                 std::vector<CellRef>& pendingRemoveCells, std::vector<CellRef>& births,
+                                 std::vector<XY>& decayed) {
+    for (auto& ref : targets) {
+        CellState& state = pool[ref].state;
+        if (GetCellDecay(state) == 0) {
+            SetCellAliveness(state, true);
+            UpdateCellAliveness(state, kernel);
+            if (GetCellAliveness(state)) {
+                continue;
+            }
+            SetCellDecay(state, 1);
+            decayed.push_back(pool[ref].xy);
+        } else if (GetCellDecay(state) + 2 < states) {
+            SetCellDecay(state, GetCellDecay(state) + 1);
+        } else {
+            pendingRemoveCells.push_back(ref);
+        }
+        const XY& xy = pool[ref].xy;
+        activity.find(blockOf(xy))->second.changes.push_back(xy);
+    }
+
+    // Births only, a new cell has no decay stage
+    for (auto it = newmap.begin(); it != newmap.end(); it++) {
+        UpdateCellAliveness(pool[it->second].state, kernel);
+        if (GetCellAliveness(pool[it->second].state)) {
+            births.push_back(it->second);
+            activity.find(blockOf(it->first))->second.changes.push_back(it->first);
+        } else {
+            pool.release(it->second);
+        }
+    }
+}
+
+void CellTreeNode::update(const Rule& rule) {
     // Note: you should performs update on root
 
-    // If an "alive" cell had less than 2 or more than 3 alive
-    // neighbors (in any of the 8 surrounding cells), it becomes dead.
-    // If a "dead" cell had *exactly* 3 alive neighbors, it becomes
-    // alive.
+    // Under the default B3/S23: if an "alive" cell had less than 2 or
+    // more than 3 alive neighbors (in any of the 8 surrounding cells), it
+    // becomes dead. If a "dead" cell had *exactly* 3 alive neighbors, it
+    // becomes alive.
 
-    std::unordered_map<XY, CellRef> newmap;
+    // Cells are handles into the pool, which may grow below, so look
+    // them up again instead of holding references
+    CellPool& pool = m_store->cells;
+    CellIndex newmap;
     constexpr CellState initialState = 0;
 
-    // 1. Clear counts for all cells
-    for (auto it = m_cells_map.begin(); it != m_cells_map.end(); it++) {
-        ClearCellNeighborCount(it->second->state);
+    // 1. Classify the blocks around recent changes, every other block
+    // has had a still neighborhood for two generations
+    FlatMap<XY, uint8_t> blocks;
+    for (auto it = m_activity.begin(); it != m_activity.end(); it++) {
+        uint8_t constraints = blockConstraints(it->second);
+        XY around[9];
+        blockNeighborhood(it->first, around);
+        for (auto& block : around) {
+            blocks.insert(std::make_pair(block, (uint8_t)0)).first->second |= constraints;
+        }
     }
 
-    // 2. Calculate contribution
-    for (auto it = m_cells_map.begin(); it != m_cells_map.end(); it++) {
-        auto xy = it->first;
-        auto cell = it->second;
+    std::vector<XY> computed;
+    std::vector<XY> replayed;
+    for (auto it = blocks.begin(); it != blocks.end(); it++) {
+        uint8_t constraints = it->second;
+        if (!(constraints & kBlockNotStill)) {
+            it->second = kBlockSettled;
+        } else if (!(constraints & kBlockNotPeriod2) && rule.states == 2) {
+            // Replaying only flips cells on and off, decay stages would
+            // be lost
+            it->second = kBlockReplay;
+            replayed.push_back(it->first);
+        } else {
+            it->second = kBlockCompute;
+            computed.push_back(it->first);
+        }
+    }
+
+    // The blocks around recomputed ones feed their counts
+    for (auto& block : computed) {
+        XY around[9];
+        blockNeighborhood(block, around);
+        bool surrounded = true;
+        for (auto& neighbor : around) {
+            auto result = blocks.insert(std::make_pair(neighbor, (uint8_t)kBlockSettled));
+            surrounded = surrounded && result.first->second >= kBlockCompute;
+        }
+        if (surrounded) {
+            blocks.find(block)->second = kBlockSurrounded;
+        }
+    }
+
+    // 2. Clear counts for the cells of recomputed blocks, and find the
+    // cells that contribute to them. Only the recomputed blocks and their
+    // neighbors are queried, settled regions cost nothing.
+    std::vector<XY> gathered;
+    for (auto& block : computed) {
+        XY around[9];
+        blockNeighborhood(block, around);
+        gathered.insert(gathered.end(), around, around + 9);
+    }
+    std::sort(gathered.begin(), gathered.end(), lessXY);
+    gathered.erase(std::unique(gathered.begin(), gathered.end()), gathered.end());
+
+    std::vector<CellRef> targets;
+    std::vector<std::pair<CellRef, uint8_t>> sources;
+    std::vector<CellRef> cells;
+    for (auto& block : gathered) {
+        uint8_t kind = blocks.find(block)->second;
+        cells.clear();
+        query(blockBox(block), cells);
+        for (auto& ref : cells) {
+            if (kind >= kBlockCompute) {
+                ClearCellNeighborCount(pool[ref].state);
+                targets.push_back(ref);
+            }
+            // Decaying cells are no one's neighbors
+            if (GetCellDecay(pool[ref].state) == 0) {
+                sources.push_back(std::make_pair(ref, kind));
+            }
+        }
+    }
+
+    // 3. Calculate contribution
+    for (auto& source : sources) {
+        XY xy = pool[source.first].xy;
+
+        // Away from the block edges, or inside a run of recomputed
+        // blocks, the neighbors need no block lookup
+        XY home = blockOf(xy);
+        Coord dx = xy.x - home.x;
+        Coord dy = xy.y - home.y;
+        bool inner = dx > 0 && dx < kActiveBlockSize - 1 && dy > 0 && dy < kActiveBlockSize - 1;
+        bool allComputed = source.second == kBlockSurrounded || (inner && source.second == kBlockCompute);
+        if (inner && !allComputed) {
+            continue;
+        }
 
         // Contribute to neighbor XYs
         XY neighbors[8] = {
@@ -373,6 +1407,13 @@ void CellTreeNode::update() {
 
         // For each neighbor, calculate and record its contribution
         for (auto& neighbor : neighbors) {
+            if (!allComputed) {
+                auto kind = blocks.find(blockOf(neighbor));
+                if (kind == blocks.end() || kind->second < kBlockCompute) {
+                    continue;
+                }
+            }
+
             auto it = m_cells_map.find(neighbor);
             if (it == m_cells_map.end()) {
                 // Try the new map
@@ -380,7 +1421,7 @@ void CellTreeNode::update() {
 
                 if (it == newmap.end()) {
                     // Create a new cell
-                    CellRef newcell = std::make_shared<Cell>(neighbor, initialState);
+                    CellRef newcell = pool.allocate(neighbor, initialState);
 
                     // Insert into maps
                     auto result = newmap.insert(std::make_pair(neighbor, newcell));
@@ -396,45 +1437,97 @@ void CellTreeNode::update() {
             }
 
             // Inrease neighbor count by 1
-            UpdateCellNeighborCount(it->second->state, 1);
+            UpdateCellNeighborCount(pool[it->second].state, 1);
         }
     }
 
-    // 3. Prune dead cells
-    // 3.1 Remove cell from tree
-    std::vector<XY> pendingRemoveXYs;
-    for (auto it = m_cells_map.begin(); it != m_cells_map.end(); it++) {
-        UpdateCellAliveness(it->second->state);
-        if (!GetCellAliveness(it->second->state)) {
-            this->remove(it->second);
-            pendingRemoveXYs.push_back(it->first);
+    // 4. Start the next history, the last changes become the previous ones
+    ActivityMap activity;
+    std::vector<CellRef> pendingRemoveCells;
+    std::vector<CellRef> births;
+    for (auto& block : computed) {
+        ActiveBlock history;
+        auto it = m_activity.find(block);
+        if (it != m_activity.end()) {
+            history.prevChanges = std::move(it->second.changes);
+            history.unsettled = it->second.unsettled - (it->second.unsettled > 0);
         }
+        activity.insert(std::make_pair(block, std::move(history)));
     }
 
-    // 3.2 Remove cell from map
-    for (auto& xy : pendingRemoveXYs) {
-        size_t result = m_cells_map.erase(xy);
-        if (result != 1) {
-            std::cerr << "Panic: Dead cells not removed!\n";
-            std::abort();
+    // 5. Period 2 blocks flip back the cells that changed last generation
+    for (auto& block : replayed) {
+        ActiveBlock history;
+        auto it = m_activity.find(block);
+        if (it != m_activity.end()) {
+            history.prevChanges = std::move(it->second.changes);
+            history.changes = history.prevChanges;
+        }
+        for (auto& xy : history.changes) {
+            auto cell = m_cells_map.find(xy);
+            if (cell != m_cells_map.end()) {
+                pendingRemoveCells.push_back(cell->second);
+            } else {
+                births.push_back(pool.allocate(xy, kCellAliveMask));
+            }
         }
+        activity.insert(std::make_pair(block, std::move(history)));
     }
 
+    // 6. and 7. Apply the rule, chosen once for the whole generation
+    std::vector<XY> decayed;
+    DispatchRule(rule, [&](const auto& kernel) {
+        if (rule.states > 2) {
+            applyGenerationsRule(kernel, rule.states, pool, targets, newmap, activity, pendingRemoveCells, births,
+                                 decayed);
+        } else {
+            applyRule(kernel, pool, targets, newmap, activity, pendingRemoveCells, births);
+        }
+    });
+    // Cells that started to decay stay where they are, only the counts
+    // on their path change
+    for (auto& xy : decayed) {
+        startDecay(xy);
+    }
 
-    // 4. Add new cells
-    for (auto it = newmap.begin(); it != newmap.end(); it++) {
-        UpdateCellAliveness(it->second->state);
-        if (GetCellAliveness(it->second->state)) {
-            if (!this->insert(it->second)) {
-                std::cerr << "Panic: new cells not inserted in CellTree\n";
-                std::abort();
-            }
+    // 8. Keep the blocks that still have a history
+    std::vector<XY> forgotten;
+    for (auto it = activity.begin(); it != activity.end(); it++) {
+        ActiveBlock& history = it->second;
+        if (history.changes.empty() && history.prevChanges.empty() && history.unsettled == 0) {
+            forgotten.push_back(it->first);
         }
+        std::sort(history.changes.begin(), history.changes.end(), lessXY);
+    }
+    for (auto& block : forgotten) {
+        activity.erase(block);
+    }
+    m_activity = std::move(activity);
+
+    // 9. Remove dead cells from the tree in one pass, then from the map
+    // and back to the pool
+    std::vector<XY> pendingRemoveXYs;
+    for (auto& ref : pendingRemoveCells) {
+        pendingRemoveXYs.push_back(pool[ref].xy);
     }
+    this->removeCells(pendingRemoveCells);
+
+    for (auto& xy : pendingRemoveXYs) {
+        auto it = m_cells_map.find(xy);
+        if (it == m_cells_map.end()) {
+            std::cerr << "Panic: Dead cells not removed!\n";
+            std::abort();
+        }
+        pool.release(it->second);
+        m_cells_map.erase(it);
+    }
+
+    // 10. Add new cells in one pass
+    this->insertCells(births);
 }
 
 void CellTreeNode::query(const AABB& range, std::vector<CellRef>& output) {
-    if (!m_bbox.intersect(range)) {
+    if (m_population == 0 || !m_bbox.intersect(range)) {
         return;
     }
 
@@ -446,14 +1539,47 @@ void CellTreeNode::query(const AABB& range, std::vector<CellRef>& output) {
         m_se->query(range, output);
     } else {
         // No children, leaf nodes
-        for (auto& cell : m_cells) {
-            if (range.contains(cell->xy)) {
+        for (CellRef cell = m_cells.head(); cell != kNullCell; cell = this->cell(cell).next) {
+            if (range.contains(this->cell(cell).xy)) {
                 output.push_back(cell);
             }
         }
     }
 }
 
+void CellTreeNode::queryDensity(DensityGrid& grid) {
+    // Decaying cells are not alive, the grid counts what query() returns
+    if (m_population == m_decaying) {
+        return;
+    }
+    // Node boxes are not aligned to the grid, one straddling a pixel
+    // edge is split further
+    DensityGrid::Cover cover = grid.cover(m_bbox.left, m_bbox.top,
+                                          (Len)m_bbox.right - (Len)m_bbox.left,
+                                          (Len)m_bbox.bottom - (Len)m_bbox.top);
+    if (cover == DensityGrid::kOutside) {
+        return;
+    }
+    if (cover == DensityGrid::kOnePixel) {
+        grid.add(XY(m_bbox.left, m_bbox.top), m_population - m_decaying);
+        return;
+    }
+
+    if (m_nw) {
+        // Has children
+        m_nw->queryDensity(grid);
+        m_ne->queryDensity(grid);
+        m_sw->queryDensity(grid);
+        m_se->queryDensity(grid);
+    } else {
+        for (CellRef cell = m_cells.head(); cell != kNullCell; cell = this->cell(cell).next) {
+            if (GetCellDecay(this->cell(cell).state) == 0) {
+                grid.addCell(this->cell(cell).xy);
+            }
+        }
+    }
+}
+
 void CellTreeNode::print(std::ostream& output) {
     if (m_root) {
         output << "#Life 1.06\n";
@@ -465,8 +1591,11 @@ void CellTreeNode::print(std::ostream& output) {
         m_sw->print(output);
         m_se->print(output);
     } else {
-        for (auto& cell : m_cells) {
-            output << cell->xy.x << " " << cell->xy.y << std::endl;
+        for (CellRef cell = m_cells.head(); cell != kNullCell; cell = this->cell(cell).next) {
+            // Live cells only, Life 1.06 has no decay stages
+            if (GetCellDecay(this->cell(cell).state) == 0) {
+                output << this->cell(cell).xy.x << " " << this->cell(cell).xy.y << std::endl;
+            }
         }
     }
 }
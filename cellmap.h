@@ -10,14 +10,25 @@
 #include <cstdint>
 #include <exception>
 #include <stdexcept>
+#include <limits>
+#include <string>
+#include <ostream>
+#include "flatmap.h"
+#include "rule.h"
 
 typedef int64_t Coord;
 typedef uint64_t Len;
 typedef uint8_t CellState;
 constexpr uint8_t kCellAliveMask = 1;
 constexpr uint8_t kCellNeighborCountMask = 0b11110;
+// Generations rules: how many generations a dying cell has decayed, 0 for
+// live cells
+constexpr uint8_t kCellDecayMask = 0b11100000;
+constexpr int kCellDecayShift = 5;
 // Maximum number of cells in a tree node
 constexpr int kNodeCapacity = 4;
+// Side of the squares the root tracks activity for, a power of two
+constexpr Coord kActiveBlockSize = 16;
 
 class XY;
 
@@ -34,6 +45,8 @@ public:
 
 const RGBA kOnColor(255, 200, 255, 255);
 const RGBA kOffColor(0, 0, 0, 0);
+// Cells decaying under a Generations rule, darker with each stage
+const RGBA kDecayColor(110, 130, 255, 255);
 
 inline bool GetCellAliveness(CellState& state) {
     return (bool) (state & kCellAliveMask);
@@ -53,8 +66,22 @@ inline void UpdateCellAliveness(CellState& state) {
                      (GetCellNeighborCount(state) == 2 && GetCellAliveness(state)));
 }
 
+// Same for any rule, kernel is a StaticRule or RuleTable from DispatchRule
+template<class Kernel>
+inline void UpdateCellAliveness(CellState& state, const Kernel& kernel) {
+    SetCellAliveness(state, kernel.next(state & (kCellAliveMask | kCellNeighborCountMask)));
+}
+
+inline uint8_t GetCellDecay(CellState& state) {
+    return state >> kCellDecayShift;
+}
+
+inline void SetCellDecay(CellState& state, uint8_t decay) {
+    state = (state & ~kCellDecayMask) | (decay << kCellDecayShift);
+}
+
 inline void ClearCellNeighborCount(CellState& state) {
-    state = state & 1;
+    state = state & ~kCellNeighborCountMask;
 }
 
 inline void UpdateCellNeighborCount(CellState& state, int8_t by) {
@@ -63,6 +90,8 @@ inline void UpdateCellNeighborCount(CellState& state, int8_t by) {
 
 class XY {
 public:
+    XY()
+        : x(0), y(0) {}
     XY(Coord ix, Coord iy)
         : x(ix), y(iy) {}
     Coord x;
@@ -79,21 +108,103 @@ struct std::hash<XY>
 {
     std::size_t operator()(XY const& xy) const noexcept
     {
-        std::size_t result = 0;
-        // long should be the same as int64_t
-        result ^= std::hash<long>()(xy.x) + 0x9e3779b9 + (result << 6) + (result >> 2);
-        result ^= std::hash<long>()(xy.y) + 0x9e3779b9 + (result << 6) + (result >> 2);
-        return result;
+        // Identity std::hash<long> would leave neighbors in neighboring
+        // buckets, mix both coordinates through all 64 bits
+        return Mix64((uint64_t)xy.x * 0x9e3779b97f4a7c15ULL ^ (uint64_t)xy.y);
     }
 };
 
 
+// Handle of a cell in a CellPool
+typedef uint32_t CellRef;
+constexpr CellRef kNullCell = std::numeric_limits<CellRef>::max();
+
 class Cell {
 public:
     Cell(XY ixy, CellState istate)
         : xy(ixy), state(istate) {}
     XY xy;
     CellState state;
+    // Next cell in the owning leaf, or in the free list once released
+    CellRef next = kNullCell;
+};
+
+// Arena of cells addressed by index. Released cells are recycled through
+// an intrusive free list, so steady-state generations do not allocate.
+class CellPool {
+public:
+    CellRef allocate(const XY& xy, CellState state);
+    void release(CellRef ref);
+
+    Cell& operator[](CellRef ref) { return m_cells[ref]; }
+    const Cell& operator[](CellRef ref) const { return m_cells[ref]; }
+
+    // Live cells
+    size_t size() const { return m_cells.size() - m_freeCount; }
+    size_t capacity() const { return m_cells.size(); }
+
+private:
+    std::vector<Cell> m_cells;
+    CellRef m_free = kNullCell;
+    size_t m_freeCount = 0;
+};
+
+// Cells of a leaf node, linked through Cell::next
+class CellList {
+public:
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    CellRef head() const { return m_head; }
+
+    void push(CellPool& pool, CellRef ref);
+    bool erase(CellPool& pool, CellRef ref);
+    void clear() {
+        m_head = kNullCell;
+        m_size = 0;
+    }
+
+private:
+    CellRef m_head = kNullCell;
+    size_t m_size = 0;
+};
+
+// Free-list allocator handing out fixed-size slots from slabs
+template<typename T, size_t SlabSize = 256>
+class ObjectPool {
+public:
+    ObjectPool() = default;
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    template<typename... Args>
+    T* create(Args&&... args) {
+        void* slot;
+        if (!m_free.empty()) {
+            slot = m_free.back();
+            m_free.pop_back();
+        } else {
+            if (m_slabUsed == SlabSize) {
+                m_slabs.push_back(std::make_unique<Slot[]>(SlabSize));
+                m_slabUsed = 0;
+            }
+            slot = &m_slabs.back()[m_slabUsed++];
+        }
+        return new (slot) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T* object) {
+        object->~T();
+        m_free.push_back(object);
+    }
+
+private:
+    struct alignas(T) Slot {
+        unsigned char bytes[sizeof(T)];
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> m_slabs;
+    std::vector<void*> m_free;
+    size_t m_slabUsed = SlabSize;
 };
 
 // Axis-Aligned Bounding Box
@@ -119,63 +230,350 @@ public:
 };
 
 // Quad Tree
-typedef std::shared_ptr<Cell> CellRef;
+typedef FlatMap<XY, CellRef> CellIndex;
+
+// Recent history of one kActiveBlockSize square, keyed by its top left
+// corner. A block whose neighborhood did not change (period 1), or
+// changed the same way twice in a row (period 2), can be skipped.
+class ActiveBlock {
+public:
+    // Cells that appeared or vanished in the last generation and in the
+    // one before, sorted
+    std::vector<XY> changes;
+    std::vector<XY> prevChanges;
+    // Generations to recompute before the history can be trusted, set
+    // when cells are inserted or removed outside update()
+    uint8_t unsettled = 0;
+};
+typedef FlatMap<XY, ActiveBlock> ActivityMap;
 
 class CellTreeNode;
+class CellTreeStore;
+class DensityGrid;
 typedef std::shared_ptr<CellTreeNode> CellTreeNodeRef;
-typedef std::unique_ptr<CellTreeNode> CellTreeNodeUniq;
 class CellTreeNode {
 public:
-    CellTreeNode(AABB ibbox, bool root = false);
+    // The root creates the store, other nodes share it
+    CellTreeNode(AABB ibbox, bool root = false, CellTreeStore* store = nullptr);
+    ~CellTreeNode();
+    CellTreeNode(const CellTreeNode&) = delete;
+    CellTreeNode& operator=(const CellTreeNode&) = delete;
 
     static CellTreeNodeRef createRoot();
+    // Allocates a cell that is not in the tree yet
+    CellRef newCell(const XY& xy, CellState state);
+    inline Cell& cell(CellRef ref);
     bool insert(CellRef cell);
     bool remove(CellRef cell);
+    // Bulk insert and remove, sorted by Morton key and applied in one
+    // top-down pass that visits each node at most once. Reorders the batch.
+    void insertBatch(std::vector<CellRef>& cells);
+    void removeBatch(std::vector<CellRef>& cells);
     void subdivide();
     void merge();
     void query(const AABB& range, std::vector<CellRef>& output);
-    void update();
+    // Adds the live cells of this subtree to grid, a node inside one
+    // square adds population() - decaying() without visiting its cells
+    void queryDensity(DensityGrid& grid);
+    void update(const Rule& rule = kConwayRule);
     void print(std::ostream& output);
     size_t cellCount();
+    // Cells in this subtree, kept up to date by insert, remove and merge
+    size_t population() const { return m_population; }
+    // Those of them with a decay stage, under a Generations rule
+    size_t decaying() const { return m_decaying; }
+    // Blocks with recent changes, the rest of the plane is settled
+    size_t activeBlockCount() const { return m_activity.size(); }
+    // Forgets what update() knows about settled blocks, so every block
+    // with cells is recomputed, e.g. after a rule change
+    void unsettle();
 
     AABB m_bbox;
-    std::unordered_set<CellRef> m_cells;
+    CellList m_cells;
+    size_t m_population = 0;
+    size_t m_decaying = 0;
 
     // Only root has m_cells_map populated for quick reference
     bool m_root = false;
-    std::unordered_map<XY, CellRef> m_cells_map;
+    CellIndex m_cells_map;
+    // Only root tracks activity, so update() only recomputes blocks near
+    // recent changes
+    ActivityMap m_activity;
+
+    // Children, allocated from the store
+    CellTreeNode* m_nw = nullptr;
+    CellTreeNode* m_ne = nullptr;
+    CellTreeNode* m_sw = nullptr;
+    CellTreeNode* m_se = nullptr;
 
-    // Children
-    CellTreeNodeUniq m_nw = nullptr;
-    CellTreeNodeUniq m_ne = nullptr;
-    CellTreeNodeUniq m_sw = nullptr;
-    CellTreeNodeUniq m_se = nullptr;
+    CellTreeStore* m_store;
+
+private:
+    void sortMorton(std::vector<CellRef>& cells);
+    // extent bounds the cells of a range, a range inside one child is
+    // split without looking at its cells
+    void partitionChildren(CellRef* begin, CellRef* end, const AABB& extent, CellRef* split[5],
+                           std::vector<CellRef>& scratch);
+    void insertRange(CellRef* begin, CellRef* end, const AABB& extent, std::vector<CellRef>& scratch);
+    void removeRange(CellRef* begin, CellRef* end, const AABB& extent, std::vector<CellRef>& scratch);
+    AABB extentOf(const std::vector<CellRef>& cells);
+    // Batches without marking the blocks touched, for update()
+    void insertCells(std::vector<CellRef>& cells);
+    void removeCells(std::vector<CellRef>& cells);
+    // Forgets the history of the block around xy
+    void touch(const XY& xy);
+    // Counts the cell at xy as decaying in every node down to its leaf,
+    // for cells that start to decay in place
+    void startDecay(const XY& xy);
+    size_t countDecaying(const CellRef* begin, const CellRef* end);
+
+    std::unique_ptr<CellTreeStore> m_ownedStore;
+};
+
+// Arenas shared by all nodes of one tree
+class CellTreeStore {
+public:
+    CellPool cells;
+    ObjectPool<CellTreeNode> nodes;
+};
+
+inline Cell& CellTreeNode::cell(CellRef ref) {
+    return m_store->cells[ref];
+}
+
+// Live cells per 2^shift x 2^shift square of a columns x rows grid, row by
+// row, whose top left cell is origin. Offsets from origin wrap around like
+// big_int_addition, so a grid may straddle the Coord limits.
+class DensityGrid {
+public:
+    // How a box of cells lies on the grid
+    enum Cover {
+        kOutside,
+        kOnePixel,
+        kSeveral
+    };
+
+    void reset(const XY& iorigin, unsigned ishift, int icolumns, int irows) {
+        origin = iorigin;
+        shift = ishift;
+        columns = icolumns;
+        rows = irows;
+        counts.assign((size_t)columns * rows, 0);
+    }
+
+    // Box whose top left cell is (left, top), width and height are
+    // right - left and bottom - top
+    Cover cover(Coord left, Coord top, Len width, Len height) const {
+        Len x = (Len)left - (Len)origin.x;
+        Len y = (Len)top - (Len)origin.y;
+        Len right = x + width;
+        Len bottom = y + height;
+        // A box that wraps past the end of the plane may come back in
+        bool wrapsX = right < x;
+        bool wrapsY = bottom < y;
+        if ((!wrapsX && x >= ((Len)columns << shift)) || (!wrapsY && y >= ((Len)rows << shift))) {
+            return kOutside;
+        }
+        if (wrapsX || wrapsY || right >= ((Len)columns << shift) || bottom >= ((Len)rows << shift) ||
+            (x >> shift) != (right >> shift) || (y >> shift) != (bottom >> shift)) {
+            return kSeveral;
+        }
+        return kOnePixel;
+    }
+
+    // Adds count to the square holding xy, which must be on the grid
+    void add(const XY& xy, uint64_t count) {
+        Len x = ((Len)xy.x - (Len)origin.x) >> shift;
+        Len y = ((Len)xy.y - (Len)origin.y) >> shift;
+        counts[y * columns + x] += count;
+    }
+
+    void addCell(const XY& xy) {
+        if (cover(xy.x, xy.y, 0, 0) == kOnePixel) {
+            add(xy, 1);
+        }
+    }
+
+    XY origin;
+    unsigned shift = 0;
+    int columns = 0;
+    int rows = 0;
+    std::vector<uint64_t> counts;
+};
+
+// Simulation backends CellMap can run on
+enum class EngineKind {
+    QuadTree,
+    HashLife,
+    Tile,
+    Morton,
+    // Tile engine for range-R rules, see LtlEngine
+    LargerThanLife
+};
+
+bool ParseEngineKind(const std::string& name, EngineKind& kind);
+
+class LifeEngine {
+public:
+    virtual ~LifeEngine() = default;
+
+    virtual void addCell(const XY& xy) = 0;
+    // Adds many cells at once, engines with a bulk insert override it
+    virtual void addCells(const std::vector<XY>& cells);
+    // Advance one generation
+    virtual void update() = 0;
+    // Advance 2^log2Generations generations
+    virtual void step(unsigned log2Generations);
+    virtual void query(const AABB& range, std::vector<XY>& output) = 0;
+    // Fills grid.counts for the grid's origin, shift and size. The default
+    // bins the cells of a query, engines with populated subtrees count
+    // whole subtrees that fit in one square.
+    virtual void queryDensity(DensityGrid& grid);
+    virtual void print(std::ostream& output) = 0;
+    virtual size_t cellCount() = 0;
+    // Worker threads for engines with a parallel update, 0 means one per
+    // hardware thread. Engines without one ignore it.
+    virtual void setThreadCount(unsigned /*threads*/) {}
+    // Rule of the generations from now on, B3/S23 until set. Throws for
+    // a Generations rule unless the engine supports them.
+    virtual void setRule(const Rule& rule);
+    // Engines running a rule that has no B/S form throw
+    virtual const Rule& rule() const { return m_rule; }
+    // Under a Generations rule, query() returns the live cells and this
+    // the decaying ones with their stage, 1 for a cell that died last
+    // generation. Decaying cells count towards cellCount().
+    virtual bool supportsGenerations() const { return false; }
+    virtual void queryDecaying(const AABB&, std::vector<XY>&, std::vector<uint8_t>&) {}
+
+protected:
+    Rule m_rule = kConwayRule;
+};
+typedef std::unique_ptr<LifeEngine> LifeEngineUniq;
+
+LifeEngineUniq CreateEngine(EngineKind kind);
+
+// LifeEngine over the CellTreeNode quadtree
+class CellTreeEngine : public LifeEngine {
+public:
+    CellTreeEngine()
+        : m_celltree(CellTreeNode::createRoot()) {}
+
+    void addCell(const XY& xy) override {
+        m_celltree->insert(m_celltree->newCell(xy, 1));
+    }
+    void addCells(const std::vector<XY>& cells) override;
+    void update() override {
+        m_celltree->update(m_rule);
+    }
+    // Settled blocks followed the old rule, they are all recomputed
+    void setRule(const Rule& rule) override;
+    void query(const AABB& range, std::vector<XY>& output) override;
+    void queryDensity(DensityGrid& grid) override;
+    bool supportsGenerations() const override { return true; }
+    void queryDecaying(const AABB& range, std::vector<XY>& output, std::vector<uint8_t>& stages) override;
+    void print(std::ostream& output) override {
+        m_celltree->print(output);
+    }
+    size_t cellCount() override {
+        return m_celltree->cellCount();
+    }
+
+    CellTreeNodeRef m_celltree;
+};
+
+// Side of the squares of window cells dirty rectangles are built from
+constexpr int kDirtyTileCells = 16;
+// Zoom limits: pixels per cell when zoomed in, log2 cells per pixel side
+// when zoomed out
+constexpr int kMaxPixelsPerCell = 16;
+constexpr unsigned kMaxCellShift = 20;
+
+// Seconds CellMap::update spent in each phase, summed over all frames
+class FrameTimes {
+public:
+    double query = 0;
+    double draw = 0;
+    double update = 0;
 };
 
 class CellMap {
 public:
-    CellMap(SDL_Surface* surface, int hpixels, int vpixels, int cellSize, int printAtIteration);
+    CellMap(SDL_Surface* surface, int hpixels, int vpixels, int cellSize, int printAtIteration,
+            EngineKind engine = EngineKind::QuadTree);
 
     void update();
     void drawCurrent();
+    // Draws cells queried elsewhere, e.g. a Simulation snapshot. Only
+    // the cells that changed since the last draw are painted.
+    void draw(const std::vector<XY>& cells);
+    // Same with the decaying cells of a Generations rule, colored by
+    // stage, see LifeEngine::queryDecaying
+    void draw(const std::vector<XY>& cells, const std::vector<XY>& decaying, const std::vector<uint8_t>& stages);
+    // Shades each pixel by the cells under it, for a grid queried with
+    // the view's origin, cellShift() and size. Only changed pixels are
+    // painted.
+    void drawDensity(const DensityGrid& grid);
+    // Parts of the surface the last draw changed, merged into few rects
+    const std::vector<SDL_Rect>& dirtyRects() const { return m_dirtyRects; }
+    // Moves the view by xy window cells, i.e. by 2^cellShift() cells per
+    // pixel when zoomed out
     void move(const XY& xy);
+    // Powers of two from kMaxPixelsPerCell pixels per cell to
+    // 2^kMaxCellShift cells per pixel, keeping the window center in place
+    void zoomIn();
+    void zoomOut();
+    int pixelsPerCell() const { return m_pixelsPerCell; }
+    // Draws one pixel per cell into the top left of the surface and
+    // leaves scaling it up by outputScale() to the presenter
+    void setScaledOutput(bool scaled);
+    int outputScale() const { return m_scaledOutput ? m_pixelsPerCell : 1; }
+    // Part of the surface draws write to
+    SDL_Rect drawArea() const { return SDL_Rect{0, 0, m_drawWidth, m_drawHeight}; }
+    // Log2 of the cells per pixel side, 0 unless zoomed out past one
+    // cell per pixel
+    unsigned cellShift() const { return m_cellShift; }
+    // World box the window shows
+    const AABB& view() const { return m_queryBox; }
+    LifeEngine& engine() { return *m_engine; }
+    // Replaces the engine, e.g. with one CreateEngine cannot make
+    void setEngine(LifeEngineUniq engine) { m_engine = std::move(engine); }
+    const FrameTimes& frameTimes() const { return m_frameTimes; }
     inline void addCell(const XY& xy) {
-        m_celltree->insert(std::make_shared<Cell>(xy, 1));
+        m_engine->addCell(xy);
     }
 
 private:
-    void drawCell(XY xy, RGBA color);
+    void drawCell(XY xy, uint32_t pixel);
     void clearSurface();
+    // Pixel value of a color in the surface's format
+    uint32_t mapColor(const RGBA& color) const;
+    // Full redraw at one pixel per cell, row bitmaps straight to pixels
+    void drawBitmap();
+    void markDirty(const XY& xy);
+    void collectDirtyRects();
+    void setZoom(int pixelsPerCell, unsigned cellShift);
+    void updateDrawArea();
 
     std::pair<XY, bool> worldXY2WindowXY(XY worldXY);
 
     SDL_Surface* m_surface;
-    CellTreeNodeRef m_celltree;
+    LifeEngineUniq m_engine;
 
     int m_pixelsPerCell;
+    unsigned m_cellShift = 0;
+    // Pixels per cell on the surface and the surface area in use, smaller
+    // than the window with scaled output
+    bool m_scaledOutput = false;
+    int m_cellPixels;
+    int m_drawWidth;
+    int m_drawHeight;
 
     int m_hpixels;
     int m_vpixels;
+    // Surface row length in pixels, and the cell colors in its format
+    int m_pitch;
+    uint32_t m_onPixel;
+    uint32_t m_offPixel;
 
     int m_hcells;
     int m_vcells;
@@ -190,6 +588,38 @@ private:
     int m_printAtIteration;
 
     int m_iteration;
+
+    FrameTimes m_frameTimes;
+
+    // Window cells on the surface and scratch for the next ones, the
+    // first m_litCount visible ones are live
+    std::vector<XY> m_drawn;
+    std::vector<XY> m_visible;
+    std::vector<uint8_t> m_visibleValues;
+    size_t m_litCount = 0;
+    // Per window cell: clear, lit, or kCellLit + the decay stage, with
+    // kCellKept set while a draw runs if it is still visible
+    static constexpr uint8_t kCellClear = 0;
+    static constexpr uint8_t kCellLit = 1;
+    static constexpr uint8_t kCellKept = 0x80;
+    std::vector<uint8_t> m_cellStates;
+    // Pixel for each of those values
+    uint32_t m_statePixels[kMaxRuleStates];
+    // One bit per window cell, scratch for drawBitmap
+    std::vector<uint64_t> m_rowBits;
+    // Per pixel shade while zoomed out, and whether the surface holds
+    // shades rather than cells
+    std::vector<uint8_t> m_shades;
+    bool m_drawnDensity = false;
+    DensityGrid m_density;
+    // Scratch for update() under Generations rules
+    std::vector<XY> m_decaying;
+    std::vector<uint8_t> m_stages;
+    // Set when the whole surface is stale, e.g. after a move
+    bool m_redrawAll = true;
+    // One flag per kDirtyTileCells square of window cells
+    std::vector<uint8_t> m_dirtyTiles;
+    std::vector<SDL_Rect> m_dirtyRects;
 };
 
 
@@ -0,0 +1,200 @@
+#ifndef FlatMap_H
+
+#define FlatMap_H
+#pragma once
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+// Finalizer of MurmurHash3, every input bit affects every output bit
+inline uint64_t Mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Open-addressing hash map with linear probing. Keys, values and slot
+// occupancy live in separate arrays so probing only touches keys.
+// Erase shifts the following entries back instead of leaving tombstones.
+// Inserting may rehash and invalidates iterators, erasing invalidates
+// iterators past the erased slot.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class FlatMap {
+public:
+    class Ref {
+    public:
+        const Key& first;
+        Value& second;
+    };
+
+    class iterator {
+    public:
+        iterator(FlatMap* map, size_t slot)
+            : m_map(map), m_slot(slot) {}
+
+        class Arrow {
+        public:
+            Ref ref;
+            Ref* operator->() { return &ref; }
+        };
+
+        Ref operator*() const {
+            return Ref{m_map->m_keys[m_slot], m_map->m_values[m_slot]};
+        }
+        Arrow operator->() const {
+            return Arrow{**this};
+        }
+        iterator& operator++() {
+            m_slot = m_map->nextUsed(m_slot + 1);
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator result = *this;
+            ++*this;
+            return result;
+        }
+        bool operator==(const iterator& other) const { return m_slot == other.m_slot; }
+        bool operator!=(const iterator& other) const { return m_slot != other.m_slot; }
+
+    private:
+        friend class FlatMap;
+        FlatMap* m_map;
+        size_t m_slot;
+    };
+
+    FlatMap() = default;
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    size_t capacity() const { return m_keys.size(); }
+
+    iterator begin() { return iterator(this, nextUsed(0)); }
+    iterator end() { return iterator(this, m_keys.size()); }
+
+    iterator find(const Key& key) {
+        if (m_size == 0) {
+            return end();
+        }
+        size_t mask = m_keys.size() - 1;
+        for (size_t slot = home(key);; slot = (slot + 1) & mask) {
+            if (!m_used[slot]) {
+                return end();
+            }
+            if (m_keys[slot] == key) {
+                return iterator(this, slot);
+            }
+        }
+    }
+
+    std::pair<iterator, bool> insert(const std::pair<Key, Value>& entry) {
+        return insert(std::pair<Key, Value>(entry));
+    }
+
+    std::pair<iterator, bool> insert(std::pair<Key, Value>&& entry) {
+        // Keep the load factor at or below 3/4
+        if ((m_size + 1) * 4 > m_keys.size() * 3) {
+            rehash(m_keys.empty() ? kInitialCapacity : m_keys.size() * 2);
+        }
+        size_t mask = m_keys.size() - 1;
+        size_t slot = home(entry.first);
+        for (; m_used[slot]; slot = (slot + 1) & mask) {
+            if (m_keys[slot] == entry.first) {
+                return std::make_pair(iterator(this, slot), false);
+            }
+        }
+        m_used[slot] = 1;
+        m_keys[slot] = entry.first;
+        m_values[slot] = std::move(entry.second);
+        m_size++;
+        return std::make_pair(iterator(this, slot), true);
+    }
+
+    void erase(iterator it) {
+        size_t mask = m_keys.size() - 1;
+        size_t hole = it.m_slot;
+        // Move back every entry whose probe sequence runs over the hole
+        for (size_t slot = (hole + 1) & mask; m_used[slot]; slot = (slot + 1) & mask) {
+            size_t want = home(m_keys[slot]);
+            if (((slot - want) & mask) >= ((slot - hole) & mask)) {
+                m_keys[hole] = m_keys[slot];
+                m_values[hole] = std::move(m_values[slot]);
+                hole = slot;
+            }
+        }
+        m_used[hole] = 0;
+        m_size--;
+    }
+
+    size_t erase(const Key& key) {
+        iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    void clear() {
+        std::fill(m_used.begin(), m_used.end(), 0);
+        m_size = 0;
+    }
+
+    void reserve(size_t count) {
+        size_t capacity = kInitialCapacity;
+        while (capacity * 3 < count * 4) {
+            capacity *= 2;
+        }
+        if (capacity > m_keys.size()) {
+            rehash(capacity);
+        }
+    }
+
+private:
+    static constexpr size_t kInitialCapacity = 16;
+
+    size_t home(const Key& key) const {
+        return Hash()(key) & (m_keys.size() - 1);
+    }
+
+    size_t nextUsed(size_t slot) const {
+        while (slot < m_used.size() && !m_used[slot]) {
+            slot++;
+        }
+        return slot;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Key> keys(capacity);
+        std::vector<Value> values(capacity);
+        std::vector<uint8_t> used(capacity, 0);
+        keys.swap(m_keys);
+        values.swap(m_values);
+        used.swap(m_used);
+
+        size_t mask = capacity - 1;
+        for (size_t i = 0; i < used.size(); i++) {
+            if (!used[i]) {
+                continue;
+            }
+            size_t slot = home(keys[i]);
+            while (m_used[slot]) {
+                slot = (slot + 1) & mask;
+            }
+            m_used[slot] = 1;
+            m_keys[slot] = keys[i];
+            m_values[slot] = std::move(values[i]);
+        }
+    }
+
+    std::vector<Key> m_keys;
+    std::vector<Value> m_values;
+    std::vector<uint8_t> m_used;
+    size_t m_size = 0;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <unordered_map>
+#include "cellmap.h"
+#include "flatmap.h"
+
+// Lookups per second in FlatMap and std::unordered_map, keyed by the live
+// cells of a random soup. Half of the lookups hit, half miss, like the
+// neighbor probes of CellTreeNode::update.
+
+constexpr size_t kLookups = 10000000;
+
+template<typename Map>
+double lookupsPerSecond(Map& map, const std::vector<XY>& probes) {
+    auto start = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (size_t i = 0; i < kLookups; i++) {
+        found += map.find(probes[i % probes.size()]) != map.end();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (found == 0) {
+        std::cerr << "No hits\n";
+    }
+    return kLookups / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<size_t> sizes = {100000, 1000000, 10000000};
+    if (argc > 1) {
+        sizes = {(size_t)std::atoll(argv[1])};
+    }
+
+    std::cout << "cells,flatmap_lookups_per_sec,unordered_map_lookups_per_sec\n";
+    for (size_t cells : sizes) {
+        // Soup at 50% density in a square, the way live cells cluster
+        Coord side = 1;
+        while ((size_t)(side * side) < cells * 2) {
+            side *= 2;
+        }
+        std::mt19937_64 rng(cells);
+        FlatMap<XY, CellRef> flat;
+        flat.reserve(cells);
+        std::unordered_map<XY, CellRef> reference;
+        reference.reserve(cells);
+        std::vector<XY> keys;
+        while (flat.size() < cells) {
+            XY xy((Coord)(rng() % side) - side / 2, (Coord)(rng() % side) - side / 2);
+            if (flat.insert(std::make_pair(xy, (CellRef)flat.size())).second) {
+                reference.insert(std::make_pair(xy, (CellRef)reference.size()));
+                keys.push_back(xy);
+            }
+        }
+
+        std::vector<XY> probes;
+        for (size_t i = 0; i < std::min<size_t>(cells, 1000000); i++) {
+            const XY& xy = keys[rng() % keys.size()];
+            probes.push_back(i % 2 ? xy : XY(xy.x + side, xy.y));
+        }
+
+        double flatRate = lookupsPerSecond(flat, probes);
+        double referenceRate = lookupsPerSecond(reference, probes);
+        std::cout << cells << "," << (uint64_t)flatRate << "," << (uint64_t)referenceRate << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,245 @@
+#include "gridmap.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+bool ParseGridSize(const std::string& text, Coord& width, Coord& height) {
+    size_t x = text.find('x');
+    if (x == std::string::npos) {
+        return false;
+    }
+    std::string w = text.substr(0, x);
+    std::string h = text.substr(x + 1);
+    for (auto* side : {&w, &h}) {
+        if (side->empty() || side->size() > 7 || side->find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+    }
+    width = std::stoll(w);
+    height = std::stoll(h);
+    return width >= 1 && width <= kMaxGridSide && height >= 1 && height <= kMaxGridSide;
+}
+
+GridEngine::GridEngine(Coord width, Coord height, bool torus, bool simd)
+    : m_width(width),
+      m_height(height),
+      m_torus(torus),
+      m_simd(simd),
+      m_left(-(width / 2)),
+      m_top(-(height / 2)) {
+    if (width < 1 || width > kMaxGridSide || height < 1 || height > kMaxGridSide) {
+        throw std::runtime_error("Unsupported grid size");
+    }
+#ifdef TILE_AVX2
+    m_simd = m_simd && cpuHasAVX2();
+#else
+    m_simd = false;
+#endif
+    m_words = (size_t)(width + kTileSize - 1) / kTileSize;
+    m_stride = m_words + 2;
+    int tail = (int)(width % kTileSize);
+    m_lastMask = tail ? (1ULL << tail) - 1 : ~0ULL;
+    m_cells.assign(m_stride * (size_t)(height + 2), 0);
+    m_next.assign(m_cells.size(), 0);
+}
+
+void GridEngine::setThreadCount(unsigned threads) {
+    if (threads == 1) {
+        m_pool = nullptr;
+    } else {
+        m_pool = std::make_unique<ThreadPool>(threads);
+    }
+}
+
+void GridEngine::addCell(const XY& xy) {
+    Coord x, y;
+    if (m_torus) {
+        // Remainders first, x - m_left may not fit in a Coord
+        x = (xy.x % m_width - m_left % m_width) % m_width;
+        y = (xy.y % m_height - m_top % m_height) % m_height;
+        x += x < 0 ? m_width : 0;
+        y += y < 0 ? m_height : 0;
+    } else {
+        uint64_t dx = (uint64_t)xy.x - (uint64_t)m_left;
+        uint64_t dy = (uint64_t)xy.y - (uint64_t)m_top;
+        if (dx >= (uint64_t)m_width || dy >= (uint64_t)m_height) {
+            return;
+        }
+        x = (Coord)dx;
+        y = (Coord)dy;
+    }
+    row(m_cells, y)[1 + x / kTileSize] |= 1ULL << (x % kTileSize);
+}
+
+bool GridEngine::getCell(const XY& xy) const {
+    uint64_t x = (uint64_t)xy.x - (uint64_t)m_left;
+    uint64_t y = (uint64_t)xy.y - (uint64_t)m_top;
+    if (x >= (uint64_t)m_width || y >= (uint64_t)m_height) {
+        return false;
+    }
+    return (row(m_cells, (Coord)y)[1 + x / kTileSize] >> (x % kTileSize)) & 1;
+}
+
+void GridEngine::fillHalo() {
+    if (!m_torus) {
+        // Halo words and rows are never written, they stay dead
+        return;
+    }
+    // West of column 0 is column width - 1, east of column width - 1,
+    // the bit just past the row, is column 0
+    size_t lastWord = 1 + (size_t)(m_width - 1) / kTileSize;
+    int lastBit = (int)((m_width - 1) % kTileSize);
+    size_t eastWord = 1 + (size_t)m_width / kTileSize;
+    int eastBit = (int)(m_width % kTileSize);
+    for (Coord y = 0; y < m_height; y++) {
+        uint64_t* cells = row(m_cells, y);
+        cells[0] = ((cells[lastWord] >> lastBit) & 1) << (kTileSize - 1);
+        cells[m_stride - 1] = 0;
+        cells[eastWord] |= (cells[1] & 1) << eastBit;
+    }
+    std::copy(row(m_cells, m_height - 1), row(m_cells, m_height), row(m_cells, -1));
+    std::copy(row(m_cells, 0), row(m_cells, 1), row(m_cells, m_height));
+}
+
+#ifdef TILE_AVX2
+// West-shifted and east-shifted words of the four words from p, which
+// has a word on either side
+AVX2_TARGET static inline void shift4(const uint64_t* p, __m256i& l, __m256i& c, __m256i& r) {
+    c = load4(p);
+    l = _mm256_or_si256(_mm256_slli_epi64(c, 1), _mm256_srli_epi64(load4(p - 1), kTileSize - 1));
+    r = _mm256_or_si256(_mm256_srli_epi64(c, 1), _mm256_slli_epi64(load4(p + 1), kTileSize - 1));
+}
+
+// B3/S23 on words 1.. of a row four at a time, returns the first word
+// left for the scalar loop
+AVX2_TARGET static size_t nextWordsAVX2(const uint64_t* above, const uint64_t* cells, const uint64_t* below,
+                                        uint64_t* output, size_t words) {
+    size_t i = 1;
+    for (; i + 3 <= words; i += 4) {
+        __m256i la, ca, ra, lm, cm, rm, lb, cb, rb;
+        shift4(above + i, la, ca, ra);
+        shift4(cells + i, lm, cm, rm);
+        shift4(below + i, lb, cb, rb);
+        _mm256_storeu_si256((__m256i*)(output + i), nextRow4(la, ca, ra, lm, cm, rm, lb, cb, rb));
+    }
+    return i;
+}
+#endif
+
+// West-shifted, centered and east-shifted word i of a row
+inline void shiftWord(const uint64_t* p, size_t i, uint64_t& l, uint64_t& c, uint64_t& r) {
+    c = p[i];
+    l = (c << 1) | (p[i - 1] >> (kTileSize - 1));
+    r = (c >> 1) | (p[i + 1] << (kTileSize - 1));
+}
+
+// Any rule, kernel is a StaticRule or RuleTable
+template<class Kernel>
+static void nextWordsRule(const Kernel& kernel, const uint64_t* above, const uint64_t* cells,
+                          const uint64_t* below, uint64_t* output, size_t words) {
+    uint32_t mask = kernel.sumMask();
+    for (size_t i = 1; i <= words; i++) {
+        uint64_t la, ca, ra, lm, cm, rm, lb, cb, rb;
+        shiftWord(above, i, la, ca, ra);
+        shiftWord(cells, i, lm, cm, rm);
+        shiftWord(below, i, lb, cb, rb);
+        uint64_t bits[4];
+        sumRow(la, ca, ra, lm, cm, rm, lb, cb, rb, bits);
+        output[i] = selectSum(mask, bits, cm);
+    }
+}
+
+void GridEngine::nextRows(Coord begin, Coord end) {
+    for (Coord y = begin; y < end; y++) {
+        const uint64_t* above = row(m_cells, y - 1);
+        const uint64_t* cells = row(m_cells, y);
+        const uint64_t* below = row(m_cells, y + 1);
+        uint64_t* output = row(m_next, y);
+
+        if (m_rule != kConwayRule) {
+            DispatchRule(m_rule, [&](const auto& kernel) {
+                nextWordsRule(kernel, above, cells, below, output, m_words);
+            });
+        } else {
+            size_t i = 1;
+#ifdef TILE_AVX2
+            if (m_simd) {
+                i = nextWordsAVX2(above, cells, below, output, m_words);
+            }
+#endif
+            for (; i <= m_words; i++) {
+                uint64_t la, ca, ra, lm, cm, rm, lb, cb, rb;
+                shiftWord(above, i, la, ca, ra);
+                shiftWord(cells, i, lm, cm, rm);
+                shiftWord(below, i, lb, cb, rb);
+                output[i] = nextRow(la, ca, ra, lm, cm, rm, lb, cb, rb);
+            }
+        }
+        // Bits past the east edge stay dead
+        output[m_words] &= m_lastMask;
+    }
+}
+
+void GridEngine::update() {
+    fillHalo();
+    auto body = [&](size_t begin, size_t end) {
+        nextRows((Coord)begin, (Coord)end);
+    };
+    if (m_pool) {
+        m_pool->parallelFor((size_t)m_height, kGridGrain, body);
+    } else {
+        body(0, (size_t)m_height);
+    }
+    m_cells.swap(m_next);
+}
+
+void GridEngine::query(const AABB& range, std::vector<XY>& output) {
+    // Only the rows and words the range overlaps
+    Coord left = std::max(range.left, m_left);
+    Coord right = std::min(range.right, m_left + m_width - 1);
+    Coord top = std::max(range.top, m_top);
+    Coord bottom = std::min(range.bottom, m_top + m_height - 1);
+    if (left > right || top > bottom) {
+        return;
+    }
+    size_t firstWord = 1 + (size_t)(left - m_left) / kTileSize;
+    size_t lastWord = 1 + (size_t)(right - m_left) / kTileSize;
+    for (Coord y = top - m_top; y <= bottom - m_top; y++) {
+        const uint64_t* cells = row(m_cells, y);
+        for (size_t i = firstWord; i <= lastWord; i++) {
+            uint64_t word = cells[i];
+            while (word) {
+                int bit = ctz64(word);
+                word &= word - 1;
+                XY xy(m_left + (Coord)((i - 1) * kTileSize) + bit, m_top + y);
+                if (range.contains(xy)) {
+                    output.push_back(xy);
+                }
+            }
+        }
+    }
+}
+
+void GridEngine::print(std::ostream& output) {
+    output << "#Life 1.06\n";
+    std::vector<XY> cells;
+    query(AABB(XY(0, 0),
+               std::numeric_limits<Coord>::min(), std::numeric_limits<Coord>::max(),
+               std::numeric_limits<Coord>::min(), std::numeric_limits<Coord>::max()),
+          cells);
+    for (auto& xy : cells) {
+        output << xy.x << " " << xy.y << std::endl;
+    }
+}
+
+size_t GridEngine::cellCount() {
+    size_t result = 0;
+    for (Coord y = 0; y < m_height; y++) {
+        const uint64_t* cells = row(m_cells, y);
+        for (size_t i = 1; i <= m_words; i++) {
+            result += popcount64(cells[i]);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,70 @@
+#ifndef GridMap_H
+
+#define GridMap_H
+#pragma once
+#include <string>
+#include <vector>
+#include "tilemap.h"
+
+// Rows handed to a worker at a time
+constexpr size_t kGridGrain = 16;
+// Largest side of a bounded universe
+constexpr Coord kMaxGridSide = 1 << 20;
+
+// Parses "WxH", e.g. "1024x768", with sides from 1 to kMaxGridSide
+bool ParseGridSize(const std::string& text, Coord& width, Coord& height);
+
+// Fixed width x height universe centered on the origin, its top left
+// cell is (-width / 2, -height / 2). On a torus the edges wrap around,
+// otherwise the cells past them are always dead. Cells added outside are
+// wrapped in on a torus and dropped otherwise.
+//
+// Every cell lives in one contiguous bit grid, 64 cells per word, with a
+// halo word on both ends of each row and a halo row above and below. An
+// update fills the halo from the opposite edges (or leaves it dead),
+// computes the next generation into a second grid with the tile
+// engine's adders, four words at a time with AVX2, and swaps the two.
+// Rows are spread over a work-stealing pool when more than one thread is
+// configured.
+class GridEngine : public LifeEngine {
+public:
+    GridEngine(Coord width, Coord height, bool torus, bool simd = true);
+
+    void addCell(const XY& xy) override;
+    void update() override;
+    void query(const AABB& range, std::vector<XY>& output) override;
+    void print(std::ostream& output) override;
+    size_t cellCount() override;
+    void setThreadCount(unsigned threads) override;
+
+    bool getCell(const XY& xy) const;
+    Coord width() const { return m_width; }
+    Coord height() const { return m_height; }
+    bool torus() const { return m_torus; }
+    bool simd() const { return m_simd; }
+
+private:
+    uint64_t* row(std::vector<uint64_t>& grid, Coord y) { return grid.data() + (size_t)(y + 1) * m_stride; }
+    const uint64_t* row(const std::vector<uint64_t>& grid, Coord y) const {
+        return grid.data() + (size_t)(y + 1) * m_stride;
+    }
+    void fillHalo();
+    void nextRows(Coord begin, Coord end);
+
+    Coord m_width;
+    Coord m_height;
+    bool m_torus;
+    bool m_simd;
+    Coord m_left;
+    Coord m_top;
+    // Words of cells per row, and per row with the two halo words
+    size_t m_words;
+    size_t m_stride;
+    // Live bits of the last word of a row
+    uint64_t m_lastMask;
+    std::vector<uint64_t> m_cells;
+    std::vector<uint64_t> m_next;
+    std::unique_ptr<ThreadPool> m_pool;
+};
+
+#endif
@@ -0,0 +1,509 @@
+#include "hashlife.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+// Flipping the sign bit maps the signed Coord order onto the unsigned
+// order, MIN becomes 0 and MAX becomes 2^64 - 1.
+constexpr uint64_t kSignBit = 1ULL << 63;
+
+inline uint64_t coord2Local(Coord c) {
+    return (uint64_t)c ^ kSignBit;
+}
+
+inline Coord local2Coord(uint64_t u) {
+    return (Coord)(u ^ kSignBit);
+}
+
+// Offset of the last cell covered by a node of the given level
+inline uint64_t levelExtent(int level) {
+    return level >= 64 ? std::numeric_limits<uint64_t>::max() : (1ULL << level) - 1;
+}
+
+HashLifeNode::HashLifeNode(HashLifeNode* inw, HashLifeNode* ine, HashLifeNode* isw, HashLifeNode* ise)
+    : nw(inw), ne(ine), sw(isw), se(ise),
+      population(inw->population + ine->population + isw->population + ise->population),
+      level(inw->level + 1) {}
+
+HashLifeEngine::HashLifeEngine()
+    : m_dead(false), m_alive(true) {
+    m_empty.push_back(&m_dead);
+    // One extra level for the tiled universe used by step()
+    for (int level = 1; level <= kHashLifeRootLevel + 1; level++) {
+        HashLifeNode* e = m_empty.back();
+        m_empty.push_back(join(e, e, e, e));
+    }
+    m_root = m_empty[kHashLifeRootLevel];
+}
+
+HashLifeNode* HashLifeEngine::join(HashLifeNode* nw, HashLifeNode* ne, HashLifeNode* sw, HashLifeNode* se) {
+    HashLifeKey key{nw, ne, sw, se};
+    auto it = m_nodes.find(key);
+    if (it != m_nodes.end()) {
+        return it->second.get();
+    }
+    auto result = m_nodes.emplace(key, std::make_unique<HashLifeNode>(nw, ne, sw, se));
+    if (!result.second) {
+        throw std::runtime_error("Unable to insert node to hash table");
+    }
+    return result.first->second.get();
+}
+
+HashLifeNode* HashLifeEngine::empty(int level) {
+    return m_empty[level];
+}
+
+HashLifeNode* HashLifeEngine::centre(HashLifeNode* node) {
+    return join(node->nw->se, node->ne->sw, node->sw->ne, node->se->nw);
+}
+
+HashLifeNode* HashLifeEngine::advanceLevel2(HashLifeNode* node) {
+    // Gather the 4x4 block, bit (y * 4 + x)
+    uint16_t bits = 0;
+    HashLifeNode* quads[4] = {node->nw, node->ne, node->sw, node->se};
+    for (int q = 0; q < 4; q++) {
+        int ox = (q & 1) * 2;
+        int oy = (q >> 1) * 2;
+        HashLifeNode* cells[4] = {quads[q]->nw, quads[q]->ne, quads[q]->sw, quads[q]->se};
+        for (int c = 0; c < 4; c++) {
+            if (cells[c]->alive) {
+                bits |= 1 << ((oy + (c >> 1)) * 4 + ox + (c & 1));
+            }
+        }
+    }
+
+    HashLifeNode* next[4];
+    for (int c = 0; c < 4; c++) {
+        int x = 1 + (c & 1);
+        int y = 1 + (c >> 1);
+        CellState state = (bits >> (y * 4 + x)) & 1;
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if ((dx || dy) && ((bits >> ((y + dy) * 4 + x + dx)) & 1)) {
+                    UpdateCellNeighborCount(state, 1);
+                }
+            }
+        }
+        UpdateCellAliveness(state, m_kernel);
+        next[c] = GetCellAliveness(state) ? &m_alive : &m_dead;
+    }
+    return join(next[0], next[1], next[2], next[3]);
+}
+
+HashLifeNode* HashLifeEngine::advance(HashLifeNode* node, int log2Generations) {
+    // Returns the center of the node, advanced by 2^log2Generations,
+    // where log2Generations <= level - 2
+    if (node == empty(node->level)) {
+        return empty(node->level - 1);
+    }
+    if (node->m_resultStep == log2Generations) {
+        return node->m_result;
+    }
+
+    HashLifeNode* result;
+    if (node->level == 2) {
+        result = advanceLevel2(node);
+    } else {
+        HashLifeNode* nw = node->nw;
+        HashLifeNode* ne = node->ne;
+        HashLifeNode* sw = node->sw;
+        HashLifeNode* se = node->se;
+
+        // Nine overlapping sub-squares one level down
+        HashLifeNode* n[9] = {
+            nw,
+            join(nw->ne, ne->nw, nw->se, ne->sw),
+            ne,
+            join(nw->sw, nw->se, sw->nw, sw->ne),
+            join(nw->se, ne->sw, sw->ne, se->nw),
+            join(ne->sw, ne->se, se->nw, se->ne),
+            sw,
+            join(sw->ne, se->nw, sw->se, se->sw),
+            se
+        };
+
+        // At full speed both halves advance by 2^(level-3), otherwise
+        // the first half only recenters
+        bool full = log2Generations == node->level - 2;
+        int sub = full ? log2Generations - 1 : log2Generations;
+        HashLifeNode* r[9];
+        for (int i = 0; i < 9; i++) {
+            r[i] = full ? advance(n[i], sub) : centre(n[i]);
+        }
+
+        result = join(
+            advance(join(r[0], r[1], r[3], r[4]), sub),
+            advance(join(r[1], r[2], r[4], r[5]), sub),
+            advance(join(r[3], r[4], r[6], r[7]), sub),
+            advance(join(r[4], r[5], r[7], r[8]), sub));
+    }
+
+    node->m_result = result;
+    node->m_resultStep = log2Generations;
+    return result;
+}
+
+HashLifeNode* HashLifeEngine::setCell(HashLifeNode* node, uint64_t x, uint64_t y, bool alive) {
+    if (node->level == 0) {
+        return alive ? &m_alive : &m_dead;
+    }
+    int shift = node->level - 1;
+    bool east = (x >> shift) & 1;
+    bool south = (y >> shift) & 1;
+    uint64_t mask = levelExtent(shift);
+    x &= mask;
+    y &= mask;
+
+    if (!south && !east) {
+        return join(setCell(node->nw, x, y, alive), node->ne, node->sw, node->se);
+    } else if (!south) {
+        return join(node->nw, setCell(node->ne, x, y, alive), node->sw, node->se);
+    } else if (!east) {
+        return join(node->nw, node->ne, setCell(node->sw, x, y, alive), node->se);
+    } else {
+        return join(node->nw, node->ne, node->sw, setCell(node->se, x, y, alive));
+    }
+}
+
+void HashLifeEngine::addCell(const XY& xy) {
+    m_root = setCell(m_root, coord2Local(xy.x), coord2Local(xy.y), true);
+}
+
+// Child a key falls into below a node of the given level, in nw, ne, sw,
+// se order. Morton keys flip the sign bits like coord2Local does.
+inline int mortonQuadrant(const MortonKey& key, int level) {
+    int bit = 2 * (level - 1);
+    uint64_t word = bit >= 64 ? key.hi : key.lo;
+    return (int)((word >> (bit & 63)) & 3);
+}
+
+HashLifeNode* HashLifeEngine::build(const MortonKey* begin, const MortonKey* end, int level) {
+    if (begin == end) {
+        return empty(level);
+    }
+    if (level == 0) {
+        return &m_alive;
+    }
+    // Sorted keys keep each child's cells together
+    const MortonKey* split[5] = {begin, nullptr, nullptr, nullptr, end};
+    for (int q = 1; q < 4; q++) {
+        split[q] = std::partition_point(split[q - 1], end, [&](const MortonKey& key) {
+            return mortonQuadrant(key, level) < q;
+        });
+    }
+    return join(build(split[0], split[1], level - 1),
+                build(split[1], split[2], level - 1),
+                build(split[2], split[3], level - 1),
+                build(split[3], split[4], level - 1));
+}
+
+HashLifeNode* HashLifeEngine::merge(HashLifeNode* a, HashLifeNode* b) {
+    if (a == b || b == empty(b->level)) {
+        return a;
+    }
+    if (a == empty(a->level)) {
+        return b;
+    }
+    if (a->level == 0) {
+        return &m_alive;
+    }
+    return join(merge(a->nw, b->nw), merge(a->ne, b->ne), merge(a->sw, b->sw), merge(a->se, b->se));
+}
+
+void HashLifeEngine::addCells(const std::vector<XY>& cells) {
+    std::vector<MortonKey> keys;
+    keys.reserve(cells.size());
+    for (auto& xy : cells) {
+        keys.push_back(MortonEncode(xy));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    m_root = merge(m_root, build(keys.data(), keys.data() + keys.size(), kHashLifeRootLevel));
+}
+
+bool HashLifeEngine::getCell(const XY& xy) {
+    uint64_t x = coord2Local(xy.x);
+    uint64_t y = coord2Local(xy.y);
+    HashLifeNode* node = m_root;
+    while (node->level > 0) {
+        if (node == empty(node->level)) {
+            return false;
+        }
+        int shift = node->level - 1;
+        bool east = (x >> shift) & 1;
+        bool south = (y >> shift) & 1;
+        node = south ? (east ? node->se : node->sw) : (east ? node->ne : node->nw);
+    }
+    return node->alive;
+}
+
+void HashLifeEngine::update() {
+    step(0);
+}
+
+void HashLifeEngine::step(unsigned log2Generations) {
+    // The tiled node below can advance at most 2^63 generations at once
+    if (log2Generations > kHashLifeRootLevel - 1) {
+        step(log2Generations - 1);
+        step(log2Generations - 1);
+        return;
+    }
+
+    // Tile the torus 2x2, the center of the tiling is the whole universe
+    // shifted by half its size in both directions
+    HashLifeNode* tiled = join(m_root, m_root, m_root, m_root);
+    HashLifeNode* shifted = advance(tiled, log2Generations);
+
+    // Shift back by swapping quadrants
+    m_root = join(shifted->se, shifted->sw, shifted->ne, shifted->nw);
+
+    if (m_nodes.size() > m_gcThreshold) {
+        garbageCollect();
+    }
+}
+
+void HashLifeEngine::mark(HashLifeNode* node) {
+    if (node->m_marked || node->level == 0) {
+        return;
+    }
+    node->m_marked = true;
+    mark(node->nw);
+    mark(node->ne);
+    mark(node->sw);
+    mark(node->se);
+}
+
+void HashLifeEngine::setRule(const Rule& rule) {
+    LifeEngine::setRule(rule);
+    m_kernel = RuleTable(rule);
+    garbageCollect();
+}
+
+void HashLifeEngine::garbageCollect() {
+    mark(m_root);
+    for (auto& e : m_empty) {
+        mark(e);
+    }
+
+    for (auto it = m_nodes.begin(); it != m_nodes.end();) {
+        HashLifeNode* node = it->second.get();
+        if (!node->m_marked) {
+            it = m_nodes.erase(it);
+        } else {
+            // Results may point to collected nodes
+            node->m_marked = false;
+            node->m_result = nullptr;
+            node->m_resultStep = -1;
+            it++;
+        }
+    }
+
+    m_gcThreshold = std::max(kHashLifeGCThreshold, m_nodes.size() * 2);
+}
+
+void HashLifeEngine::collect(HashLifeNode* node, uint64_t x, uint64_t y,
+                             uint64_t left, uint64_t right, uint64_t top, uint64_t bottom,
+                             std::vector<XY>& output) {
+    if (node == empty(node->level)) {
+        return;
+    }
+    uint64_t extent = levelExtent(node->level);
+    if (x > right || x + extent < left || y > bottom || y + extent < top) {
+        return;
+    }
+    if (node->level == 0) {
+        output.emplace_back(local2Coord(x), local2Coord(y));
+        return;
+    }
+
+    uint64_t half = 1ULL << (node->level - 1);
+    collect(node->nw, x, y, left, right, top, bottom, output);
+    collect(node->ne, x + half, y, left, right, top, bottom, output);
+    collect(node->sw, x, y + half, left, right, top, bottom, output);
+    collect(node->se, x + half, y + half, left, right, top, bottom, output);
+}
+
+void HashLifeEngine::query(const AABB& range, std::vector<XY>& output) {
+    collect(m_root, 0, 0,
+            coord2Local(range.left), coord2Local(range.right),
+            coord2Local(range.top), coord2Local(range.bottom),
+            output);
+}
+
+void HashLifeEngine::collectDensity(HashLifeNode* node, uint64_t x, uint64_t y, DensityGrid& grid) {
+    if (node->population == 0) {
+        return;
+    }
+    uint64_t extent = levelExtent(node->level);
+    DensityGrid::Cover cover = grid.cover(local2Coord(x), local2Coord(y), extent, extent);
+    if (cover == DensityGrid::kOutside) {
+        return;
+    }
+    if (cover == DensityGrid::kOnePixel) {
+        grid.add(XY(local2Coord(x), local2Coord(y)), node->population);
+        return;
+    }
+
+    uint64_t half = 1ULL << (node->level - 1);
+    collectDensity(node->nw, x, y, grid);
+    collectDensity(node->ne, x + half, y, grid);
+    collectDensity(node->sw, x, y + half, grid);
+    collectDensity(node->se, x + half, y + half, grid);
+}
+
+void HashLifeEngine::queryDensity(DensityGrid& grid) {
+    std::fill(grid.counts.begin(), grid.counts.end(), 0);
+    collectDensity(m_root, 0, 0, grid);
+}
+
+HashLifeNode* HashLifeEngine::expand(HashLifeNode* node) {
+    HashLifeNode* e = empty(node->level - 1);
+    return join(join(e, e, e, node->nw), join(e, e, node->ne, e),
+                join(e, node->sw, e, e), join(node->se, e, e, e));
+}
+
+void HashLifeEngine::readMacrocell(std::istream& input) {
+    std::string line;
+    if (!std::getline(input, line) || line.rfind("[M2]", 0) != 0) {
+        throw std::runtime_error("Not a macrocell file");
+    }
+
+    // Node n of the file is nodes[n], 0 stands for an empty node
+    Rule rule = m_rule;
+    std::vector<HashLifeNode*> nodes = {nullptr};
+    while (std::getline(input, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.size() > 3 && line.compare(0, 3, "#R ") == 0) {
+            if (!ParseRule(line.substr(3), rule)) {
+                throw std::runtime_error("Unsupported macrocell rule: " + line.substr(3));
+            }
+            continue;
+        }
+        if (line.empty() || line[0] == '#') {
+            // Generation and comments
+            continue;
+        }
+
+        if (line[0] == '.' || line[0] == '*' || line[0] == '$') {
+            // 8x8 leaf, rows end with $ and trailing dead cells are left out
+            HashLifeNode* node = empty(kMacrocellLeafLevel);
+            uint64_t x = 0;
+            uint64_t y = 0;
+            for (char c : line) {
+                if (c == '$') {
+                    x = 0;
+                    y++;
+                    continue;
+                }
+                if ((c != '.' && c != '*') || x >= 8 || y >= 8) {
+                    throw std::runtime_error("Malformed macrocell leaf: " + line);
+                }
+                if (c == '*') {
+                    node = setCell(node, x, y, true);
+                }
+                x++;
+            }
+            nodes.push_back(node);
+            continue;
+        }
+
+        std::istringstream fields(line);
+        int level;
+        uint64_t children[4];
+        if (!(fields >> level >> children[0] >> children[1] >> children[2] >> children[3]) ||
+            level <= kMacrocellLeafLevel || level > kHashLifeRootLevel) {
+            throw std::runtime_error("Malformed macrocell node: " + line);
+        }
+        HashLifeNode* quads[4];
+        for (int q = 0; q < 4; q++) {
+            if (children[q] >= nodes.size()) {
+                throw std::runtime_error("Macrocell node refers to a later node: " + line);
+            }
+            quads[q] = children[q] == 0 ? empty(level - 1) : nodes[children[q]];
+            if (quads[q]->level != level - 1) {
+                throw std::runtime_error("Macrocell node levels do not match: " + line);
+            }
+        }
+        nodes.push_back(join(quads[0], quads[1], quads[2], quads[3]));
+    }
+
+    // The last node is the root, grow it to the whole plane around the
+    // origin
+    HashLifeNode* root = nodes.size() > 1 ? nodes.back() : empty(kHashLifeRootLevel);
+    while (root->level < kHashLifeRootLevel) {
+        root = expand(root);
+    }
+    m_root = root;
+    if (rule != m_rule) {
+        setRule(rule);
+    }
+}
+
+uint64_t HashLifeEngine::writeNode(HashLifeNode* node, std::unordered_map<HashLifeNode*, uint64_t>& indices,
+                                   std::ostream& output) {
+    if (node == empty(node->level)) {
+        return 0;
+    }
+    auto it = indices.find(node);
+    if (it != indices.end()) {
+        return it->second;
+    }
+
+    if (node->level == kMacrocellLeafLevel) {
+        std::string leaf;
+        for (uint64_t y = 0; y < 8; y++) {
+            std::string row;
+            for (uint64_t x = 0; x < 8; x++) {
+                // Walk down the three levels to the cell
+                HashLifeNode* cell = node;
+                for (int shift = 2; shift >= 0; shift--) {
+                    bool east = (x >> shift) & 1;
+                    bool south = (y >> shift) & 1;
+                    cell = south ? (east ? cell->se : cell->sw) : (east ? cell->ne : cell->nw);
+                }
+                row.push_back(cell->alive ? '*' : '.');
+            }
+            row.erase(row.find_last_not_of('.') + 1);
+            leaf += row + "$";
+        }
+        output << leaf << "\n";
+    } else {
+        uint64_t nw = writeNode(node->nw, indices, output);
+        uint64_t ne = writeNode(node->ne, indices, output);
+        uint64_t sw = writeNode(node->sw, indices, output);
+        uint64_t se = writeNode(node->se, indices, output);
+        output << node->level << " " << nw << " " << ne << " " << sw << " " << se << "\n";
+    }
+    uint64_t index = indices.size() + 1;
+    indices.emplace(node, index);
+    return index;
+}
+
+void HashLifeEngine::writeMacrocell(std::ostream& output) {
+    output << "[M2] (conway_sdl)\n";
+    output << "#R " << m_rule.toString() << "\n";
+    // Drop empty borders while the pattern fits in the center
+    HashLifeNode* root = m_root;
+    while (root->level > kMacrocellLeafLevel && centre(root)->population == root->population) {
+        root = centre(root);
+    }
+    std::unordered_map<HashLifeNode*, uint64_t> indices;
+    writeNode(root, indices, output);
+}
+
+void HashLifeEngine::print(std::ostream& output) {
+    std::vector<XY> cells;
+    collect(m_root, 0, 0, 0, levelExtent(kHashLifeRootLevel), 0, levelExtent(kHashLifeRootLevel), cells);
+    output << "#Life 1.06\n";
+    for (auto& xy : cells) {
+        output << xy.x << " " << xy.y << std::endl;
+    }
+}
+
+size_t HashLifeEngine::cellCount() {
+    return m_root->population;
+}
@@ -0,0 +1,125 @@
+#ifndef HashLife_H
+
+#define HashLife_H
+#pragma once
+#include "cellmap.h"
+#include "morton.h"
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+
+// Level of the node covering the whole Coord plane (2^64 x 2^64 cells)
+constexpr int kHashLifeRootLevel = 64;
+// Macrocell leaves are 8x8 blocks
+constexpr int kMacrocellLeafLevel = 3;
+// Collect unreachable nodes once the table grows beyond this many nodes
+constexpr size_t kHashLifeGCThreshold = 1 << 22;
+
+// Hash-consed quadtree node. A node of level n covers 2^n x 2^n cells,
+// level 0 nodes are single cells. Nodes are immutable and unique, so two
+// equal subtrees are always the same pointer.
+class HashLifeNode {
+public:
+    HashLifeNode(HashLifeNode* inw, HashLifeNode* ine, HashLifeNode* isw, HashLifeNode* ise);
+    explicit HashLifeNode(bool ialive)
+        : population(ialive ? 1 : 0), level(0), alive(ialive) {}
+
+    HashLifeNode* nw = nullptr;
+    HashLifeNode* ne = nullptr;
+    HashLifeNode* sw = nullptr;
+    HashLifeNode* se = nullptr;
+
+    uint64_t population;
+    int level;
+    bool alive = false;
+
+    // Memoized center advanced by 2^m_resultStep generations
+    HashLifeNode* m_result = nullptr;
+    int m_resultStep = -1;
+
+    bool m_marked = false;
+};
+
+class HashLifeKey {
+public:
+    HashLifeNode* nw;
+    HashLifeNode* ne;
+    HashLifeNode* sw;
+    HashLifeNode* se;
+
+    bool operator==(const HashLifeKey& other) const {
+        return nw == other.nw && ne == other.ne && sw == other.sw && se == other.se;
+    }
+};
+
+template<>
+struct std::hash<HashLifeKey>
+{
+    std::size_t operator()(HashLifeKey const& key) const noexcept
+    {
+        uint64_t result = (uint64_t)key.nw;
+        result = result * 0x9e3779b97f4a7c15ULL + (uint64_t)key.ne;
+        result = result * 0x9e3779b97f4a7c15ULL + (uint64_t)key.sw;
+        result = result * 0x9e3779b97f4a7c15ULL + (uint64_t)key.se;
+        return result ^ (result >> 29);
+    }
+};
+
+// Memoized HashLife engine over the full int64 plane. The plane wraps
+// around at the Coord limits exactly like big_int_addition does, i.e. the
+// universe is a 2^64 x 2^64 torus.
+class HashLifeEngine : public LifeEngine {
+public:
+    HashLifeEngine();
+
+    void addCell(const XY& xy) override;
+    // Builds the cells into a tree of their own and merges it in
+    void addCells(const std::vector<XY>& cells) override;
+    void update() override;
+    void step(unsigned log2Generations) override;
+    void query(const AABB& range, std::vector<XY>& output) override;
+    void queryDensity(DensityGrid& grid) override;
+    void print(std::ostream& output) override;
+    size_t cellCount() override;
+
+    bool getCell(const XY& xy);
+    size_t nodeCount() const { return m_nodes.size(); }
+    // Macrocell files as written by Golly: every distinct subtree is one
+    // line, so the cost follows the unique nodes, not the population. The
+    // root is centered on the origin. Reading replaces the pattern, takes
+    // the rule of a #R line and throws on malformed input.
+    void readMacrocell(std::istream& input);
+    void writeMacrocell(std::ostream& output);
+    // Memoized results belong to the old rule and are dropped
+    void setRule(const Rule& rule) override;
+    void garbageCollect();
+
+private:
+    HashLifeNode* join(HashLifeNode* nw, HashLifeNode* ne, HashLifeNode* sw, HashLifeNode* se);
+    HashLifeNode* empty(int level);
+    HashLifeNode* centre(HashLifeNode* node);
+    HashLifeNode* advance(HashLifeNode* node, int log2Generations);
+    HashLifeNode* advanceLevel2(HashLifeNode* node);
+    HashLifeNode* setCell(HashLifeNode* node, uint64_t x, uint64_t y, bool alive);
+    HashLifeNode* build(const MortonKey* begin, const MortonKey* end, int level);
+    HashLifeNode* merge(HashLifeNode* a, HashLifeNode* b);
+    // The node one level up with node in its center
+    HashLifeNode* expand(HashLifeNode* node);
+    uint64_t writeNode(HashLifeNode* node, std::unordered_map<HashLifeNode*, uint64_t>& indices,
+                       std::ostream& output);
+    void collect(HashLifeNode* node, uint64_t x, uint64_t y,
+                 uint64_t left, uint64_t right, uint64_t top, uint64_t bottom,
+                 std::vector<XY>& output);
+    void collectDensity(HashLifeNode* node, uint64_t x, uint64_t y, DensityGrid& grid);
+    void mark(HashLifeNode* node);
+
+    HashLifeNode m_dead;
+    HashLifeNode m_alive;
+    std::unordered_map<HashLifeKey, std::unique_ptr<HashLifeNode>> m_nodes;
+    std::vector<HashLifeNode*> m_empty;
+    HashLifeNode* m_root;
+    RuleTable m_kernel = RuleTable(kConwayRule);
+    size_t m_gcThreshold = kHashLifeGCThreshold;
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "isotropic.h"
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+// Rows IsotropicKernel::nextRows evaluates at once
+constexpr int kIsotropicLanes = 4;
+
+// The 8 neighbors of the cell in a neighborhood index
+constexpr unsigned kNeighborMask = (kNeighborhoods - 1) & ~(1u << 4);
+
+// Hensel's letters for 1 to 4 neighbors and one arrangement of each, the
+// others are its rotations and reflections. 5 to 7 neighbors use the
+// letters of 3 to 1 for the complementary arrangement.
+static const char* const kHenselLetters[4] = {"ce", "cekain", "cekainyqjr", "cekainyqjrtwz"};
+static const unsigned kHenselNeighborhoods[4][13] = {
+    {1, 2},
+    {5, 10, 33, 3, 40, 68},
+    {69, 42, 98, 11, 7, 13, 97, 70, 14, 41},
+    {325, 170, 99, 15, 45, 71, 78, 102, 106, 43, 101, 105, 108}
+};
+
+// Cell (x, y) of neighborhood, each 0..2
+static bool cellAt(unsigned neighborhood, int x, int y) {
+    return (neighborhood >> (3 * y + x)) & 1;
+}
+
+// Rotations (turns of 90 degrees) and reflection of a neighborhood
+static unsigned transform(unsigned neighborhood, int turns, bool reflect) {
+    unsigned result = 0;
+    for (int y = 0; y < 3; y++) {
+        for (int x = 0; x < 3; x++) {
+            int tx = reflect ? 2 - x : x;
+            int ty = y;
+            for (int i = 0; i < turns; i++) {
+                int rotated = 2 - ty;
+                ty = tx;
+                tx = rotated;
+            }
+            result |= (unsigned)cellAt(neighborhood, x, y) << (3 * ty + tx);
+        }
+    }
+    return result;
+}
+
+static void setBit(uint64_t* bits, unsigned i) {
+    bits[i >> 6] |= 1ULL << (i & 63);
+}
+
+static bool getBit(const uint64_t* bits, unsigned i) {
+    return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+// Adds every arrangement of count neighbors that letter names
+static bool addLetter(uint64_t* neighborhoods, int count, char letter) {
+    int base = count <= 4 ? count : 8 - count;
+    if (base == 0) {
+        return false;
+    }
+    const char* letters = kHenselLetters[base - 1];
+    const char* found = std::strchr(letters, letter);
+    if (!found) {
+        return false;
+    }
+    unsigned neighborhood = kHenselNeighborhoods[base - 1][found - letters];
+    if (count > 4) {
+        neighborhood ^= kNeighborMask;
+    }
+    for (int turns = 0; turns < 4; turns++) {
+        setBit(neighborhoods, transform(neighborhood, turns, false));
+        setBit(neighborhoods, transform(neighborhood, turns, true));
+    }
+    return true;
+}
+
+// One half of a rule, e.g. "2-a" or "34cz", into the neighborhoods it
+// covers with the cell itself left out
+static bool parseHalf(const std::string& text, uint64_t* neighborhoods) {
+    size_t i = 0;
+    while (i < text.size()) {
+        if (text[i] < '0' || text[i] > '8') {
+            return false;
+        }
+        int count = text[i++] - '0';
+        bool negate = i < text.size() && text[i] == '-';
+        if (negate) {
+            i++;
+        }
+        uint64_t letters[kNeighborhoods / 64] = {};
+        bool any = false;
+        while (i < text.size() && std::islower((unsigned char)text[i])) {
+            if (!addLetter(letters, count, text[i++])) {
+                return false;
+            }
+            any = true;
+        }
+        if (negate && !any) {
+            return false;
+        }
+        for (unsigned neighborhood = 0; neighborhood < kNeighborhoods; neighborhood++) {
+            int neighbors = (int)std::bitset<kNeighborhoodCells>(neighborhood).count();
+            if ((neighborhood & ~kNeighborMask) || neighbors != count) {
+                continue;
+            }
+            if (!any || getBit(letters, neighborhood) != negate) {
+                setBit(neighborhoods, neighborhood);
+            }
+        }
+    }
+    return true;
+}
+
+bool ParseIsotropicRule(const std::string& text, IsotropicRule& rule) {
+    size_t slash = text.find('/');
+    if (slash == std::string::npos || slash == 0 || slash + 1 == text.size()) {
+        return false;
+    }
+    std::string first = text.substr(0, slash);
+    std::string second = text.substr(slash + 1);
+    char firstKind = (char)std::toupper((unsigned char)first[0]);
+    char secondKind = (char)std::toupper((unsigned char)second[0]);
+    std::string birth, survival;
+    if (firstKind == 'B' && secondKind == 'S') {
+        birth = first.substr(1);
+        survival = second.substr(1);
+    } else if (firstKind == 'S' && secondKind == 'B') {
+        survival = first.substr(1);
+        birth = second.substr(1);
+    } else {
+        return false;
+    }
+
+    uint64_t born[kNeighborhoods / 64] = {};
+    uint64_t survives[kNeighborhoods / 64] = {};
+    if (!parseHalf(birth, born) || !parseHalf(survival, survives) || getBit(born, 0)) {
+        return false;
+    }
+    IsotropicRule result;
+    for (unsigned neighborhood = 0; neighborhood < kNeighborhoods; neighborhood++) {
+        bool alive = (neighborhood >> 4) & 1;
+        if (getBit(alive ? survives : born, neighborhood & kNeighborMask)) {
+            setBit(result.table, neighborhood);
+        }
+    }
+    result.text = "B" + birth + "/S" + survival;
+    rule = result;
+    return true;
+}
+
+IsotropicKernel::IsotropicKernel(const IsotropicRule& rule) : m_rule(rule) {
+    std::vector<bool> table(kNeighborhoods);
+    for (unsigned neighborhood = 0; neighborhood < kNeighborhoods; neighborhood++) {
+        table[neighborhood] = rule.next(neighborhood);
+    }
+    std::map<std::vector<bool>, uint16_t> seen;
+    m_result = compile(table, seen);
+    if (m_ops.size() > kMaxIsotropicOps) {
+        throw std::logic_error("Isotropic rule compiled to too many operations");
+    }
+}
+
+uint16_t IsotropicKernel::compile(const std::vector<bool>& table, std::map<std::vector<bool>, uint16_t>& seen) {
+    // Constant functions are the first two slots
+    bool constant = true;
+    for (bool value : table) {
+        constant = constant && value == table[0];
+    }
+    if (constant) {
+        return table[0] ? 1 : 0;
+    }
+    auto it = seen.find(table);
+    if (it != seen.end()) {
+        return it->second;
+    }
+
+    // Split on the highest cell, the upper half of the table has it set
+    size_t half = table.size() / 2;
+    uint8_t cell = 0;
+    while ((2u << cell) < table.size()) {
+        cell++;
+    }
+    uint16_t zero = compile(std::vector<bool>(table.begin(), table.begin() + half), seen);
+    uint16_t one = compile(std::vector<bool>(table.begin() + half, table.end()), seen);
+    uint16_t slot;
+    if (zero == 0 && one == 1) {
+        slot = 2 + cell;
+    } else {
+        slot = (uint16_t)(kFirstOp + m_ops.size());
+        m_ops.push_back({cell, zero, one});
+    }
+    seen.emplace(table, slot);
+    return slot;
+}
+
+void IsotropicKernel::nextRows(const uint64_t* l, const uint64_t* c, const uint64_t* r, uint64_t* output,
+                               int count) const {
+    // kIsotropicLanes rows go through the program together, which keeps
+    // independent work in flight and lets the compiler vectorize
+    uint64_t values[kFirstOp + kMaxIsotropicOps][kIsotropicLanes];
+    for (int lane = 0; lane < kIsotropicLanes; lane++) {
+        values[0][lane] = 0;
+        values[1][lane] = ~0ULL;
+    }
+    for (int j = 0; j < count; j += kIsotropicLanes) {
+        int lanes = std::min(kIsotropicLanes, count - j);
+        for (int lane = 0; lane < kIsotropicLanes; lane++) {
+            // Rows past count repeat the last one
+            int row = j + std::min(lane, lanes - 1);
+            for (int dy = 0; dy < 3; dy++) {
+                values[2 + 3 * dy][lane] = l[row + dy];
+                values[3 + 3 * dy][lane] = c[row + dy];
+                values[4 + 3 * dy][lane] = r[row + dy];
+            }
+        }
+        uint64_t (*slot)[kIsotropicLanes] = values + kFirstOp;
+        for (const Op& op : m_ops) {
+            const uint64_t* select = values[2 + op.cell];
+            const uint64_t* one = values[op.one];
+            const uint64_t* zero = values[op.zero];
+            for (int lane = 0; lane < kIsotropicLanes; lane++) {
+                (*slot)[lane] = (select[lane] & one[lane]) | (~select[lane] & zero[lane]);
+            }
+            slot++;
+        }
+        for (int lane = 0; lane < lanes; lane++) {
+            output[j + lane] = values[m_result][lane];
+        }
+    }
+}
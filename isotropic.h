@@ -0,0 +1,68 @@
+#ifndef Isotropic_H
+
+#define Isotropic_H
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Index into an IsotropicRule's table: bit 3 * dy + dx is the cell at
+// (x + dx - 1, y + dy - 1), so bit 4 is the cell itself
+constexpr int kNeighborhoodCells = 9;
+constexpr int kNeighborhoods = 1 << kNeighborhoodCells;
+// Nodes a reduced decision diagram over 9 cells can have
+constexpr size_t kMaxIsotropicOps = 256;
+
+// Isotropic non-totalistic rule in Hensel notation, e.g. "B2-a/S12". A
+// count may be followed by letters naming which arrangements of that
+// many neighbors it covers, "-" before the letters takes all the others.
+// The rule is kept as the next state of each 3x3 neighborhood.
+class IsotropicRule {
+public:
+    bool next(unsigned neighborhood) const { return (table[neighborhood >> 6] >> (neighborhood & 63)) & 1; }
+    std::string toString() const { return text; }
+
+    uint64_t table[kNeighborhoods / 64] = {};
+    // As parsed, with B and S in upper case
+    std::string text;
+};
+
+// Takes B/S and S/B order and plain counts, so any Life-like rule parses
+// too. Rejects letters a count does not have and rules with B0.
+bool ParseIsotropicRule(const std::string& text, IsotropicRule& rule);
+
+// IsotropicRule compiled once into a straight-line program of
+// multiplexers, one per node of the reduced decision diagram of its
+// table. Runs on bit-packed rows, 64 cells per word.
+class IsotropicKernel {
+public:
+    explicit IsotropicKernel(const IsotropicRule& rule);
+
+    // Same layout as TileEngine's adders: rows -1..count of west
+    // neighbors (l), cells (c) and east neighbors (r) in, rows 0..count-1
+    // of the next generation out
+    void nextRows(const uint64_t* l, const uint64_t* c, const uint64_t* r, uint64_t* output, int count) const;
+
+    const IsotropicRule& rule() const { return m_rule; }
+    size_t size() const { return m_ops.size(); }
+
+private:
+    // Slot index of op is kFirstOp + its position, slots before that
+    // hold 0, all ones and the 9 cells of the neighborhood
+    static constexpr uint16_t kFirstOp = 2 + kNeighborhoodCells;
+    struct Op {
+        uint8_t cell;
+        uint16_t zero;
+        uint16_t one;
+    };
+
+    // Slot of the function table gives, on the cells below its size
+    uint16_t compile(const std::vector<bool>& table, std::map<std::vector<bool>, uint16_t>& seen);
+
+    IsotropicRule m_rule;
+    std::vector<Op> m_ops;
+    uint16_t m_result = 0;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "jsonpattern.h"
+#include <stdexcept>
+#include <string>
+#include "nlohmann/json.hpp"
+using json = nlohmann::json;
+
+// Keeps only the depth and the current point, cells go out in batches
+class JsonPatternHandler : public nlohmann::json_sax<json> {
+public:
+    explicit JsonPatternHandler(const std::function<void(const std::vector<XY>&)>& sink)
+        : m_sink(sink) {
+        m_cells.reserve(kJsonBatchCells);
+    }
+
+    bool null() override { return value(); }
+    bool boolean(bool) override { return value(); }
+    bool number_integer(number_integer_t number) override { return coordinate((Coord)number); }
+    // Positive numbers past the Coord range wrap like the universe does
+    bool number_unsigned(number_unsigned_t number) override { return coordinate((Coord)number); }
+    bool number_float(number_float_t number, const string_t&) override { return coordinate((Coord)number); }
+    bool string(string_t&) override { return value(); }
+    bool binary(binary_t&) override { return value(); }
+
+    bool start_object(std::size_t) override {
+        if (m_inData && m_depth >= 2) {
+            throw std::runtime_error("JSON point is not an array of two numbers");
+        }
+        m_depth++;
+        return true;
+    }
+    bool end_object() override {
+        m_depth--;
+        return true;
+    }
+    bool key(string_t& key) override {
+        if (m_depth == 1) {
+            m_inData = key == "data";
+        }
+        return true;
+    }
+
+    bool start_array(std::size_t) override {
+        if (inPoint()) {
+            throw std::runtime_error("JSON point is not an array of two numbers");
+        }
+        m_depth++;
+        if (inPoint()) {
+            m_coords = 0;
+        }
+        return true;
+    }
+    bool end_array() override {
+        if (inPoint()) {
+            if (m_coords != 2) {
+                throw std::runtime_error("JSON point is not an array of two numbers");
+            }
+            m_cells.emplace_back(m_x, m_y);
+            if (m_cells.size() >= kJsonBatchCells) {
+                flush();
+            }
+        }
+        m_depth--;
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& error) override {
+        throw std::runtime_error(std::string("Malformed JSON pattern: ") + error.what());
+    }
+
+    void flush() {
+        if (!m_cells.empty()) {
+            m_sink(m_cells);
+            m_total += m_cells.size();
+            m_cells.clear();
+        }
+    }
+
+    size_t total() const { return m_total; }
+
+private:
+    // Points are the arrays at depth 3: {"data": [[x, y]]}
+    bool inPoint() const { return m_inData && m_depth == 3; }
+
+    // Anything but a number inside "data" is malformed
+    bool value() {
+        if (m_inData && (m_depth == 2 || m_depth == 3)) {
+            throw std::runtime_error("JSON point is not an array of two numbers");
+        }
+        return true;
+    }
+
+    bool coordinate(Coord coord) {
+        if (!inPoint()) {
+            return value();
+        }
+        if (m_coords == 0) {
+            m_x = coord;
+        } else if (m_coords == 1) {
+            m_y = coord;
+        }
+        m_coords++;
+        return true;
+    }
+
+    const std::function<void(const std::vector<XY>&)>& m_sink;
+    std::vector<XY> m_cells;
+    size_t m_total = 0;
+    int m_depth = 0;
+    bool m_inData = false;
+    int m_coords = 0;
+    Coord m_x = 0;
+    Coord m_y = 0;
+};
+
+size_t ReadJsonPattern(std::istream& input, const std::function<void(const std::vector<XY>&)>& sink) {
+    JsonPatternHandler handler(sink);
+    json::sax_parse(input, &handler);
+    handler.flush();
+    return handler.total();
+}
+
+size_t LoadJsonPattern(std::istream& input, LifeEngine& engine) {
+    return ReadJsonPattern(input, [&engine](const std::vector<XY>& cells) {
+        engine.addCells(cells);
+    });
+}
@@ -0,0 +1,26 @@
+#ifndef JsonPattern_H
+
+#define JsonPattern_H
+#pragma once
+#include <functional>
+#include <istream>
+#include <vector>
+#include "cellmap.h"
+
+// Cells handed to the sink at a time
+constexpr size_t kJsonBatchCells = 1 << 16;
+
+// Streams the cells of a pattern in the JSON form
+//
+//   {"data": [[x, y], [x, y], ...]}
+//
+// through nlohmann's SAX parser, so no document is built and memory stays
+// at one batch of cells whatever the file size. Other keys are skipped.
+// Calls sink with each batch, throws on malformed input.
+size_t ReadJsonPattern(std::istream& input, const std::function<void(const std::vector<XY>&)>& sink);
+
+// Adds every cell of a JSON pattern to engine through addCells, returns
+// the number of cells
+size_t LoadJsonPattern(std::istream& input, LifeEngine& engine);
+
+#endif
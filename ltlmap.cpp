@@ -0,0 +1,223 @@
+#include "ltlmap.h"
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
+
+// Cells along a side of the square a tile's counts come from
+constexpr int kMaxLtlWindow = kTileSize + 2 * kMaxLtlRange;
+
+bool LtlRule::operator==(const LtlRule& other) const {
+    return range == other.range && middle == other.middle &&
+           survivalMin == other.survivalMin && survivalMax == other.survivalMax &&
+           birthMin == other.birthMin && birthMax == other.birthMax;
+}
+
+static void printCounts(std::ostream& output, char name, int min, int max) {
+    output << name;
+    if (min <= max) {
+        output << min << ".." << max;
+    }
+}
+
+std::string LtlRule::toString() const {
+    std::ostringstream output;
+    output << "R" << range << ",C0,M" << (middle ? 1 : 0) << ",";
+    printCounts(output, 'S', survivalMin, survivalMax);
+    output << ",";
+    printCounts(output, 'B', birthMin, birthMax);
+    output << ",NM";
+    return output.str();
+}
+
+static bool parseNumber(const std::string& text, int& value) {
+    if (text.empty() || text.size() > 3 || text.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    value = std::stoi(text);
+    return true;
+}
+
+// "34..58", or nothing for no counts at all
+static bool parseCounts(const std::string& text, int& min, int& max) {
+    if (text.empty()) {
+        min = 1;
+        max = 0;
+        return true;
+    }
+    size_t dots = text.find("..");
+    if (dots == std::string::npos) {
+        return false;
+    }
+    return parseNumber(text.substr(0, dots), min) && parseNumber(text.substr(dots + 2), max) && min <= max;
+}
+
+bool ParseLtlRule(const std::string& text, LtlRule& rule) {
+    LtlRule result;
+    result.survivalMin = result.birthMin = 1;
+    result.survivalMax = result.birthMax = 0;
+    bool ranged = false;
+    std::istringstream parts(text);
+    std::string part;
+    while (std::getline(parts, part, ',')) {
+        for (auto& c : part) {
+            c = (char)std::toupper((unsigned char)c);
+        }
+        if (part.empty()) {
+            return false;
+        }
+        std::string value = part.substr(1);
+        int number;
+        switch (part[0]) {
+        case 'R':
+            if (!parseNumber(value, result.range) || result.range < 1 || result.range > kMaxLtlRange) {
+                return false;
+            }
+            ranged = true;
+            break;
+        case 'C':
+            if (!parseNumber(value, number) || (number != 0 && number != 2)) {
+                return false;
+            }
+            break;
+        case 'M':
+            if (!parseNumber(value, number) || number > 1) {
+                return false;
+            }
+            result.middle = number == 1;
+            break;
+        case 'S':
+            if (!parseCounts(value, result.survivalMin, result.survivalMax)) {
+                return false;
+            }
+            break;
+        case 'B':
+            if (!parseCounts(value, result.birthMin, result.birthMax)) {
+                return false;
+            }
+            break;
+        case 'N':
+            if (value != "M") {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+    // Counts cannot go past the square, a birth from nothing would fill
+    // the universe
+    int cells = (2 * result.range + 1) * (2 * result.range + 1);
+    if (!ranged || result.survivalMax > cells || result.birthMax > cells ||
+        result.birthMin == 0) {
+        return false;
+    }
+    rule = result;
+    return true;
+}
+
+// Lowest and highest set bit of mask when the set bits are contiguous
+static bool countRange(uint16_t mask, int& min, int& max) {
+    if (!mask) {
+        min = 1;
+        max = 0;
+        return true;
+    }
+    min = ctz64(mask);
+    uint64_t run = mask >> min;
+    if (run & (run + 1)) {
+        return false;
+    }
+    max = min + popcount64(run) - 1;
+    return true;
+}
+
+void LtlEngine::setRule(const Rule& rule) {
+    LtlRule ltl;
+    if (rule.states > 2 || !countRange(rule.survival, ltl.survivalMin, ltl.survivalMax) ||
+        !countRange(rule.birth, ltl.birthMin, ltl.birthMax)) {
+        throw std::runtime_error("Rule " + rule.toString() + " has no Larger than Life form");
+    }
+    m_ltlRule = ltl;
+    m_rule = rule;
+}
+
+void LtlEngine::setLtlRule(const LtlRule& rule) {
+    m_ltlRule = rule;
+    m_isotropic = nullptr;
+    // Range 1 rules have a B/S form too
+    if (rule.range == 1) {
+        uint16_t birth = 0, survival = 0;
+        int self = rule.middle ? 1 : 0;
+        for (int n = 0; n <= 8; n++) {
+            birth |= (uint16_t)(n >= rule.birthMin && n <= rule.birthMax) << n;
+            survival |= (uint16_t)(n + self >= rule.survivalMin && n + self <= rule.survivalMax) << n;
+        }
+        m_rule = Rule(birth, survival);
+    }
+}
+
+void LtlEngine::setIsotropicRule(const IsotropicRule& rule) {
+    throw std::runtime_error("Isotropic rule " + rule.toString() + " needs the tile engine");
+}
+
+const Rule& LtlEngine::rule() const {
+    if (m_ltlRule.range != 1) {
+        throw std::runtime_error("Larger than Life rule " + m_ltlRule.toString() + " has no B/S form");
+    }
+    return m_rule;
+}
+
+void LtlEngine::nextTile(const XY& txy, Tile& output) const {
+    static const Tile emptyTile;
+    const Tile* n[3][3];
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            const Tile* tile = findTile(XY(TileAddition(txy.x, dx), TileAddition(txy.y, dy)));
+            n[dy + 1][dx + 1] = tile ? tile : &emptyTile;
+        }
+    }
+
+    // sums[j + 1][i + 1] counts the live cells of rows 0..j and columns
+    // 0..i of the window, the tile and range cells on every side. A full
+    // window has 84^2 cells, which fits in a uint16_t.
+    const int range = m_ltlRule.range;
+    const int window = kTileSize + 2 * range;
+    uint16_t sums[kMaxLtlWindow + 1][kMaxLtlWindow + 1];
+    for (int i = 0; i <= window; i++) {
+        sums[0][i] = 0;
+    }
+    for (int j = 0; j < window; j++) {
+        int y = j - range;
+        int band = y < 0 ? 0 : (y >= kTileSize ? 2 : 1);
+        int row = y & (kTileSize - 1);
+        uint64_t west = n[band][0]->rows[row];
+        uint64_t center = n[band][1]->rows[row];
+        uint64_t east = n[band][2]->rows[row];
+
+        uint16_t line = 0;
+        sums[j + 1][0] = 0;
+        for (int i = 0; i < window; i++) {
+            int x = i - range;
+            uint64_t word = x < 0 ? west : (x >= kTileSize ? east : center);
+            line += (word >> (x & (kTileSize - 1))) & 1;
+            sums[j + 1][i + 1] = sums[j][i + 1] + line;
+        }
+    }
+
+    const int side = 2 * range + 1;
+    const int self = m_ltlRule.middle ? 0 : 1;
+    for (int j = 0; j < kTileSize; j++) {
+        uint64_t cells = n[1][1]->rows[j];
+        uint64_t next = 0;
+        const uint16_t* above = sums[j];
+        const uint16_t* below = sums[j + side];
+        for (int i = 0; i < kTileSize; i++) {
+            int alive = (cells >> i) & 1;
+            int count = below[i + side] - below[i] - above[i + side] + above[i] - alive * self;
+            bool live = alive ? count >= m_ltlRule.survivalMin && count <= m_ltlRule.survivalMax
+                              : count >= m_ltlRule.birthMin && count <= m_ltlRule.birthMax;
+            next |= (uint64_t)live << i;
+        }
+        output.rows[j] = next;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef LtlMap_H
+
+#define LtlMap_H
+#pragma once
+#include <string>
+#include "tilemap.h"
+
+// Farthest neighborhood a Larger than Life rule may reach
+constexpr int kMaxLtlRange = 10;
+
+// Larger than Life rule in Golly's notation, e.g. Bosco's rule
+// "R5,C0,M1,S34..58,B34..45,NM". A cell counts the live cells of the
+// (2R+1)^2 square around it, itself included when middle is set. A dead
+// cell with birthMin..birthMax of them comes alive, a live one with
+// survivalMin..survivalMax stays alive. An empty range has min > max.
+class LtlRule {
+public:
+    int range = 1;
+    bool middle = false;
+    int survivalMin = 2;
+    int survivalMax = 3;
+    int birthMin = 3;
+    int birthMax = 3;
+
+    bool operator==(const LtlRule& other) const;
+    bool operator!=(const LtlRule& other) const { return !(*this == other); }
+
+    // e.g. "R1,C0,M0,S2..3,B3..3,NM" for B3/S23
+    std::string toString() const;
+};
+
+const LtlRule kBoscoRule = {5, true, 34, 58, 34, 45};
+
+// Takes the R, C, M, S, B and N parts in any order, R defaults to 1 and
+// the others to 0 or empty. Only 2 states (C0 or C2) and the Moore
+// neighborhood (NM) are supported, and birth cannot take 0 cells.
+bool ParseLtlRule(const std::string& text, LtlRule& rule);
+
+// Tile engine for range-R outer-totalistic rules. Each tile is counted
+// from a summed-area table over its cells and the R cells around it, so
+// a cell costs four lookups whatever the range.
+class LtlEngine : public TileEngine {
+public:
+    LtlEngine() : TileEngine(false) {}
+
+    // Takes range 1 rules whose birth and survival counts are ranges,
+    // throws for others
+    void setRule(const Rule& rule) override;
+    void setLtlRule(const LtlRule& rule);
+    const LtlRule& ltlRule() const { return m_ltlRule; }
+    // Larger than Life has no isotropic rules, throws
+    void setIsotropicRule(const IsotropicRule& rule) override;
+    // The B/S form of a range 1 rule, throws for longer ranges
+    const Rule& rule() const override;
+
+protected:
+    int range() const override { return m_ltlRule.range; }
+    void nextTile(const XY& txy, Tile& output) const override;
+
+private:
+    LtlRule m_ltlRule;
+};
+
+#endif
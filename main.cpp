@@ -2,20 +2,33 @@
 #include <iostream>
 #include <cstdlib>
 #include <fstream>
-#include <ctype.h>
+#include <string>
+#include <algorithm>
+#include <vector>
 #include "cellmap.h"
+#include "simulation.h"
+#include "presenter.h"
+#include "rle.h"
+#include "hashlife.h"
+#include "tilemap.h"
+#include "ltlmap.h"
+#include "gridmap.h"
 #if Windows
 #include <windows.h>
 #endif
 #if JSON
-#include "nlohmann/json.hpp"
-using json = nlohmann::json;
+#include "jsonpattern.h"
+#endif
+#if CIN
+#include "points.h"
 #endif
 
 constexpr int kCellSize = 5;
 constexpr int kWindowWidth = 1080;
 constexpr int kWindowHeight = 720;
-constexpr int kTickRate = 50; // millisecond
+constexpr int kFrameDelay = 16; // millisecond
+constexpr unsigned kDefaultRate = 20; // generations per second
+constexpr int kPrintAtGeneration = 10;
 
 SDL_Window *window = nullptr;
 SDL_Surface *surface = nullptr;
@@ -36,6 +49,19 @@ void debugDrawCell(unsigned int x, unsigned int y, RGBA color)
 	}
 }
 
+std::string argString(const char* arg) {
+    return std::string(arg);
+}
+
+std::string argString(const wchar_t* arg) {
+    // Options are plain ASCII
+    std::string result;
+    for (; *arg; arg++) {
+        result.push_back((char)*arg);
+    }
+    return result;
+}
+
 #if DEBUG
 void debugUpdate() {
     for (int i = 0; i < std::min(kWindowWidth, kWindowHeight); i++) {
@@ -49,43 +75,129 @@ int wmain(int argc, wchar_t* argv[])
 int main(int argc, char *argv[])
 #endif
 {
-#if JSON
-    if (argc < 2) {
-        std::cerr << "Usage: ./game <input file>\n";
-        return -1;
+    EngineKind engine = EngineKind::QuadTree;
+    PresenterKind present = PresenterKind::Surface;
+    unsigned threads = 1;
+    unsigned rate = kDefaultRate;
+    unsigned stepLog2 = 0;
+    bool adaptive = false;
+    std::string save;
+    Rule rule = kConwayRule;
+    bool ruled = false;
+    LtlRule ltlRule;
+    bool largerThanLife = false;
+    IsotropicRule isotropicRule;
+    bool isotropic = false;
+    Coord gridWidth = 0, gridHeight = 0;
+    bool grid = false;
+    bool torus = false;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argString(argv[i]);
+        if (arg.rfind("--engine=", 0) == 0) {
+            if (!ParseEngineKind(arg.substr(9), engine)) {
+                std::cerr << "Unknown engine: " << arg.substr(9) << "\n";
+                return -1;
+            }
+        } else if (arg.rfind("--present=", 0) == 0) {
+            if (!ParsePresenterKind(arg.substr(10), present)) {
+                std::cerr << "Unknown presenter: " << arg.substr(10) << "\n";
+                return -1;
+            }
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            threads = (unsigned)std::atoi(arg.substr(10).c_str());
+        } else if (arg.rfind("--rate=", 0) == 0) {
+            rate = (unsigned)std::atoi(arg.substr(7).c_str());
+        } else if (arg == "--step=auto") {
+            adaptive = true;
+        } else if (arg.rfind("--step=", 0) == 0) {
+            stepLog2 = (unsigned)std::atoi(arg.substr(7).c_str());
+        } else if (arg.rfind("--rule=R", 0) == 0 || arg.rfind("--rule=r", 0) == 0) {
+            if (!ParseLtlRule(arg.substr(7), ltlRule)) {
+                std::cerr << "Unsupported rule: " << arg.substr(7) << "\n";
+                return -1;
+            }
+            largerThanLife = true;
+        } else if (arg.rfind("--rule=", 0) == 0) {
+            if (ParseRule(arg.substr(7), rule)) {
+                ruled = true;
+            } else if (ParseIsotropicRule(arg.substr(7), isotropicRule)) {
+                isotropic = true;
+            } else {
+                std::cerr << "Unsupported rule: " << arg.substr(7) << "\n";
+                return -1;
+            }
+        } else if (arg.rfind("--torus=", 0) == 0 || arg.rfind("--bounded=", 0) == 0) {
+            torus = arg.rfind("--torus=", 0) == 0;
+            std::string size = arg.substr(arg.find('=') + 1);
+            if (!ParseGridSize(size, gridWidth, gridHeight)) {
+                std::cerr << "Unsupported universe size: " << size << "\n";
+                return -1;
+            }
+            grid = true;
+        } else if (arg.rfind("--save=", 0) == 0) {
+            save = arg.substr(7);
+        } else {
+            inputs.push_back(arg);
+        }
     }
 
-    // Read and parse json
-    std::ifstream f(argv[1]);
-    json json_data = json::parse(f);
-    json points = json_data["data"];
-#endif
-
-#if CIN
-    std::vector<XY> xys;
-    Coord x, y;
-    bool neg = false;
-    std::string s_int;
-    char c;
-    while (std::cin >> c) {
-        if (isdigit(c)) {
-            s_int = s_int.append(1, c);
-        }
-        else if (c == ',') {
-            x = neg ? -std::atol(s_int.c_str()) : std::atol(s_int.c_str());
-            s_int = "";
-            neg = false;
-        }
-        else if (c == ')') {
-            y = neg ? -std::atol(s_int.c_str()) : std::atol(s_int.c_str()) ;
-            s_int = "";
-            neg = false;
-            xys.emplace_back(x, y);
+    // .rle files load the same way in every build
+    bool rle = !inputs.empty() && inputs[0].size() > 4 &&
+               inputs[0].compare(inputs[0].size() - 4, 4, ".rle") == 0;
+    // So do .mc files, which only the hashlife engine reads
+    bool macrocell = !inputs.empty() && inputs[0].size() > 3 &&
+                     inputs[0].compare(inputs[0].size() - 3, 3, ".mc") == 0;
+    if (macrocell && engine != EngineKind::HashLife) {
+        std::cerr << "Macrocell input, using the hashlife engine\n";
+        engine = EngineKind::HashLife;
+    }
+    bool file = rle || macrocell;
+    // Without a rule of its own, the rule an .rle header names picks the
+    // engine like --rule would
+    bool given = ruled || largerThanLife || isotropic;
+    if (rle && !given) {
+        std::ifstream f(inputs[0], std::ios::binary);
+        std::string header;
+        try {
+            header = ReadRleRule(f);
+        } catch (const std::exception& e) {
+            std::cerr << "Cannot read " << inputs[0] << ": " << e.what() << "\n";
+            return -1;
         }
-        else if (c == '-') {
-            neg = true;
+        if (!header.empty() && !ParseRule(header, rule)) {
+            if ((header[0] == 'R' || header[0] == 'r') && ParseLtlRule(header, ltlRule)) {
+                largerThanLife = true;
+            } else if (ParseIsotropicRule(header, isotropicRule)) {
+                isotropic = true;
+            } else {
+                std::cerr << "Unsupported rule in " << inputs[0] << ": " << header << "\n";
+                return -1;
+            }
         }
-        // Ignore other cases
+    }
+    // Bounded universes run on the grid engine, which takes B/S rules only
+    if (grid && (macrocell || largerThanLife || isotropic || rule.states > 2)) {
+        std::cerr << "Bounded universes take B/S rules and no macrocell input\n";
+        return -1;
+    }
+    if (rule.states > 2 && engine != EngineKind::QuadTree) {
+        std::cerr << "Generations rule, using the quadtree engine\n";
+        engine = EngineKind::QuadTree;
+    }
+    if (isotropic && engine != EngineKind::Tile) {
+        std::cerr << "Isotropic rule, using the tile engine\n";
+        engine = EngineKind::Tile;
+    }
+    if (largerThanLife && engine != EngineKind::LargerThanLife) {
+        std::cerr << "Larger than Life rule, using the ltl engine\n";
+        engine = EngineKind::LargerThanLife;
+    }
+
+#if JSON
+    if (inputs.empty()) {
+        std::cerr << "Usage: ./game [--engine=quadtree|hashlife|tile|morton|ltl] [--present=surface|texture|software] [--threads=N] [--rate=N] [--step=K|auto] [--rule=B3/S23|R5,C0,M1,S34..58,B34..45,NM] [--torus=WxH|--bounded=WxH] [--save=FILE] <input file>\n";
+        return -1;
     }
 #endif
 
@@ -96,7 +208,8 @@ int main(int argc, char *argv[])
         std::cerr << "Cannot create SDL window!\n";
         std::abort();
     }
-    surface = SDL_GetWindowSurface(window);
+    PresenterUniq presenter = CreatePresenter(window, present);
+    surface = presenter->surface();
     if (!surface) {
         std::cerr << "Cannot get SDL surface!\n";
     }
@@ -104,27 +217,102 @@ int main(int argc, char *argv[])
     SDL_Event ev;
     bool started = false;
     bool quit = false;
-    CellMap map(surface, kWindowWidth, kWindowHeight, kCellSize, 10);
+    CellMap map(surface, kWindowWidth, kWindowHeight, kCellSize, kPrintAtGeneration, engine);
+    if (grid) {
+        map.setEngine(std::make_unique<GridEngine>(gridWidth, gridHeight, torus));
+    }
+    map.engine().setThreadCount(threads);
+    map.setScaledOutput(presenter->scales());
 
-    // Put points in
+    // Put points in, a malformed file ends the program with a message
+    try {
 #if JSON
-    for (json::iterator it = points.begin(); it != points.end(); ++it) {
-        XY xy((*it)[0], (*it)[1]);
-        map.addCell(xy);
-    }
+        if (!file) {
+            // Streamed in batches, the document is never held whole
+            std::ifstream f(inputs[0], std::ios::binary);
+            if (!f) {
+                std::cerr << "Cannot open " << inputs[0] << "\n";
+                return -1;
+            }
+            LoadJsonPattern(f, map.engine());
+        }
 #endif
 
 #if CIN
-    for (auto& xy : xys) {
-        map.addCell(xy);
-    }
+        if (!file) {
+            LoadPoints(std::cin, map.engine());
+        }
 #endif
 
+        if (rle) {
+            std::ifstream f(inputs[0], std::ios::binary);
+            if (!f) {
+                std::cerr << "Cannot open " << inputs[0] << "\n";
+                return -1;
+            }
+            LoadRle(f, map.engine(), !given);
+        }
+        if (macrocell) {
+            std::ifstream f(inputs[0], std::ios::binary);
+            if (!f) {
+                std::cerr << "Cannot open " << inputs[0] << "\n";
+                return -1;
+            }
+            static_cast<HashLifeEngine&>(map.engine()).readMacrocell(f);
+        }
+        // Overrides the rule a pattern file names
+        if (largerThanLife) {
+            static_cast<LtlEngine&>(map.engine()).setLtlRule(ltlRule);
+        } else if (isotropic) {
+            static_cast<TileEngine&>(map.engine()).setIsotropicRule(isotropicRule);
+        } else if (ruled) {
+            map.engine().setRule(rule);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Cannot load " << (inputs.empty() ? "points" : inputs[0]) << ": " << e.what() << "\n";
+        return -1;
+    }
+    // Range-R and isotropic rules have no B/S form
+    LtlEngine* ltlEngine = dynamic_cast<LtlEngine*>(&map.engine());
+    TileEngine* tileEngine = dynamic_cast<TileEngine*>(&map.engine());
+    std::string ruleName = ltlEngine ? ltlEngine->ltlRule().toString()
+                           : tileEngine && tileEngine->isotropicRule() ? tileEngine->isotropicRule()->toString()
+                           : map.engine().rule().toString();
+
+    // Generations run on their own thread from here on, this loop only
+    // draws the newest snapshot
+    Simulation simulation(map.engine(), map.view(), kPrintAtGeneration);
+    simulation.setRate(rate);
+    simulation.setStep(stepLog2);
+    // An adaptive step fills the time between two steps, or one frame
+    // when the rate is uncapped
+    unsigned stepBudget = rate > 0 ? std::max(1000 / rate, 1u) : kFrameDelay;
+    if (adaptive) {
+        simulation.setAdaptiveStep(stepBudget);
+    }
+    simulation.start();
+    std::string title;
+    uint64_t drawnSequence = 0;
+
     while (!quit) {
         while (SDL_PollEvent(&ev) != 0) {
             if (ev.type == SDL_QUIT)
                 quit = true;
 
+            if (ev.type == SDL_WINDOWEVENT && ev.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                // The window system lost the contents
+                presenter->refresh(map);
+            }
+
+            if (ev.type == SDL_MOUSEWHEEL && ev.wheel.y != 0) {
+                if (ev.wheel.y > 0) {
+                    map.zoomIn();
+                } else {
+                    map.zoomOut();
+                }
+                simulation.setView(map.view(), map.cellShift());
+            }
+
             if (ev.type == SDL_KEYDOWN) {
                 // Handling keyboard event
                 switch(ev.key.keysym.sym) {
@@ -157,21 +345,77 @@ int main(int argc, char *argv[])
                     std::cout << "Space! \n";
 #endif
                     started ^= true;
+                    simulation.setRunning(started);
+                    break;
+                case SDLK_EQUALS:
+                case SDLK_PLUS:
+                case SDLK_KP_PLUS:
+                    simulation.setStep(simulation.step() + 1);
+                    break;
+                case SDLK_MINUS:
+                case SDLK_KP_MINUS:
+                    simulation.setStep(simulation.step() > 0 ? simulation.step() - 1 : 0);
+                    break;
+                case SDLK_a:
+                    simulation.setAdaptiveStep(simulation.adaptiveStep() ? 0 : stepBudget);
+                    break;
+                case SDLK_PAGEUP:
+                case SDLK_RIGHTBRACKET:
+                    map.zoomIn();
+                    break;
+                case SDLK_PAGEDOWN:
+                case SDLK_LEFTBRACKET:
+                    map.zoomOut();
+                    break;
                 }
+                simulation.setView(map.view(), map.cellShift());
             }
         }
 
         // // DEBUG
         // debugUpdate();
-        if (started) {
-            map.update();
+        // Push only what changed since the last snapshot
+        const Snapshot& snapshot = simulation.snapshot();
+        // A snapshot taken before a zoom waits for the next one
+        if (snapshot.sequence != drawnSequence && snapshot.shift == map.cellShift()) {
+            if (snapshot.shift > 0) {
+                map.drawDensity(snapshot.density);
+            } else {
+                map.draw(snapshot.cells, snapshot.decaying, snapshot.stages);
+            }
+            drawnSequence = snapshot.sequence;
+            presenter->present(map);
         }
 
-        SDL_UpdateWindowSurface(window);
+        std::string status = "Conway's Game of Life - " + ruleName +
+                             ", generation " + std::to_string(snapshot.generation) +
+                             ", step 2^" + std::to_string(simulation.step()) +
+                             (simulation.adaptiveStep() ? " (auto)" : "") +
+                             (map.cellShift() > 0 ? ", zoom 2^" + std::to_string(map.cellShift()) + ":1"
+                                                  : ", zoom 1:" + std::to_string(map.pixelsPerCell()));
+        if (status != title) {
+            title = status;
+            SDL_SetWindowTitle(window, title.c_str());
+        }
 
-        SDL_Delay(kTickRate);
+        SDL_Delay(kFrameDelay);
+    }
+    simulation.stop();
+
+    if (!save.empty()) {
+        // Macrocell from the hashlife engine, Life 1.06 from the others
+        std::ofstream f(save, std::ios::binary);
+        HashLifeEngine* hashlife = dynamic_cast<HashLifeEngine*>(&map.engine());
+        if (!f) {
+            std::cerr << "Cannot write " << save << "\n";
+        } else if (hashlife) {
+            hashlife->writeMacrocell(f);
+        } else {
+            map.engine().print(f);
+        }
     }
 
+    presenter.reset();
     SDL_DestroyWindow(window);
     SDL_Quit();
 
@@ -0,0 +1,91 @@
+#ifndef Morton_H
+
+#define Morton_H
+#pragma once
+#include "cellmap.h"
+#include <cstdint>
+
+// Z-order key of an XY over the full int64 plane. Bit 2i of the 128-bit
+// key is bit i of x, bit 2i + 1 is bit i of y, after flipping the sign
+// bits so that MIN sorts first.
+class MortonKey {
+public:
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+
+    bool operator<(const MortonKey& other) const {
+        return hi < other.hi || (hi == other.hi && lo < other.lo);
+    }
+    bool operator==(const MortonKey& other) const {
+        return hi == other.hi && lo == other.lo;
+    }
+    bool operator!=(const MortonKey& other) const {
+        return !(*this == other);
+    }
+};
+
+// Spreads the 32 bits of v over the even bits of the result
+inline uint64_t MortonSpread(uint64_t v) {
+    v &= 0xffffffffULL;
+    v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+    v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+    v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v | (v << 2)) & 0x3333333333333333ULL;
+    v = (v | (v << 1)) & 0x5555555555555555ULL;
+    return v;
+}
+
+// Inverse of MortonSpread
+inline uint64_t MortonCompact(uint64_t v) {
+    v &= 0x5555555555555555ULL;
+    v = (v | (v >> 1)) & 0x3333333333333333ULL;
+    v = (v | (v >> 2)) & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v | (v >> 4)) & 0x00ff00ff00ff00ffULL;
+    v = (v | (v >> 8)) & 0x0000ffff0000ffffULL;
+    v = (v | (v >> 16)) & 0x00000000ffffffffULL;
+    return v;
+}
+
+inline MortonKey MortonEncode(const XY& xy) {
+    uint64_t x = (uint64_t)xy.x ^ (1ULL << 63);
+    uint64_t y = (uint64_t)xy.y ^ (1ULL << 63);
+    MortonKey key;
+    key.hi = MortonSpread(x >> 32) | (MortonSpread(y >> 32) << 1);
+    key.lo = MortonSpread(x) | (MortonSpread(y) << 1);
+    return key;
+}
+
+// Even key bits belong to x, odd ones to y
+constexpr uint64_t kMortonXMask = 0x5555555555555555ULL;
+constexpr uint64_t kMortonYMask = 0xaaaaaaaaaaaaaaaaULL;
+
+// Adds +1 or -1 to one coordinate of a key without decoding it. The
+// other coordinate's bits are filled in so carries ripple across them,
+// and the result wraps around like big_int_addition.
+inline MortonKey MortonStep(const MortonKey& key, uint64_t mask, bool increment) {
+    uint64_t unit = mask & (0 - mask);
+    MortonKey result;
+    if (increment) {
+        uint64_t lo = (key.lo | ~mask) + unit;
+        uint64_t carry = lo < (key.lo | ~mask);
+        uint64_t hi = (key.hi | ~mask) + carry;
+        result.lo = (lo & mask) | (key.lo & ~mask);
+        result.hi = (hi & mask) | (key.hi & ~mask);
+    } else {
+        uint64_t part = key.lo & mask;
+        uint64_t lo = part - unit;
+        uint64_t borrow = part < unit;
+        uint64_t hi = (key.hi & mask) - borrow;
+        result.lo = (lo & mask) | (key.lo & ~mask);
+        result.hi = (hi & mask) | (key.hi & ~mask);
+    }
+    return result;
+}
+
+inline XY MortonDecode(const MortonKey& key) {
+    uint64_t x = (MortonCompact(key.hi) << 32) | MortonCompact(key.lo);
+    uint64_t y = (MortonCompact(key.hi >> 1) << 32) | MortonCompact(key.lo >> 1);
+    return XY((Coord)(x ^ (1ULL << 63)), (Coord)(y ^ (1ULL << 63)));
+}
+
+#endif
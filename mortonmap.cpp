@@ -0,0 +1,186 @@
+#include "mortonmap.h"
+#include <algorithm>
+#include <iostream>
+
+constexpr uint8_t kSelfWeight = 0x10;
+constexpr uint8_t kNeighborWeightMask = 0x0f;
+
+inline bool keyBit(const MortonKey& key, int bit) {
+    return bit >= 64 ? (key.hi >> (bit - 64)) & 1 : (key.lo >> bit) & 1;
+}
+
+// Bit `bit` of the key
+inline MortonKey bitKey(int bit) {
+    MortonKey result;
+    if (bit >= 64) {
+        result.hi = 1ULL << (bit - 64);
+    } else {
+        result.lo = 1ULL << bit;
+    }
+    return result;
+}
+
+// Bits below `bit` that belong to the same coordinate
+inline MortonKey lowerBits(int bit) {
+    uint64_t dim = (bit & 1) ? kMortonYMask : kMortonXMask;
+    MortonKey result;
+    if (bit >= 64) {
+        result.lo = dim;
+        result.hi = ((1ULL << (bit - 64)) - 1) & dim;
+    } else {
+        result.lo = ((1ULL << bit) - 1) & dim;
+    }
+    return result;
+}
+
+// Sets the bit and clears the lower bits of its coordinate, "1000..."
+inline MortonKey loadOnes(const MortonKey& key, int bit) {
+    MortonKey low = lowerBits(bit);
+    MortonKey one = bitKey(bit);
+    MortonKey result;
+    result.hi = (key.hi & ~low.hi) | one.hi;
+    result.lo = (key.lo & ~low.lo) | one.lo;
+    return result;
+}
+
+// Clears the bit and sets the lower bits of its coordinate, "0111..."
+inline MortonKey loadZeros(const MortonKey& key, int bit) {
+    MortonKey low = lowerBits(bit);
+    MortonKey one = bitKey(bit);
+    MortonKey result;
+    result.hi = (key.hi & ~one.hi) | low.hi;
+    result.lo = (key.lo & ~one.lo) | low.lo;
+    return result;
+}
+
+MortonKey MortonBigMin(const MortonKey& zval, MortonKey zmin, MortonKey zmax) {
+    MortonKey bigmin;
+    for (int bit = 127; bit >= 0; bit--) {
+        bool v = keyBit(zval, bit);
+        bool lo = keyBit(zmin, bit);
+        bool hi = keyBit(zmax, bit);
+        if (!v && !lo && hi) {
+            bigmin = loadOnes(zmin, bit);
+            zmax = loadZeros(zmax, bit);
+        } else if (!v && lo && hi) {
+            return zmin;
+        } else if (v && !lo && !hi) {
+            return bigmin;
+        } else if (v && !lo && hi) {
+            zmin = loadOnes(zmin, bit);
+        }
+        // Equal bits narrow nothing, lo > hi cannot happen for a valid box
+    }
+    return bigmin;
+}
+
+void MortonEngine::normalize() {
+    if (!m_sorted) {
+        std::sort(m_keys.begin(), m_keys.end());
+        m_keys.erase(std::unique(m_keys.begin(), m_keys.end()), m_keys.end());
+        m_sorted = true;
+    }
+}
+
+const std::vector<MortonKey>& MortonEngine::keys() {
+    normalize();
+    return m_keys;
+}
+
+void MortonEngine::addCell(const XY& xy) {
+    MortonKey key = MortonEncode(xy);
+    if (!m_keys.empty() && !(m_keys.back() < key)) {
+        m_sorted = false;
+    }
+    m_keys.push_back(key);
+}
+
+bool MortonEngine::getCell(const XY& xy) {
+    normalize();
+    return std::binary_search(m_keys.begin(), m_keys.end(), MortonEncode(xy));
+}
+
+void MortonEngine::update() {
+    normalize();
+
+    // 1. Every cell marks itself and adds one to its eight neighbors,
+    // stepping the keys directly instead of decoding them
+    m_contributions.clear();
+    m_contributions.reserve(m_keys.size() * 9);
+    for (auto& key : m_keys) {
+        MortonKey west = MortonStep(key, kMortonXMask, false);
+        MortonKey east = MortonStep(key, kMortonXMask, true);
+        MortonKey column[3] = {west, key, east};
+        for (int i = 0; i < 3; i++) {
+            m_contributions.push_back({MortonStep(column[i], kMortonYMask, false), 1});
+            m_contributions.push_back({MortonStep(column[i], kMortonYMask, true), 1});
+        }
+        m_contributions.push_back({west, 1});
+        m_contributions.push_back({east, 1});
+        m_contributions.push_back({key, kSelfWeight});
+    }
+
+    // 2. Bring equal keys together
+    std::sort(m_contributions.begin(), m_contributions.end(),
+              [](const Contribution& a, const Contribution& b) {
+                  return a.key < b.key;
+              });
+
+    // 3. Sum each run and apply the rule, the output stays sorted
+    DispatchRule(m_rule, [this](const auto& kernel) {
+        applyRule(kernel);
+    });
+
+    m_keys.swap(m_next);
+}
+
+template<class Kernel>
+void MortonEngine::applyRule(const Kernel& kernel) {
+    m_next.clear();
+    for (size_t i = 0; i < m_contributions.size();) {
+        const MortonKey& key = m_contributions[i].key;
+        unsigned weight = 0;
+        for (; i < m_contributions.size() && m_contributions[i].key == key; i++) {
+            weight += m_contributions[i].weight;
+        }
+
+        CellState state = (weight & kSelfWeight) ? 1 : 0;
+        UpdateCellNeighborCount(state, weight & kNeighborWeightMask);
+        UpdateCellAliveness(state, kernel);
+        if (GetCellAliveness(state)) {
+            m_next.push_back(key);
+        }
+    }
+}
+
+void MortonEngine::query(const AABB& range, std::vector<XY>& output) {
+    normalize();
+    MortonKey zmin = MortonEncode(XY(range.left, range.top));
+    MortonKey zmax = MortonEncode(XY(range.right, range.bottom));
+
+    auto it = std::lower_bound(m_keys.begin(), m_keys.end(), zmin);
+    while (it != m_keys.end() && !(zmax < *it)) {
+        XY xy = MortonDecode(*it);
+        if (range.contains(xy)) {
+            output.push_back(xy);
+            it++;
+        } else {
+            // Jump to the next key that can be inside the box
+            it = std::lower_bound(it, m_keys.end(), MortonBigMin(*it, zmin, zmax));
+        }
+    }
+}
+
+void MortonEngine::print(std::ostream& output) {
+    normalize();
+    output << "#Life 1.06\n";
+    for (auto& key : m_keys) {
+        XY xy = MortonDecode(key);
+        output << xy.x << " " << xy.y << std::endl;
+    }
+}
+
+size_t MortonEngine::cellCount() {
+    normalize();
+    return m_keys.size();
+}
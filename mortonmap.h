@@ -0,0 +1,50 @@
+#ifndef MortonMap_H
+
+#define MortonMap_H
+#pragma once
+#include "cellmap.h"
+#include "morton.h"
+#include <vector>
+
+// Live cells kept as one sorted array of Morton keys. Range queries are a
+// binary search plus a scan that jumps over runs outside the box, and a
+// generation sorts the neighbor contributions of the whole array, so both
+// walk memory front to back.
+class MortonEngine : public LifeEngine {
+public:
+    void addCell(const XY& xy) override;
+    void update() override;
+    void query(const AABB& range, std::vector<XY>& output) override;
+    void print(std::ostream& output) override;
+    size_t cellCount() override;
+
+    bool getCell(const XY& xy);
+    const std::vector<MortonKey>& keys();
+
+private:
+    // A key and what it contributes, kSelfWeight for the cell itself or
+    // 1 for each live neighbor
+    class Contribution {
+    public:
+        MortonKey key;
+        uint8_t weight;
+    };
+
+    void normalize();
+    // Sums the sorted contributions into m_next
+    template<class Kernel>
+    void applyRule(const Kernel& kernel);
+
+    std::vector<MortonKey> m_keys;
+    bool m_sorted = true;
+
+    // Reused across generations
+    std::vector<Contribution> m_contributions;
+    std::vector<MortonKey> m_next;
+};
+
+// Smallest key greater than zval whose cell lies in the box spanned by
+// the keys zmin and zmax (Tropf and Herzog's BIGMIN)
+MortonKey MortonBigMin(const MortonKey& zval, MortonKey zmin, MortonKey zmax);
+
+#endif
@@ -0,0 +1,122 @@
+#include "points.h"
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static const char* skipSpace(const char* pos, const char* end) {
+    while (pos != end && isSpace(*pos)) {
+        pos++;
+    }
+    return pos;
+}
+
+PointReader::PointReader(std::istream& input)
+    : m_input(input), m_chunk(kPointChunkSize) {}
+
+// Keeps the unparsed bytes from m_pos on and appends what fits after them,
+// growing the chunk when a single point fills it
+bool PointReader::fill() {
+    size_t kept = m_end - m_pos;
+    memmove(m_chunk.data(), m_chunk.data() + m_pos, kept);
+    m_pos = 0;
+    m_end = kept;
+    if (m_end == m_chunk.size()) {
+        m_chunk.resize(m_chunk.size() * 2);
+    }
+    m_input.read(m_chunk.data() + m_end, m_chunk.size() - m_end);
+    size_t count = (size_t)m_input.gcount();
+    m_end += count;
+    if (count == 0) {
+        m_eof = true;
+    }
+    return count > 0;
+}
+
+PointReader::Parse PointReader::parseCoord(const char*& pos, const char* end, Coord& coord) const {
+    pos = skipSpace(pos, end);
+    bool negative = false;
+    if (pos != end && (*pos == '-' || *pos == '+')) {
+        negative = *pos == '-';
+        pos = skipSpace(pos + 1, end);
+    }
+    uint64_t magnitude;
+    auto result = std::from_chars(pos, end, magnitude);
+    if (result.ptr == end) {
+        // The number may go on in the next chunk
+        return kIncomplete;
+    }
+    if (result.ec == std::errc::invalid_argument) {
+        throw std::runtime_error("Malformed point, expected a number");
+    }
+    if (result.ec == std::errc::result_out_of_range ||
+        magnitude > (negative ? (uint64_t)1 << 63 : ((uint64_t)1 << 63) - 1)) {
+        throw std::runtime_error("Point coordinate out of range: " + std::string(pos, result.ptr));
+    }
+    coord = negative ? (Coord)(0 - magnitude) : (Coord)magnitude;
+    pos = result.ptr;
+    return kParsed;
+}
+
+// pos is just past the '('
+PointReader::Parse PointReader::parsePoint(const char*& pos, const char* end, XY& xy) const {
+    for (int i = 0; i < 2; i++) {
+        if (parseCoord(pos, end, i == 0 ? xy.x : xy.y) == kIncomplete) {
+            return kIncomplete;
+        }
+        pos = skipSpace(pos, end);
+        if (pos == end) {
+            return kIncomplete;
+        }
+        if (*pos != (i == 0 ? ',' : ')')) {
+            throw std::runtime_error(std::string("Malformed point, unexpected '") + *pos + "'");
+        }
+        pos++;
+    }
+    return kParsed;
+}
+
+bool PointReader::read(std::vector<XY>& cells) {
+    size_t start = cells.size();
+    while (cells.size() - start < kPointBatchCells) {
+        const char* begin = m_chunk.data() + m_pos;
+        const char* end = m_chunk.data() + m_end;
+        const char* open = (const char*)memchr(begin, '(', end - begin);
+        if (!open) {
+            m_pos = m_end;
+            if (m_eof || !fill()) {
+                break;
+            }
+            continue;
+        }
+
+        const char* pos = open + 1;
+        XY xy;
+        if (parsePoint(pos, end, xy) == kIncomplete) {
+            m_pos = open - m_chunk.data();
+            if (m_eof || !fill()) {
+                throw std::runtime_error("Unterminated point at the end of the input");
+            }
+            continue;
+        }
+        cells.push_back(xy);
+        m_pos = pos - m_chunk.data();
+    }
+    return cells.size() > start;
+}
+
+size_t LoadPoints(std::istream& input, LifeEngine& engine) {
+    PointReader reader(input);
+    std::vector<XY> cells;
+    size_t total = 0;
+    while (reader.read(cells)) {
+        engine.addCells(cells);
+        total += cells.size();
+        cells.clear();
+    }
+    return total;
+}
@@ -0,0 +1,48 @@
+#ifndef Points_H
+
+#define Points_H
+#pragma once
+#include <istream>
+#include <vector>
+#include "cellmap.h"
+
+// Bytes read from the stream at a time
+constexpr size_t kPointChunkSize = 1 << 16;
+// Cells handed out per read() call
+constexpr size_t kPointBatchCells = 1 << 16;
+
+// Reads the "(x, y)" point list the CIN build takes on stdin, e.g.
+//
+//   (0, 0)
+//   (-1, 2) (3,-4)
+//
+// in chunks, parsing numbers in place with std::from_chars. Whitespace may
+// appear anywhere inside a point and numbers may carry a sign, text
+// outside the parentheses is ignored.
+class PointReader {
+public:
+    explicit PointReader(std::istream& input);
+
+    // Appends the next batch of points, false once the input ended. Throws
+    // on a malformed or unterminated point.
+    bool read(std::vector<XY>& cells);
+
+private:
+    enum Parse { kParsed, kIncomplete };
+
+    bool fill();
+    Parse parsePoint(const char*& pos, const char* end, XY& xy) const;
+    Parse parseCoord(const char*& pos, const char* end, Coord& coord) const;
+
+    std::istream& m_input;
+    std::vector<char> m_chunk;
+    size_t m_pos = 0;
+    size_t m_end = 0;
+    bool m_eof = false;
+};
+
+// Adds every point of the stream to engine through addCells, returns the
+// number of points
+size_t LoadPoints(std::istream& input, LifeEngine& engine);
+
+#endif
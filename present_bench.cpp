@@ -0,0 +1,143 @@
+#define SDL_MAIN_HANDLED
+#include <SDL2/SDL.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "cellmap.h"
+#include "presenter.h"
+#include "nlohmann/json.hpp"
+using json = nlohmann::json;
+
+// Times drawing and presenting frames of a random soup through each
+// presenter, on SDL's dummy video driver unless SDL_VIDEODRIVER picks
+// another one (e.g. offscreen), so it runs without a display.
+//
+//   ./present_bench [--present=surface|texture|software]... [--window=WxH]
+//                   [--cell=N] [--frames=N] [--soup=SIDE]
+//
+// Defaults to all three presenters on a 3840x2160 window.
+
+constexpr int kDefaultCellSize = 5;
+
+// Half of the cells of a side x side square centered on the origin
+std::vector<XY> randomSoup(Coord side) {
+    std::mt19937_64 rng(side);
+    std::vector<XY> cells;
+    for (Coord y = 0; y < side; y++) {
+        for (Coord x = 0; x < side; x++) {
+            if (rng() & 1) {
+                cells.emplace_back(x - side / 2, y - side / 2);
+            }
+        }
+    }
+    return cells;
+}
+
+json runPresenter(const std::string& name, PresenterKind kind, int width, int height, int cellSize,
+                  int frames, const std::vector<XY>& cells) {
+    SDL_Window* window = SDL_CreateWindow("present_bench", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                          width, height, SDL_WINDOW_HIDDEN);
+    if (!window) {
+        throw std::runtime_error(std::string("Cannot create SDL window: ") + SDL_GetError());
+    }
+    json result;
+    {
+        PresenterUniq presenter = CreatePresenter(window, kind);
+        if (!presenter->surface()) {
+            SDL_DestroyWindow(window);
+            throw std::runtime_error(std::string("Cannot get SDL surface: ") + SDL_GetError());
+        }
+        CellMap map(presenter->surface(), width, height, cellSize, -1);
+        map.setScaledOutput(presenter->scales());
+        for (auto& xy : cells) {
+            map.addCell(xy);
+        }
+
+        double frameSeconds = 0;
+        double presentSeconds = 0;
+        for (int i = 0; i < frames; i++) {
+            auto start = std::chrono::steady_clock::now();
+            map.update();
+            auto drawn = std::chrono::steady_clock::now();
+            presenter->present(map);
+            auto presented = std::chrono::steady_clock::now();
+            frameSeconds += std::chrono::duration<double>(presented - start).count();
+            presentSeconds += std::chrono::duration<double>(presented - drawn).count();
+        }
+
+        const FrameTimes& times = map.frameTimes();
+        result["presenter"] = name;
+        // Falls back to the window surface when no renderer is available
+        result["scaled"] = presenter->scales();
+        result["frame_ms"] = frameSeconds * 1000 / frames;
+        result["present_ms"] = presentSeconds * 1000 / frames;
+        result["draw_ms"] = times.draw * 1000 / frames;
+        result["update_ms"] = times.update * 1000 / frames;
+    }
+    SDL_DestroyWindow(window);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::pair<std::string, PresenterKind>> presenters;
+    int width = 3840;
+    int height = 2160;
+    int cellSize = kDefaultCellSize;
+    int frames = 300;
+    Coord soup = 512;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        PresenterKind kind;
+        if (arg.rfind("--present=", 0) == 0 && ParsePresenterKind(arg.substr(10), kind)) {
+            presenters.emplace_back(arg.substr(10), kind);
+        } else if (arg.rfind("--window=", 0) == 0 && arg.find('x') != std::string::npos) {
+            width = std::atoi(arg.substr(9).c_str());
+            height = std::atoi(arg.substr(arg.find('x') + 1).c_str());
+        } else if (arg.rfind("--cell=", 0) == 0) {
+            cellSize = std::atoi(arg.substr(7).c_str());
+        } else if (arg.rfind("--frames=", 0) == 0) {
+            frames = std::atoi(arg.substr(9).c_str());
+        } else if (arg.rfind("--soup=", 0) == 0) {
+            soup = std::atoll(arg.substr(7).c_str());
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return -1;
+        }
+    }
+    if (presenters.empty()) {
+        presenters = {
+            {"surface", PresenterKind::Surface},
+            {"texture", PresenterKind::Texture},
+            {"software", PresenterKind::Software}
+        };
+    }
+
+    SDL_SetMainReady();
+    if (!SDL_getenv("SDL_VIDEODRIVER")) {
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+    }
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        std::cerr << "Cannot initialize SDL: " << SDL_GetError() << "\n";
+        return -1;
+    }
+
+    json report;
+    report["video_driver"] = SDL_GetCurrentVideoDriver();
+    report["window"] = {width, height};
+    report["cell_size"] = cellSize;
+    report["frames"] = frames;
+    report["soup"] = soup;
+    report["runs"] = json::array();
+    std::vector<XY> cells = randomSoup(soup);
+    for (auto& presenter : presenters) {
+        report["runs"].push_back(runPresenter(presenter.first, presenter.second, width, height, cellSize,
+                                              frames, cells));
+    }
+    SDL_Quit();
+
+    std::cout << report.dump(2) << std::endl;
+    return 0;
+}
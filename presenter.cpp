@@ -0,0 +1,145 @@
+#include "presenter.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+bool ParsePresenterKind(const std::string& name, PresenterKind& kind) {
+    if (name == "surface") {
+        kind = PresenterKind::Surface;
+    } else if (name == "texture") {
+        kind = PresenterKind::Texture;
+    } else if (name == "software") {
+        kind = PresenterKind::Software;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+SurfacePresenter::SurfacePresenter(SDL_Window* window)
+    : m_window(window), m_surface(SDL_GetWindowSurface(window)) {}
+
+void SurfacePresenter::present(const CellMap& map) {
+    const std::vector<SDL_Rect>& rects = map.dirtyRects();
+    if (!rects.empty()) {
+        SDL_UpdateWindowSurfaceRects(m_window, rects.data(), (int)rects.size());
+    }
+}
+
+void SurfacePresenter::refresh(const CellMap&) {
+    SDL_UpdateWindowSurface(m_window);
+}
+
+TexturePresenter::TexturePresenter(SDL_Window* window, bool software) {
+    int width, height;
+    SDL_GetWindowSize(window, &width, &height);
+
+    // Zoomed in cells stay sharp
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    m_renderer = SDL_CreateRenderer(window, -1, software ? SDL_RENDERER_SOFTWARE : 0);
+    if (!m_renderer) {
+        throw std::runtime_error(std::string("Cannot create SDL renderer: ") + SDL_GetError());
+    }
+    m_texture = SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                  width, height);
+    m_surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (!m_texture || !m_surface) {
+        std::string error = SDL_GetError();
+        release();
+        throw std::runtime_error("Cannot create SDL texture: " + error);
+    }
+    m_dirtyRows.assign(height, 0);
+}
+
+TexturePresenter::~TexturePresenter() {
+    release();
+}
+
+void TexturePresenter::release() {
+    if (m_surface) {
+        SDL_FreeSurface(m_surface);
+        m_surface = nullptr;
+    }
+    if (m_texture) {
+        SDL_DestroyTexture(m_texture);
+        m_texture = nullptr;
+    }
+    if (m_renderer) {
+        SDL_DestroyRenderer(m_renderer);
+        m_renderer = nullptr;
+    }
+}
+
+void TexturePresenter::upload(int top, int bottom) {
+    SDL_Rect rows = {0, top, m_surface->w, bottom - top};
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(m_texture, &rows, &pixels, &pitch) != 0) {
+        std::cerr << "Cannot lock SDL texture: " << SDL_GetError() << "\n";
+        return;
+    }
+    // Locked pixels are write only, every byte of the rows is copied
+    const uint8_t* source = (const uint8_t*)m_surface->pixels + top * m_surface->pitch;
+    uint8_t* target = (uint8_t*)pixels;
+    if (pitch == m_surface->pitch) {
+        memcpy(target, source, (size_t)pitch * rows.h);
+    } else {
+        for (int i = 0; i < rows.h; i++) {
+            memcpy(target + i * pitch, source + i * m_surface->pitch, m_surface->w * 4);
+        }
+    }
+    SDL_UnlockTexture(m_texture);
+}
+
+void TexturePresenter::render(const CellMap& map) {
+    SDL_Rect source = map.drawArea();
+    SDL_Rect target = {0, 0, source.w * map.outputScale(), source.h * map.outputScale()};
+    SDL_RenderClear(m_renderer);
+    SDL_RenderCopy(m_renderer, m_texture, &source, &target);
+    SDL_RenderPresent(m_renderer);
+}
+
+void TexturePresenter::present(const CellMap& map) {
+    const std::vector<SDL_Rect>& rects = map.dirtyRects();
+    if (rects.empty()) {
+        return;
+    }
+
+    // Rows any rect touches, uploaded in runs of whole rows
+    std::fill(m_dirtyRows.begin(), m_dirtyRows.end(), 0);
+    for (auto& rect : rects) {
+        for (int y = rect.y; y < rect.y + rect.h && y < m_surface->h; y++) {
+            m_dirtyRows[y] = 1;
+        }
+    }
+    for (int y = 0; y < m_surface->h;) {
+        if (!m_dirtyRows[y]) {
+            y++;
+            continue;
+        }
+        int end = y;
+        while (end < m_surface->h && m_dirtyRows[end]) {
+            end++;
+        }
+        upload(y, end);
+        y = end;
+    }
+
+    render(map);
+}
+
+void TexturePresenter::refresh(const CellMap& map) {
+    render(map);
+}
+
+PresenterUniq CreatePresenter(SDL_Window* window, PresenterKind kind) {
+    if (kind != PresenterKind::Surface) {
+        try {
+            return std::make_unique<TexturePresenter>(window, kind == PresenterKind::Software);
+        } catch (const std::runtime_error& error) {
+            std::cerr << error.what() << ", using the window surface\n";
+        }
+    }
+    return std::make_unique<SurfacePresenter>(window);
+}
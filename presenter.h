@@ -0,0 +1,86 @@
+#ifndef Presenter_H
+
+#define Presenter_H
+#pragma once
+#include <SDL2/SDL.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cellmap.h"
+
+// Ways of getting the surface CellMap draws into onto the screen
+enum class PresenterKind {
+    // Window surface, changed rects are copied with
+    // SDL_UpdateWindowSurfaceRects
+    Surface,
+    // Streaming texture on the default renderer
+    Texture,
+    // Streaming texture on the software renderer
+    Software
+};
+
+bool ParsePresenterKind(const std::string& name, PresenterKind& kind);
+
+class Presenter {
+public:
+    virtual ~Presenter() = default;
+
+    // Surface to hand to CellMap
+    virtual SDL_Surface* surface() = 0;
+    // True when the presenter scales the map's output itself, see
+    // CellMap::setScaledOutput
+    virtual bool scales() const = 0;
+    // Shows the changed rects of the map's last draw
+    virtual void present(const CellMap& map) = 0;
+    // Shows the whole surface again, e.g. after the window was exposed
+    virtual void refresh(const CellMap& map) = 0;
+};
+typedef std::unique_ptr<Presenter> PresenterUniq;
+
+class SurfacePresenter : public Presenter {
+public:
+    explicit SurfacePresenter(SDL_Window* window);
+
+    SDL_Surface* surface() override { return m_surface; }
+    bool scales() const override { return false; }
+    void present(const CellMap& map) override;
+    void refresh(const CellMap& map) override;
+
+private:
+    SDL_Window* m_window;
+    SDL_Surface* m_surface;
+};
+
+// Keeps the pixels in a surface of its own and uploads only the rows a
+// draw changed into a streaming texture. The renderer scales the texture
+// up to the window, so zoomed in maps draw one pixel per cell.
+class TexturePresenter : public Presenter {
+public:
+    // Throws when the renderer or the texture cannot be created
+    TexturePresenter(SDL_Window* window, bool software);
+    ~TexturePresenter();
+    TexturePresenter(const TexturePresenter&) = delete;
+    TexturePresenter& operator=(const TexturePresenter&) = delete;
+
+    SDL_Surface* surface() override { return m_surface; }
+    bool scales() const override { return true; }
+    void present(const CellMap& map) override;
+    void refresh(const CellMap& map) override;
+
+private:
+    void release();
+    void upload(int top, int bottom);
+    void render(const CellMap& map);
+
+    SDL_Renderer* m_renderer = nullptr;
+    SDL_Texture* m_texture = nullptr;
+    SDL_Surface* m_surface = nullptr;
+    // Scratch, one flag per surface row
+    std::vector<uint8_t> m_dirtyRows;
+};
+
+// Falls back to the window surface when a texture presenter cannot be
+// created
+PresenterUniq CreatePresenter(SDL_Window* window, PresenterKind kind);
+
+#endif
@@ -0,0 +1,176 @@
+#include "rle.h"
+#include "ltlmap.h"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
+
+static std::string trim(const std::string& s) {
+    size_t begin = s.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(begin, end - begin + 1);
+}
+
+RleReader::RleReader(std::istream& input)
+    : m_input(input), m_chunk(kRleChunkSize) {}
+
+bool RleReader::fill() {
+    m_input.read(m_chunk.data(), m_chunk.size());
+    m_pos = 0;
+    m_end = (size_t)m_input.gcount();
+    return m_end > 0;
+}
+
+void RleReader::headerLine(const std::string& line) {
+    if (line[0] == '#') {
+        // #P and #R place the top left cell, other lines are comments
+        if (line.size() > 1 && (line[1] == 'P' || line[1] == 'R') && !m_body) {
+            std::istringstream position(line.substr(2));
+            Coord x, y;
+            if (position >> x >> y) {
+                m_left = m_x = x;
+                m_y = y;
+            }
+        }
+        return;
+    }
+
+    // x = 3, y = 3, rule = B3/S23
+    size_t begin = 0;
+    while (begin < line.size()) {
+        size_t comma = std::min(line.find(',', begin), line.size());
+        size_t equals = line.find('=', begin);
+        if (equals >= comma) {
+            throw std::runtime_error("Malformed RLE header: " + line);
+        }
+        std::string key = trim(line.substr(begin, equals - begin));
+        if (key == "rule") {
+            // Larger than Life rules have commas of their own
+            m_rule = trim(line.substr(equals + 1));
+            break;
+        }
+        std::string value = trim(line.substr(equals + 1, comma - equals - 1));
+        if (key == "x") {
+            m_width = std::stoull(value);
+        } else if (key == "y") {
+            m_height = std::stoull(value);
+        }
+        begin = comma + 1;
+    }
+}
+
+bool RleReader::read(std::vector<XY>& cells) {
+    size_t start = cells.size();
+    while (!m_done && cells.size() - start < kRleBatchCells) {
+        if (m_pos == m_end && !fill()) {
+            // A pattern may end without '!'
+            if (m_inLine) {
+                headerLine(m_line);
+            }
+            m_done = true;
+            break;
+        }
+        char c = m_chunk[m_pos++];
+
+        if (m_inLine) {
+            if (c == '\n' || c == '\r') {
+                headerLine(m_line);
+                m_inLine = false;
+                m_lineStart = true;
+            } else {
+                m_line.push_back(c);
+            }
+            continue;
+        }
+        if (c == '\n' || c == '\r') {
+            m_lineStart = true;
+            continue;
+        }
+        bool lineStart = m_lineStart;
+        m_lineStart = false;
+        if (lineStart && (c == '#' || (c == 'x' && !m_body))) {
+            m_inLine = true;
+            m_line.assign(1, c);
+            continue;
+        }
+        if (c >= '0' && c <= '9') {
+            m_count = m_count * 10 + (c - '0');
+            continue;
+        }
+        if (c == ' ' || c == '\t') {
+            continue;
+        }
+
+        m_body = true;
+        Len run = m_count ? m_count : 1;
+        m_count = 0;
+        if (c == 'b' || c == '.') {
+            m_x = (Coord)((Len)m_x + run);
+        } else if (c == '$') {
+            m_y = (Coord)((Len)m_y + run);
+            m_x = m_left;
+        } else if (c == '!') {
+            m_done = true;
+        } else if (std::isalpha((unsigned char)c)) {
+            for (Len i = 0; i < run; i++) {
+                cells.emplace_back(m_x, m_y);
+                m_x = (Coord)((Len)m_x + 1);
+            }
+        } else {
+            throw std::runtime_error(std::string("Unexpected '") + c + "' in RLE pattern");
+        }
+    }
+    return cells.size() > start || !m_done;
+}
+
+void SetRleRule(const std::string& text, LifeEngine& engine) {
+    Rule rule = kConwayRule;
+    if (ParseRule(text, rule)) {
+        engine.setRule(rule);
+        return;
+    }
+    // The ltl engine is a tile engine too, but takes no isotropic rules
+    if (auto* ltlEngine = dynamic_cast<LtlEngine*>(&engine)) {
+        LtlRule ltlRule;
+        if (!text.empty() && (text[0] == 'R' || text[0] == 'r') && ParseLtlRule(text, ltlRule)) {
+            ltlEngine->setLtlRule(ltlRule);
+            return;
+        }
+    } else if (auto* tileEngine = dynamic_cast<TileEngine*>(&engine)) {
+        IsotropicRule isotropicRule;
+        if (ParseIsotropicRule(text, isotropicRule)) {
+            tileEngine->setIsotropicRule(isotropicRule);
+            return;
+        }
+    }
+    throw std::runtime_error("Unsupported RLE rule: " + text);
+}
+
+std::string ReadRleRule(std::istream& input) {
+    // The header comes before any cell, so one batch gets past it
+    RleReader reader(input);
+    std::vector<XY> cells;
+    reader.read(cells);
+    return reader.rule();
+}
+
+size_t LoadRle(std::istream& input, LifeEngine& engine, bool headerRule) {
+    RleReader reader(input);
+    std::vector<XY> cells;
+    size_t total = 0;
+    bool ruled = !headerRule;
+    while (reader.read(cells)) {
+        // The header comes before any cell
+        if (!ruled && !reader.rule().empty()) {
+            SetRleRule(reader.rule(), engine);
+            ruled = true;
+        }
+        engine.addCells(cells);
+        total += cells.size();
+        cells.clear();
+    }
+    return total;
+}
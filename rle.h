@@ -0,0 +1,78 @@
+#ifndef Rle_H
+
+#define Rle_H
+#pragma once
+#include <istream>
+#include <string>
+#include <vector>
+#include "cellmap.h"
+
+// Bytes read from the stream at a time
+constexpr size_t kRleChunkSize = 1 << 16;
+// Cells handed out per read() call, a long run may go past it
+constexpr size_t kRleBatchCells = 1 << 16;
+
+// Reads a pattern in run length encoded form, e.g.
+//
+//   #N Glider
+//   x = 3, y = 3, rule = B3/S23
+//   bob$2bo$3o!
+//
+// from a stream chunk by chunk, without holding the whole text. Rows may
+// wrap over several lines and runs may span chunks. b and . are dead
+// cells, any other letter is alive. The top left cell is at the origin
+// unless a #P or #R line says otherwise.
+class RleReader {
+public:
+    explicit RleReader(std::istream& input);
+
+    // Appends the next batch of live cells, false once the pattern ended.
+    // Throws on a malformed pattern.
+    bool read(std::vector<XY>& cells);
+
+    // From the header line, once read() got past it
+    Len width() const { return m_width; }
+    Len height() const { return m_height; }
+    const std::string& rule() const { return m_rule; }
+
+private:
+    bool fill();
+    void headerLine(const std::string& line);
+
+    std::istream& m_input;
+    std::vector<char> m_chunk;
+    size_t m_pos = 0;
+    size_t m_end = 0;
+
+    // Header and comment lines are collected whole
+    std::string m_line;
+    bool m_inLine = false;
+    bool m_lineStart = true;
+    bool m_body = false;
+    bool m_done = false;
+
+    Len m_count = 0;
+    Coord m_left = 0;
+    Coord m_x = 0;
+    Coord m_y = 0;
+
+    Len m_width = 0;
+    Len m_height = 0;
+    std::string m_rule;
+};
+
+// Sets the rule an RLE header names: a B/S or Generations rule on any
+// engine that runs it, a Larger than Life one (R5,C0,...) on an LtlEngine
+// and an isotropic one (B2-a/S12) on a TileEngine. Throws for the others.
+void SetRleRule(const std::string& text, LifeEngine& engine);
+
+// Rule the header of an RLE pattern names, empty without one. Reads input
+// past the header.
+std::string ReadRleRule(std::istream& input);
+
+// Adds every cell of an RLE pattern to engine through addCells, returns
+// the number of cells. Sets the header's rule through SetRleRule unless
+// headerRule is false, e.g. when the caller sets a rule of its own.
+size_t LoadRle(std::istream& input, LifeEngine& engine, bool headerRule = true);
+
+#endif
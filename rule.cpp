@@ -0,0 +1,87 @@
+#include "rule.h"
+#include <cctype>
+
+std::string Rule::toString() const {
+    std::string result = "B";
+    for (int n = 0; n <= 8; n++) {
+        if ((birth >> n) & 1) {
+            result.push_back((char)('0' + n));
+        }
+    }
+    result += "/S";
+    for (int n = 0; n <= 8; n++) {
+        if ((survival >> n) & 1) {
+            result.push_back((char)('0' + n));
+        }
+    }
+    if (states > 2) {
+        result += "/C" + std::to_string(states);
+    }
+    return result;
+}
+
+// Neighbor counts of one half of a rule, e.g. "36"
+static bool parseCounts(const std::string& text, uint16_t& counts) {
+    counts = 0;
+    for (char c : text) {
+        if (c < '0' || c > '8') {
+            return false;
+        }
+        counts |= 1 << (c - '0');
+    }
+    return true;
+}
+
+bool ParseRule(const std::string& text, Rule& rule) {
+    size_t slash = text.find('/');
+    if (slash == std::string::npos) {
+        return false;
+    }
+    std::string first = text.substr(0, slash);
+    std::string second = text.substr(slash + 1);
+    std::string third;
+    size_t generations = second.find('/');
+    if (generations != std::string::npos) {
+        third = second.substr(generations + 1);
+        second = second.substr(0, generations);
+    }
+    for (auto* part : {&first, &second, &third}) {
+        for (auto& c : *part) {
+            c = (char)std::toupper((unsigned char)c);
+        }
+    }
+
+    int states = 2;
+    if (generations != std::string::npos) {
+        if (!third.empty() && (third[0] == 'C' || third[0] == 'G')) {
+            third = third.substr(1);
+        }
+        if (third.empty() || third.size() > 2 ||
+            third.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        states = std::stoi(third);
+        if (states < 2 || states > kMaxRuleStates) {
+            return false;
+        }
+    }
+
+    uint16_t birth, survival;
+    if (!first.empty() && first[0] == 'B' && !second.empty() && second[0] == 'S') {
+        if (!parseCounts(first.substr(1), birth) || !parseCounts(second.substr(1), survival)) {
+            return false;
+        }
+    } else if (!first.empty() && first[0] == 'S' && !second.empty() && second[0] == 'B') {
+        if (!parseCounts(first.substr(1), survival) || !parseCounts(second.substr(1), birth)) {
+            return false;
+        }
+    } else if (!parseCounts(first, survival) || !parseCounts(second, birth)) {
+        return false;
+    }
+
+    if (birth & 1) {
+        return false;
+    }
+    rule = Rule(birth, survival, (uint8_t)states);
+    return true;
+}
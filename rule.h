@@ -0,0 +1,114 @@
+#ifndef Rule_H
+
+#define Rule_H
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Most states a Generations rule may have: dead, live and 7 decay stages,
+// what the spare CellState bits hold
+constexpr int kMaxRuleStates = 9;
+
+// Life-like rule in B/S notation. Bit n of birth is set when a dead cell
+// with n live neighbors comes alive, bit n of survival when a live cell
+// with n live neighbors stays alive.
+//
+// Generations rules (B/S/C) have more than 2 states: a live cell that
+// does not survive decays through states - 2 stages before it is dead.
+// Decaying cells are not neighbors and cannot be born.
+class Rule {
+public:
+    constexpr Rule(uint16_t ibirth, uint16_t isurvival, uint8_t istates = 2)
+        : birth(ibirth), survival(isurvival), states(istates) {}
+
+    // Next aliveness indexed by neighbors << 1 | alive, the CellState
+    // layout
+    constexpr uint32_t stateMask() const {
+        uint32_t mask = 0;
+        for (int n = 0; n <= 8; n++) {
+            mask |= (uint32_t)((birth >> n) & 1) << (n << 1);
+            mask |= (uint32_t)((survival >> n) & 1) << ((n << 1) | 1);
+        }
+        return mask;
+    }
+    // Next aliveness indexed by alive << 4 | sum, where the sum counts
+    // the cell itself too, the layout of the tile engine's adders
+    constexpr uint32_t sumMask() const {
+        return (uint32_t)birth | ((uint32_t)survival << 17);
+    }
+
+    constexpr bool operator==(const Rule& other) const {
+        return birth == other.birth && survival == other.survival && states == other.states;
+    }
+    constexpr bool operator!=(const Rule& other) const {
+        return !(*this == other);
+    }
+
+    // e.g. "B36/S23", or "B2/S/C3" for a Generations rule
+    std::string toString() const;
+
+    uint16_t birth;
+    uint16_t survival;
+    uint8_t states;
+};
+
+constexpr Rule kConwayRule(1 << 3, (1 << 2) | (1 << 3));
+constexpr Rule kHighLifeRule((1 << 3) | (1 << 6), (1 << 2) | (1 << 3));
+constexpr Rule kDayAndNightRule((1 << 3) | (1 << 6) | (1 << 7) | (1 << 8),
+                                (1 << 3) | (1 << 4) | (1 << 6) | (1 << 7) | (1 << 8));
+constexpr Rule kSeedsRule(1 << 2, 0);
+constexpr Rule kBriansBrainRule(1 << 2, 0, 3);
+constexpr Rule kStarWarsRule(1 << 2, (1 << 3) | (1 << 4) | (1 << 5), 4);
+
+// Parses "B36/S23", the older "23/36" survival/birth form and lowercase
+// letters, with a third "/C3" (or "/3" in the older form) part for
+// Generations rules. Rules with B0 are rejected: they would bring the
+// whole empty plane to life. So are rules with more than kMaxRuleStates
+// states.
+bool ParseRule(const std::string& text, Rule& rule);
+
+// Rule known at compile time, next() is a test against a constant
+template<uint16_t Birth, uint16_t Survival>
+class StaticRule {
+public:
+    static constexpr uint32_t kStateMask = Rule(Birth, Survival).stateMask();
+    static constexpr uint32_t kSumMask = Rule(Birth, Survival).sumMask();
+
+    bool next(uint32_t state) const { return (kStateMask >> state) & 1; }
+    uint32_t sumMask() const { return kSumMask; }
+};
+
+// Any other rule, next() looks the state up in a table built once
+class RuleTable {
+public:
+    explicit RuleTable(const Rule& rule)
+        : m_stateMask(rule.stateMask()), m_sumMask(rule.sumMask()) {}
+
+    bool next(uint32_t state) const { return (m_stateMask >> state) & 1; }
+    uint32_t sumMask() const { return m_sumMask; }
+
+private:
+    uint32_t m_stateMask;
+    uint32_t m_sumMask;
+};
+
+// Calls f once with the kernel for the birth and survival of rule. Per-cell
+// loops take the kernel as a template parameter, so the rule is chosen
+// once per generation and the common rules get a loop of their own.
+template<class F>
+inline void DispatchRule(const Rule& rule, F&& f) {
+    Rule lifeLike(rule.birth, rule.survival);
+    if (lifeLike == kConwayRule) {
+        f(StaticRule<kConwayRule.birth, kConwayRule.survival>());
+    } else if (lifeLike == kHighLifeRule) {
+        f(StaticRule<kHighLifeRule.birth, kHighLifeRule.survival>());
+    } else if (lifeLike == kDayAndNightRule) {
+        f(StaticRule<kDayAndNightRule.birth, kDayAndNightRule.survival>());
+    } else if (lifeLike == kSeedsRule) {
+        f(StaticRule<kSeedsRule.birth, kSeedsRule.survival>());
+    } else {
+        f(RuleTable(rule));
+    }
+}
+
+#endif
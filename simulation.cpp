@@ -0,0 +1,170 @@
+#include "simulation.h"
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+Simulation::Simulation(LifeEngine& engine, const AABB& view, int printAtGeneration)
+    : m_engine(engine), m_printAtGeneration(printAtGeneration), m_view(view) {}
+
+Simulation::~Simulation() {
+    stop();
+}
+
+void Simulation::start() {
+    if (!m_thread.joinable()) {
+        m_thread = std::thread(&Simulation::run, this);
+    }
+}
+
+void Simulation::stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+    m_stop = false;
+}
+
+void Simulation::setRunning(bool running) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = running;
+        m_republish = true;
+    }
+    m_wake.notify_all();
+}
+
+bool Simulation::running() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_running;
+}
+
+void Simulation::setRate(unsigned stepsPerSecond) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_rate = stepsPerSecond;
+    }
+    m_wake.notify_all();
+}
+
+void Simulation::setStep(unsigned log2) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_step.store(std::min(log2, kMaxStepLog2), std::memory_order_relaxed);
+    m_budgetMs = 0;
+}
+
+void Simulation::setAdaptiveStep(unsigned budgetMs) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_budgetMs = budgetMs;
+}
+
+bool Simulation::adaptiveStep() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_budgetMs > 0;
+}
+
+void Simulation::setView(const AABB& view, unsigned shift) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_view = view;
+        m_shift = shift;
+        m_republish = true;
+    }
+    m_wake.notify_all();
+}
+
+void Simulation::publish(const AABB& view, unsigned shift) {
+    Snapshot& snapshot = m_snapshots.back();
+    snapshot.cells.clear();
+    snapshot.decaying.clear();
+    snapshot.stages.clear();
+    snapshot.shift = shift;
+    if (shift > 0) {
+        Len width = (Len)view.right - (Len)view.left + 1;
+        Len height = (Len)view.bottom - (Len)view.top + 1;
+        snapshot.density.reset(XY(view.left, view.top), shift, (int)(width >> shift), (int)(height >> shift));
+        m_engine.queryDensity(snapshot.density);
+    } else {
+        m_engine.query(view, snapshot.cells);
+        m_engine.queryDecaying(view, snapshot.decaying, snapshot.stages);
+    }
+    snapshot.generation = m_generation.load(std::memory_order_relaxed);
+    snapshot.sequence = ++m_published;
+    m_snapshots.publish();
+}
+
+void Simulation::run() {
+    auto nextTick = std::chrono::steady_clock::now();
+    while (true) {
+        // Sleep while paused until the view changes
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [&] { return m_stop || m_running || m_republish; });
+        if (m_stop) {
+            return;
+        }
+        bool running = m_running;
+        bool republish = m_republish;
+        unsigned rate = m_rate;
+        unsigned log2 = m_step.load(std::memory_order_relaxed);
+        AABB view = m_view;
+        unsigned shift = m_shift;
+        m_republish = false;
+
+        if (running && rate > 0) {
+            auto interval = std::chrono::nanoseconds(1000000000 / rate);
+            auto now = std::chrono::steady_clock::now();
+            if (nextTick + interval < now) {
+                // Do not catch up on the time spent paused or behind
+                nextTick = now;
+            }
+            if (m_wake.wait_until(lock, nextTick, [&] { return m_stop || !m_running || m_republish; })) {
+                // Handle the command first, the tick stays due
+                continue;
+            }
+            nextTick += interval;
+        }
+        lock.unlock();
+
+        if (running) {
+            uint64_t generation = m_generation.load(std::memory_order_relaxed);
+            if ((int64_t)generation == m_printAtGeneration) {
+                m_engine.print(std::cout);
+            }
+            // Land on the generation to print instead of jumping over it
+            unsigned taken = log2;
+            while (taken > 0 && (int64_t)generation < m_printAtGeneration &&
+                   (int64_t)(generation + (1ULL << taken)) > m_printAtGeneration) {
+                taken--;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            m_engine.step(taken);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            m_generation.store(generation + (1ULL << taken), std::memory_order_relaxed);
+
+            // Double the step while twice the work still fits the
+            // budget, halve it once a step overruns
+            lock.lock();
+            auto budget = std::chrono::milliseconds(m_budgetMs);
+            if (m_budgetMs > 0 && taken == log2 && log2 == m_step.load(std::memory_order_relaxed)) {
+                if (elapsed * 2 <= budget && log2 < kMaxStepLog2) {
+                    m_step.store(log2 + 1, std::memory_order_relaxed);
+                } else if (elapsed > budget && log2 > 0) {
+                    m_step.store(log2 - 1, std::memory_order_relaxed);
+                }
+            }
+            lock.unlock();
+        }
+
+        // Querying every generation would cost more than the generation
+        // for small patterns, so wait for the render loop to take the
+        // last snapshot unless it asked for a new one
+        if (republish || !running || !m_snapshots.pending()) {
+            publish(view, shift);
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#ifndef Simulation_H
+
+#define Simulation_H
+#pragma once
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+#include "cellmap.h"
+
+// Single producer, single consumer triple buffer. The producer fills
+// back() and publishes it, the consumer takes the newest published buffer
+// with front(). Neither side locks or waits, and a buffer is never
+// written while the consumer holds it.
+template<typename T>
+class TripleBuffer {
+public:
+    // Producer side
+    T& back() { return m_buffers[m_back]; }
+    void publish() {
+        uint8_t old = m_ready.exchange(m_back | kFresh, std::memory_order_acq_rel);
+        m_back = old & kIndexMask;
+    }
+    // True until the consumer has taken the last published buffer
+    bool pending() const {
+        return m_ready.load(std::memory_order_acquire) & kFresh;
+    }
+
+    // Consumer side, stays valid until the next call
+    const T& front() {
+        if (m_ready.load(std::memory_order_acquire) & kFresh) {
+            uint8_t old = m_ready.exchange(m_front, std::memory_order_acq_rel);
+            m_front = old & kIndexMask;
+        }
+        return m_buffers[m_front];
+    }
+
+private:
+    static constexpr uint8_t kIndexMask = 3;
+    static constexpr uint8_t kFresh = 4;
+
+    T m_buffers[3];
+    uint8_t m_back = 0;
+    std::atomic<uint8_t> m_ready{1};
+    uint8_t m_front = 2;
+};
+
+// What the render loop draws: the live cells inside the view box at the
+// end of one generation, or their counts per pixel when zoomed out
+class Snapshot {
+public:
+    std::vector<XY> cells;
+    // Cells decaying under a Generations rule and their stages
+    std::vector<XY> decaying;
+    std::vector<uint8_t> stages;
+    // Filled instead of cells when shift is not 0
+    DensityGrid density;
+    unsigned shift = 0;
+    uint64_t generation = 0;
+    // Counts publications, a new one may hold the same generation seen
+    // through a moved view
+    uint64_t sequence = 0;
+};
+
+// Largest step, in log2 generations
+constexpr unsigned kMaxStepLog2 = 32;
+
+// Runs a LifeEngine on its own thread. The engine belongs to the thread
+// between start() and stop(), the render loop only sees snapshots.
+class Simulation {
+public:
+    // printAtGeneration dumps the engine to stdout once that many
+    // generations have run, like CellMap does
+    Simulation(LifeEngine& engine, const AABB& view, int printAtGeneration = -1);
+    ~Simulation();
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    void start();
+    void stop();
+
+    // Pauses or resumes the generations, the snapshots keep following
+    // the view
+    void setRunning(bool running);
+    bool running();
+    // Steps per second, 0 runs as fast as the engine goes
+    void setRate(unsigned stepsPerSecond);
+    // Each step advances 2^log2 generations, only the last one is
+    // published. Turns the adaptive step off.
+    void setStep(unsigned log2);
+    // Picks the largest step that still runs within budgetMs, 0 turns
+    // it off and keeps the current step
+    void setAdaptiveStep(unsigned budgetMs);
+    bool adaptiveStep();
+    // Shift 0 publishes cells, otherwise counts per 2^shift square
+    // starting at the top left corner of the view
+    void setView(const AABB& view, unsigned shift = 0);
+
+    // Newest snapshot, without locking
+    const Snapshot& snapshot() { return m_snapshots.front(); }
+    uint64_t generation() const { return m_generation.load(std::memory_order_relaxed); }
+    unsigned step() const { return m_step.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+    void publish(const AABB& view, unsigned shift);
+
+    LifeEngine& m_engine;
+    int m_printAtGeneration;
+    TripleBuffer<Snapshot> m_snapshots;
+    std::atomic<uint64_t> m_generation{0};
+    std::atomic<unsigned> m_step{0};
+    uint64_t m_published = 0;
+    std::thread m_thread;
+
+    // Commands from the render loop
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    AABB m_view;
+    unsigned m_shift = 0;
+    // Publish even if the render loop has not taken the last snapshot
+    bool m_republish = true;
+    bool m_running = false;
+    unsigned m_rate = 0;
+    unsigned m_budgetMs = 0;
+    bool m_stop = false;
+};
+
+#endif
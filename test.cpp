@@ -1,6 +1,26 @@
 #include <gtest/gtest.h>
 #include <limits>
+#include <algorithm>
+#include <random>
+#include <atomic>
 #include "cellmap.h"
+#include "hashlife.h"
+#include "tilemap.h"
+#include "threadpool.h"
+#include "simulation.h"
+#include "flatmap.h"
+#include "morton.h"
+#include "mortonmap.h"
+#include "ltlmap.h"
+#include "isotropic.h"
+#include "gridmap.h"
+#include "rle.h"
+#include "jsonpattern.h"
+#include "points.h"
+#include <sstream>
+#include <unordered_map>
+#include <map>
+#include <set>
 static Coord MAX = std::numeric_limits<Coord>::max();
 static Coord MIN = std::numeric_limits<Coord>::min();
 
@@ -80,6 +100,44 @@ TEST(CellStateManipulation, NeighborCount) {
     EXPECT_EQ(GetCellNeighborCount(state), 0);
 }
 
+TEST(FlatMap, MatchesUnorderedMap) {
+    FlatMap<XY, CellRef> flat;
+    std::unordered_map<XY, CellRef> reference;
+    std::mt19937_64 rng(7);
+
+    for (int i = 0; i < 200000; i++) {
+        // Small coordinate range forces long probe runs and re-insertions
+        XY xy((Coord)(rng() % 300) - 150, (Coord)(rng() % 300) - 150);
+        switch (rng() % 3) {
+        case 0:
+        case 1: {
+            auto a = flat.insert(std::make_pair(xy, (CellRef)i));
+            auto b = reference.insert(std::make_pair(xy, (CellRef)i));
+            ASSERT_EQ(a.second, b.second);
+            ASSERT_EQ(a.first->second, b.first->second);
+            break;
+        }
+        case 2:
+            ASSERT_EQ(flat.erase(xy), reference.erase(xy));
+            break;
+        }
+    }
+
+    EXPECT_EQ(flat.size(), reference.size());
+    size_t visited = 0;
+    for (auto it = flat.begin(); it != flat.end(); it++) {
+        auto found = reference.find(it->first);
+        ASSERT_TRUE(found != reference.end());
+        EXPECT_EQ(found->second, it->second);
+        visited++;
+    }
+    EXPECT_EQ(visited, reference.size());
+
+    flat.clear();
+    EXPECT_EQ(flat.size(), 0);
+    EXPECT_TRUE(flat.find(XY(0, 0)) == flat.end());
+}
+
 TEST(AABBQueries, Contain) {
     {
         AABB bb(XY(0,0), -10, 10, -10, 10);
@@ -116,16 +174,16 @@ TEST(CellTree, BigInts) {
 
 TEST(CellTree, Construction) {
     CellTreeNodeRef root = CellTreeNode::createRoot();
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(((Coord)1) << 40, -(((Coord)1) << 40)), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(((Coord)1) << 32, -(((Coord)1) << 32)), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(-(((Coord)1) << 32), -(((Coord)1) << 32)), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(-(((Coord)1) << 33), -(((Coord)1) << 32)), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(((Coord)1) << 40, -(((Coord)1) << 40)), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(((Coord)1) << 32, -(((Coord)1) << 32)), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(-(((Coord)1) << 32), -(((Coord)1) << 32)), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(-(((Coord)1) << 33), -(((Coord)1) << 32)), 0)));
 
     EXPECT_EQ(root->m_cells.size(), 4);
     EXPECT_EQ(root->m_cells_map.size(), 4);
     EXPECT_EQ(root->m_nw, nullptr);
 
-    CellRef origin = std::make_shared<Cell>(XY(0, 0), 0);
+    CellRef origin = root->newCell(XY(0, 0), 0);
     EXPECT_TRUE(root->insert(origin));
     EXPECT_EQ(root->m_cells.size(), 0);
     EXPECT_EQ(root->m_cells_map.size(), 5);
@@ -134,7 +192,7 @@ TEST(CellTree, Construction) {
     std::vector<CellRef> cells;
     root->query(query, cells);
     EXPECT_EQ(cells.size(), 1);
-    EXPECT_EQ(cells[0].get(), origin.get());
+    EXPECT_EQ(cells[0], origin);
 
     EXPECT_EQ(root->m_nw->cellCount(), 3);
     EXPECT_EQ(root->m_ne->cellCount(), 2);
@@ -145,7 +203,7 @@ TEST(CellTree, Construction) {
     EXPECT_THROW({
             try
             {
-                CellRef other = std::make_shared<Cell>(XY(1, 1), 0);
+                CellRef other = root->newCell(XY(1, 1), 0);
                 root->remove(other);
             }
             catch( const std::runtime_error& e )
@@ -163,11 +221,11 @@ TEST(CellTree, Construction) {
 
 TEST(CellTree, Update) {
     CellTreeNodeRef root = CellTreeNode::createRoot();
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(0, 0), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(100, 100), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(200, 200), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(202, 202), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(204, 204), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(0, 0), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(100, 100), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(200, 200), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(202, 202), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(204, 204), 0)));
     EXPECT_FALSE(root->m_nw == nullptr);
     EXPECT_EQ(root->m_cells.size(), 0);
     EXPECT_EQ(root->m_cells_map.size(), 5);
@@ -188,12 +246,12 @@ TEST(CellTree, Update) {
 
     Coord MAX_M1 = MAX - 1;
     Coord MIN_P1 = MIN + 1;
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(MAX_M1, MIN_P1), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(MAX, MIN_P1), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(MAX, MIN), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(0, 0), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(1, 0), 0)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(1, 1), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(MAX_M1, MIN_P1), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(MAX, MIN_P1), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(MAX, MIN), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(0, 0), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(1, 0), 0)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(1, 1), 0)));
 
     root->update();
 
@@ -216,9 +274,9 @@ TEST(CellTree, Update) {
 
 TEST(CellTree, Oscillator) {
     CellTreeNodeRef root = CellTreeNode::createRoot();
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(-1, 0), 1)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(0, 0), 1)));
-    EXPECT_TRUE(root->insert(std::make_shared<Cell>(XY(1, 0), 1)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(-1, 0), 1)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(0, 0), 1)));
+    EXPECT_TRUE(root->insert(root->newCell(XY(1, 0), 1)));
 
     root->update();
 
@@ -227,8 +285,1700 @@ TEST(CellTree, Oscillator) {
     EXPECT_TRUE(root->m_cells_map.find(XY(0, -1)) != root->m_cells_map.end());
 }
 
+// Recounts the cells of a subtree the slow way
+static size_t countCells(CellTreeNode* node) {
+    if (node->m_nw) {
+        return countCells(node->m_nw) + countCells(node->m_ne)
+            + countCells(node->m_sw) + countCells(node->m_se);
+    }
+    return node->m_cells.size();
+}
+
+// Same for the cells with a decay stage
+static size_t countDecayingCells(CellTreeNode* node) {
+    if (node->m_nw) {
+        return countDecayingCells(node->m_nw) + countDecayingCells(node->m_ne)
+            + countDecayingCells(node->m_sw) + countDecayingCells(node->m_se);
+    }
+    size_t result = 0;
+    for (CellRef cell = node->m_cells.head(); cell != kNullCell; cell = node->cell(cell).next) {
+        result += GetCellDecay(node->cell(cell).state) != 0;
+    }
+    return result;
+}
+
+static bool populationsConsistent(CellTreeNode* node) {
+    if (node->population() != countCells(node) || node->decaying() != countDecayingCells(node)) {
+        return false;
+    }
+    if (node->m_nw) {
+        return populationsConsistent(node->m_nw) && populationsConsistent(node->m_ne)
+            && populationsConsistent(node->m_sw) && populationsConsistent(node->m_se);
+    }
+    return true;
+}
+
+TEST(CellTree, Population) {
+    CellTreeNodeRef root = CellTreeNode::createRoot();
+    std::mt19937_64 rng(3);
+    std::vector<CellRef> cells;
+    for (int i = 0; i < 2000; i++) {
+        XY xy((Coord)(rng() % 200) - 100, (Coord)(rng() % 200) - 100);
+        if (root->m_cells_map.find(xy) == root->m_cells_map.end()) {
+            cells.push_back(root->newCell(xy, 1));
+            EXPECT_TRUE(root->insert(cells.back()));
+        }
+    }
+    EXPECT_EQ(root->population(), cells.size());
+    EXPECT_TRUE(populationsConsistent(root.get()));
+
+    // Removing most cells merges subtrees back
+    for (size_t i = 0; i + 3 < cells.size(); i++) {
+        EXPECT_TRUE(root->remove(cells[i]));
+    }
+    EXPECT_EQ(root->population(), 3);
+    EXPECT_TRUE(populationsConsistent(root.get()));
+    EXPECT_EQ(root->m_nw, nullptr);
+
+    // remove() leaves m_cells_map to update(), so evolve a fresh soup
+    root = CellTreeNode::createRoot();
+    for (int i = 0; i < 2000; i++) {
+        XY xy((Coord)(rng() % 100) - 50, (Coord)(rng() % 100) - 50);
+        if (root->m_cells_map.find(xy) == root->m_cells_map.end()) {
+            EXPECT_TRUE(root->insert(root->newCell(xy, 1)));
+        }
+    }
+    for (int i = 0; i < 20; i++) {
+        root->update();
+        EXPECT_TRUE(populationsConsistent(root.get()));
+        EXPECT_EQ(root->population(), root->m_cells_map.size());
+    }
+}
+
+TEST(Morton, Encode) {
+    XY samples[] = {XY(0, 0), XY(-1, 1), XY(MIN, MAX), XY(MAX, MIN), XY(12345, -678910),
+                    XY(((Coord)1) << 40, -(((Coord)1) << 33))};
+    for (auto& xy : samples) {
+        EXPECT_TRUE(MortonDecode(MortonEncode(xy)) == xy);
+    }
+
+    EXPECT_TRUE(MortonEncode(XY(MIN, MIN)) < MortonEncode(XY(0, 0)));
+    EXPECT_TRUE(MortonEncode(XY(0, 0)) < MortonEncode(XY(MAX, MAX)));
+    EXPECT_TRUE(MortonEncode(XY(-1, -1)) < MortonEncode(XY(0, 0)));
+    // x varies fastest
+    EXPECT_TRUE(MortonEncode(XY(1, 0)) < MortonEncode(XY(0, 1)));
+    EXPECT_EQ(MortonEncode(XY(MIN, MIN)).hi, 0);
+    EXPECT_EQ(MortonEncode(XY(MIN, MIN)).lo, 0);
+
+    // Stepping a key matches encoding the neighbor, wrapping at the edges
+    for (auto& xy : samples) {
+        MortonKey key = MortonEncode(xy);
+        EXPECT_TRUE(MortonStep(key, kMortonXMask, true) == MortonEncode(XY(xy.x + 1, xy.y)) ||
+                    xy.x == MAX);
+        EXPECT_TRUE(MortonStep(key, kMortonYMask, false) == MortonEncode(XY(xy.x, xy.y - 1)) ||
+                    xy.y == MIN);
+    }
+    EXPECT_TRUE(MortonStep(MortonEncode(XY(MAX, 0)), kMortonXMask, true) == MortonEncode(XY(MIN, 0)));
+    EXPECT_TRUE(MortonStep(MortonEncode(XY(0, MIN)), kMortonYMask, false) == MortonEncode(XY(0, MAX)));
+}
+
+TEST(CellTree, Batch) {
+    CellTreeNodeRef single = CellTreeNode::createRoot();
+    CellTreeNodeRef batch = CellTreeNode::createRoot();
+    std::mt19937_64 rng(11);
+    std::vector<CellRef> cells;
+    for (int i = 0; i < 5000; i++) {
+        XY xy((Coord)(rng() % 400) - 200, (Coord)(rng() % 400) - 200);
+        if (i % 50 == 0) {
+            xy = XY(xy.x + MAX - 200, xy.y + MIN + 200);
+        }
+        if (single->m_cells_map.find(xy) == single->m_cells_map.end()) {
+            EXPECT_TRUE(single->insert(single->newCell(xy, 1)));
+            cells.push_back(batch->newCell(xy, 1));
+        }
+    }
+
+    // In two halves, so the second one lands in an existing tree
+    std::vector<CellRef> first(cells.begin(), cells.begin() + cells.size() / 2);
+    std::vector<CellRef> second(cells.begin() + cells.size() / 2, cells.end());
+    batch->insertBatch(first);
+    batch->insertBatch(second);
+
+    EXPECT_EQ(batch->population(), single->population());
+    EXPECT_EQ(batch->m_cells_map.size(), cells.size());
+    EXPECT_TRUE(populationsConsistent(batch.get()));
+
+    AABB box(XY(0, 0), -50, 70, -80, 10);
+    std::vector<CellRef> a, b;
+    single->query(box, a);
+    batch->query(box, b);
+    EXPECT_EQ(a.size(), b.size());
+
+    EXPECT_THROW(batch->insertBatch(first), std::runtime_error);
+
+    std::vector<CellRef> doomed(cells.begin(), cells.end() - 2);
+    batch->removeBatch(doomed);
+    EXPECT_EQ(batch->population(), 2);
+    EXPECT_EQ(batch->m_nw, nullptr);
+    EXPECT_EQ(batch->m_cells.size(), 2);
+
+    std::vector<CellRef> missing = {batch->newCell(XY(3, 3), 1)};
+    EXPECT_THROW(batch->removeBatch(missing), std::runtime_error);
+}
+
+TEST(CellTree, PoolRecycling) {
+    CellTreeNodeRef root = CellTreeNode::createRoot();
+    for (Coord x = 0; x < 8; x++) {
+        // Two blinkers far apart keep the tree subdivided
+        EXPECT_TRUE(root->insert(root->newCell(XY(x * 1000 - 1, 0), 1)));
+        EXPECT_TRUE(root->insert(root->newCell(XY(x * 1000, 0), 1)));
+        EXPECT_TRUE(root->insert(root->newCell(XY(x * 1000 + 1, 0), 1)));
+    }
+
+    root->update();
+    root->update();
+    size_t capacity = root->m_store->cells.capacity();
+    for (int i = 0; i < 100; i++) {
+        root->update();
+    }
+
+    // Dead cells and rejected candidates are recycled
+    EXPECT_EQ(root->m_store->cells.capacity(), capacity);
+    EXPECT_EQ(root->m_store->cells.size(), 24);
+    EXPECT_EQ(root->cellCount(), 24);
+}
+
+// Gosper glider gun, same as examples/gosper_glider_gun.json
+static const Coord kGosperGun[][2] = {
+    {0, 0}, {1, 0}, {0, 1}, {1, 1}, {10, 0}, {10, 1}, {10, 2}, {11, -1}, {12, -2},
+    {13, -2}, {11, 3}, {12, 4}, {13, 4}, {14, 1}, {15, -1}, {16, 0}, {16, 1}, {16, 2},
+    {15, 3}, {17, 1}, {20, 0}, {21, 0}, {20, -1}, {21, -1}, {20, -2}, {21, -2}, {22, -3},
+    {22, 1}, {24, 1}, {24, 2}, {24, -3}, {24, -4}, {34, -1}, {34, -2}, {35, -1}, {35, -2}
+};
+
+static std::vector<std::pair<Coord, Coord>> sortedCells(LifeEngine& engine) {
+    std::vector<XY> cells;
+    engine.query(AABB(XY(0, 0), MIN, MAX, MIN, MAX), cells);
+    std::vector<std::pair<Coord, Coord>> result;
+    for (auto& xy : cells) {
+        result.emplace_back(xy.x, xy.y);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+TEST(HashLife, Oscillator) {
+    HashLifeEngine engine;
+    engine.addCell(XY(-1, 0));
+    engine.addCell(XY(0, 0));
+    engine.addCell(XY(1, 0));
+    EXPECT_EQ(engine.cellCount(), 3);
+
+    engine.update();
+
+    EXPECT_TRUE(engine.getCell(XY(0, 1)));
+    EXPECT_TRUE(engine.getCell(XY(0, 0)));
+    EXPECT_TRUE(engine.getCell(XY(0, -1)));
+    EXPECT_FALSE(engine.getCell(XY(1, 0)));
+    EXPECT_EQ(engine.cellCount(), 3);
+
+    engine.step(10);
+    EXPECT_TRUE(engine.getCell(XY(0, 1)));
+    EXPECT_FALSE(engine.getCell(XY(-1, 0)));
+}
+
+TEST(HashLife, WrapAround) {
+    // L-tromino straddling the corner of the plane becomes a block
+    HashLifeEngine hashlife;
+    CellTreeEngine quadtree;
+    XY cells[3] = {XY(MAX, MAX), XY(MIN, MAX), XY(MAX, MIN)};
+    for (auto& xy : cells) {
+        hashlife.addCell(xy);
+        quadtree.addCell(xy);
+    }
+
+    hashlife.update();
+    quadtree.update();
+
+    EXPECT_EQ(hashlife.cellCount(), 4);
+    EXPECT_TRUE(hashlife.getCell(XY(MIN, MIN)));
+    EXPECT_EQ(sortedCells(hashlife), sortedCells(quadtree));
+}
+
+TEST(HashLife, MatchesQuadTree) {
+    HashLifeEngine hashlife;
+    CellTreeEngine quadtree;
+    for (auto& xy : kGosperGun) {
+        hashlife.addCell(XY(xy[0], xy[1]));
+        quadtree.addCell(XY(xy[0], xy[1]));
+    }
+
+    for (int i = 0; i < 30; i++) {
+        hashlife.update();
+        quadtree.update();
+        ASSERT_EQ(sortedCells(hashlife), sortedCells(quadtree));
+    }
+
+    // 2^7 generations in a single call
+    hashlife.step(7);
+    for (int i = 0; i < 128; i++) {
+        quadtree.update();
+    }
+    EXPECT_EQ(sortedCells(hashlife), sortedCells(quadtree));
+
+    AABB box(XY(0, 0), -10, 40, -10, 10);
+    std::vector<XY> a, b;
+    hashlife.query(box, a);
+    quadtree.query(box, b);
+    EXPECT_EQ(a.size(), b.size());
+}
+
+TEST(HashLife, LongRun) {
+    HashLifeEngine engine;
+    for (auto& xy : kGosperGun) {
+        engine.addCell(XY(xy[0], xy[1]));
+    }
+    // The gun emits a 5-cell glider every 30 generations
+    engine.step(20);
+    EXPECT_GT(engine.cellCount(), (size_t)150000);
+    EXPECT_LT(engine.nodeCount(), (size_t)1000000);
+
+    engine.garbageCollect();
+    EXPECT_TRUE(engine.getCell(XY(0, 0)));
+}
+
+TEST(HashLife, Macrocell) {
+    // Golly's glider, one leaf in the nw quadrant of a 16x16 root
+    std::istringstream glider("[M2] (golly 4.2)\n#R B3/S23\n.*$..*$***$\n4 1 0 0 0\n");
+    HashLifeEngine engine;
+    engine.readMacrocell(glider);
+    std::vector<std::pair<Coord, Coord>> expected = {{-8, -6}, {-7, -8}, {-7, -6}, {-6, -7}, {-6, -6}};
+    EXPECT_EQ(sortedCells(engine), expected);
+
+    HashLifeEngine edges;
+    for (auto& xy : {XY(MAX, MAX), XY(MIN, MIN), XY(0, 0), XY(-1, 5), XY(MIN, 42)}) {
+        edges.addCell(xy);
+    }
+    std::stringstream file;
+    edges.writeMacrocell(file);
+    HashLifeEngine loaded;
+    loaded.addCell(XY(3, 3));
+    loaded.readMacrocell(file);
+    EXPECT_EQ(sortedCells(loaded), sortedCells(edges));
+
+    // Far more cells than distinct subtrees
+    HashLifeEngine gun;
+    for (auto& xy : kGosperGun) {
+        gun.addCell(XY(xy[0], xy[1]));
+    }
+    gun.step(20);
+    std::stringstream gunFile;
+    gun.writeMacrocell(gunFile);
+    size_t lines = std::count(std::istreambuf_iterator<char>(gunFile), std::istreambuf_iterator<char>(), '\n');
+    EXPECT_LT(lines, (size_t)2000);
+    gunFile.clear();
+    gunFile.seekg(0);
+    HashLifeEngine gunLoaded;
+    gunLoaded.readMacrocell(gunFile);
+    EXPECT_EQ(gunLoaded.cellCount(), gun.cellCount());
+    gunLoaded.step(4);
+    gun.step(4);
+    EXPECT_EQ(gunLoaded.cellCount(), gun.cellCount());
+
+    std::istringstream notMacrocell("x = 3, y = 3\nbo$2bo$3o!\n");
+    EXPECT_THROW(engine.readMacrocell(notMacrocell), std::runtime_error);
+    std::istringstream forward("[M2]\n4 2 0 0 0\n");
+    EXPECT_THROW(engine.readMacrocell(forward), std::runtime_error);
+    std::istringstream wideLeaf("[M2]\n.........*$\n");
+    EXPECT_THROW(engine.readMacrocell(wideLeaf), std::runtime_error);
+}
+
+TEST(Rule, Parse) {
+    Rule rule = kConwayRule;
+    EXPECT_TRUE(ParseRule("B36/S23", rule));
+    EXPECT_EQ(rule, kHighLifeRule);
+    EXPECT_TRUE(ParseRule("b3678/s34678", rule));
+    EXPECT_EQ(rule, kDayAndNightRule);
+    EXPECT_TRUE(ParseRule("23/3", rule));
+    EXPECT_EQ(rule, kConwayRule);
+    EXPECT_TRUE(ParseRule("S/B2", rule));
+    EXPECT_EQ(rule, kSeedsRule);
+    EXPECT_EQ(kHighLifeRule.toString(), "B36/S23");
+    EXPECT_EQ(kSeedsRule.toString(), "B2/S");
+
+    EXPECT_TRUE(ParseRule("B2/S/C3", rule));
+    EXPECT_EQ(rule, kBriansBrainRule);
+    EXPECT_TRUE(ParseRule("345/2/4", rule));
+    EXPECT_EQ(rule, kStarWarsRule);
+    EXPECT_EQ(kStarWarsRule.toString(), "B2/S345/C4");
+    EXPECT_TRUE(ParseRule("B2/S", rule));
+
+    for (const char* broken : {"B3S23", "B39/S23", "B0/S23", "X3/S23", "", "B2/S/C10", "B2/S/Cx", "B2/S/"}) {
+        EXPECT_FALSE(ParseRule(broken, rule)) << broken;
+    }
+    EXPECT_EQ(rule, kSeedsRule);
+
+    // Table and compile-time kernels agree on every state
+    StaticRule<kDayAndNightRule.birth, kDayAndNightRule.survival> fixed;
+    RuleTable table(kDayAndNightRule);
+    for (uint32_t state = 0; state < 18; state++) {
+        bool alive = state & 1;
+        uint32_t neighbors = state >> 1;
+        bool expected = ((alive ? kDayAndNightRule.survival : kDayAndNightRule.birth) >> neighbors) & 1;
+        EXPECT_EQ(fixed.next(state), expected);
+        EXPECT_EQ(table.next(state), expected);
+    }
+}
+
+// Brute force generation under rule, for comparing engines against
+static std::set<std::pair<Coord, Coord>> nextGeneration(const std::set<std::pair<Coord, Coord>>& cells,
+                                                        const Rule& rule) {
+    std::map<std::pair<Coord, Coord>, int> counts;
+    for (auto& cell : cells) {
+        for (Coord dy = -1; dy <= 1; dy++) {
+            for (Coord dx = -1; dx <= 1; dx++) {
+                if (dx || dy) {
+                    counts[std::make_pair(cell.first + dx, cell.second + dy)]++;
+                }
+            }
+        }
+    }
+    std::set<std::pair<Coord, Coord>> result;
+    for (auto& count : counts) {
+        bool alive = cells.count(count.first) > 0;
+        if (((alive ? rule.survival : rule.birth) >> count.second) & 1) {
+            result.insert(count.first);
+        }
+    }
+    return result;
+}
+
+TEST(Rule, Engines) {
+    Rule b36s125 = kConwayRule;
+    ASSERT_TRUE(ParseRule("B36/S125", b36s125));
+    std::mt19937 rng(7);
+    std::set<std::pair<Coord, Coord>> soup;
+    for (Coord y = 0; y < 24; y++) {
+        for (Coord x = 0; x < 24; x++) {
+            if (rng() % 3 == 0) {
+                // Across tile and block borders
+                soup.insert(std::make_pair(x + 52, y - 12));
+            }
+        }
+    }
+
+    for (const Rule& rule : {kHighLifeRule, kDayAndNightRule, kSeedsRule, b36s125}) {
+        std::set<std::pair<Coord, Coord>> expected = soup;
+        for (int i = 0; i < 12; i++) {
+            expected = nextGeneration(expected, rule);
+        }
+        std::vector<std::pair<Coord, Coord>> expectedCells(expected.begin(), expected.end());
+
+        for (EngineKind kind : {EngineKind::QuadTree, EngineKind::HashLife, EngineKind::Tile, EngineKind::Morton}) {
+            LifeEngineUniq engine = CreateEngine(kind);
+            engine->setRule(rule);
+            for (auto& cell : soup) {
+                engine->addCell(XY(cell.first, cell.second));
+            }
+            for (int i = 0; i < 12; i++) {
+                engine->update();
+            }
+            EXPECT_EQ(sortedCells(*engine), expectedCells) << rule.toString() << " engine " << (int)kind;
+        }
+    }
+
+    // Switching back drops HashLife's results for the old rule
+    HashLifeEngine hashlife;
+    for (auto& xy : kGosperGun) {
+        hashlife.addCell(XY(xy[0], xy[1]));
+    }
+    hashlife.setRule(kHighLifeRule);
+    hashlife.step(4);
+    hashlife.setRule(kConwayRule);
+    CellTreeEngine quadtree;
+    std::vector<XY> cells;
+    hashlife.query(AABB(XY(0, 0), MIN, MAX, MIN, MAX), cells);
+    quadtree.addCells(cells);
+    hashlife.step(6);
+    for (int i = 0; i < 64; i++) {
+        quadtree.update();
+    }
+    EXPECT_EQ(sortedCells(hashlife), sortedCells(quadtree));
+}
+
+TEST(Rule, QuadTreeRuleChange) {
+    // A block and a blinker settle under B3/S23, then both change under
+    // B36/S125: the block's cells have 3 neighbors, the blinker's ends 1
+    Rule b36s125 = kConwayRule;
+    ASSERT_TRUE(ParseRule("B36/S125", b36s125));
+    std::set<std::pair<Coord, Coord>> expected = {
+        {0, 0}, {1, 0}, {0, 1}, {1, 1},
+        {40, 20}, {41, 20}, {42, 20}
+    };
+    CellTreeEngine engine;
+    for (auto& cell : expected) {
+        engine.addCell(XY(cell.first, cell.second));
+    }
+    for (int i = 0; i < 8; i++) {
+        engine.update();
+        expected = nextGeneration(expected, kConwayRule);
+    }
+    engine.setRule(b36s125);
+    for (int i = 0; i < 6; i++) {
+        engine.update();
+        expected = nextGeneration(expected, b36s125);
+        std::vector<std::pair<Coord, Coord>> expectedCells(expected.begin(), expected.end());
+        EXPECT_EQ(sortedCells(engine), expectedCells) << "generation " << i;
+    }
+}
+
+// Brute force Generations step over cell -> state (1 live, 2.. decaying)
+static std::map<std::pair<Coord, Coord>, int> nextStates(const std::map<std::pair<Coord, Coord>, int>& cells,
+                                                         const Rule& rule) {
+    std::map<std::pair<Coord, Coord>, int> counts;
+    for (auto& cell : cells) {
+        if (cell.second != 1) {
+            continue;
+        }
+        for (Coord dy = -1; dy <= 1; dy++) {
+            for (Coord dx = -1; dx <= 1; dx++) {
+                if (dx || dy) {
+                    counts[std::make_pair(cell.first.first + dx, cell.first.second + dy)]++;
+                }
+            }
+        }
+    }
+    std::map<std::pair<Coord, Coord>, int> result;
+    for (auto& cell : cells) {
+        if (cell.second == 1) {
+            int count = counts.count(cell.first) ? counts[cell.first] : 0;
+            result[cell.first] = ((rule.survival >> count) & 1) ? 1 : 2;
+        } else if (cell.second + 1 < rule.states) {
+            result[cell.first] = cell.second + 1;
+        }
+    }
+    for (auto& count : counts) {
+        if (!cells.count(count.first) && ((rule.birth >> count.second) & 1)) {
+            result[count.first] = 1;
+        }
+    }
+    // States past the last decay stage are dead
+    for (auto it = result.begin(); it != result.end();) {
+        it = it->second >= rule.states ? result.erase(it) : std::next(it);
+    }
+    return result;
+}
+
+TEST(Rule, Generations) {
+    std::mt19937 rng(11);
+    std::vector<XY> soup;
+    for (Coord y = 0; y < 20; y++) {
+        for (Coord x = 0; x < 20; x++) {
+            if (rng() % 3 == 0) {
+                soup.emplace_back(x - 10, y + 30);
+            }
+        }
+    }
+
+    for (const Rule& rule : {kBriansBrainRule, kStarWarsRule}) {
+        std::map<std::pair<Coord, Coord>, int> expected;
+        for (auto& xy : soup) {
+            expected[std::make_pair(xy.x, xy.y)] = 1;
+        }
+        CellTreeEngine engine;
+        engine.setRule(rule);
+        engine.addCells(soup);
+        for (int i = 0; i < 25; i++) {
+            expected = nextStates(expected, rule);
+            engine.update();
+
+            std::map<std::pair<Coord, Coord>, int> actual;
+            std::vector<XY> live;
+            engine.query(AABB(XY(0, 0), MIN, MAX, MIN, MAX), live);
+            for (auto& xy : live) {
+                actual[std::make_pair(xy.x, xy.y)] = 1;
+            }
+            std::vector<XY> decaying;
+            std::vector<uint8_t> stages;
+            engine.queryDecaying(AABB(XY(0, 0), MIN, MAX, MIN, MAX), decaying, stages);
+            ASSERT_EQ(decaying.size(), stages.size());
+            for (size_t j = 0; j < decaying.size(); j++) {
+                actual[std::make_pair(decaying[j].x, decaying[j].y)] = 1 + stages[j];
+            }
+            ASSERT_EQ(actual, expected) << rule.toString() << " generation " << i + 1;
+            EXPECT_EQ(engine.cellCount(), expected.size());
+            EXPECT_TRUE(populationsConsistent(engine.m_celltree.get()));
+
+            // Zoomed out, only the live cells count, also for whole
+            // subtrees inside one square
+            for (unsigned shift : {2u, 7u}) {
+                DensityGrid density;
+                density.reset(XY(-128, -128), shift, 256 >> shift, 256 >> shift);
+                engine.queryDensity(density);
+                DensityGrid expectedDensity;
+                expectedDensity.reset(XY(-128, -128), shift, 256 >> shift, 256 >> shift);
+                for (auto& xy : live) {
+                    expectedDensity.addCell(xy);
+                }
+                EXPECT_EQ(density.counts, expectedDensity.counts) << rule.toString() << " shift " << shift;
+            }
+        }
+    }
+
+    // Only the quadtree keeps decay stages
+    TileEngine tiles;
+    EXPECT_THROW(tiles.setRule(kBriansBrainRule), std::runtime_error);
+    EXPECT_EQ(tiles.rule(), kConwayRule);
+    HashLifeEngine hashlife;
+    EXPECT_THROW(hashlife.setRule(kStarWarsRule), std::runtime_error);
+
+    // Each stage has its own color, fading out
+    constexpr int kSize = 40;
+    std::vector<uint8_t> pixels(kSize * kSize * 4);
+    SDL_Surface surface = {};
+    surface.pixels = pixels.data();
+    CellMap map(&surface, kSize, kSize, 1, -1);
+    auto red = [&](Coord x, Coord y) {
+        return pixels[((y + kSize / 2) * kSize + x + kSize / 2) * 4];
+    };
+    map.draw({XY(0, 0)}, {XY(1, 0), XY(2, 0)}, {1, 2});
+    EXPECT_EQ(red(0, 0), kOnColor.r);
+    EXPECT_GT(red(1, 0), red(2, 0));
+    EXPECT_GT(red(2, 0), 0);
+    map.draw({XY(1, 0)}, {XY(2, 0)}, {3});
+    EXPECT_EQ(red(0, 0), 0);
+    EXPECT_EQ(red(1, 0), kOnColor.r);
+    EXPECT_GT(red(2, 0), 0);
+    EXPECT_FALSE(map.dirtyRects().empty());
+    map.draw({XY(1, 0)});
+    EXPECT_EQ(red(2, 0), 0);
+}
+
+TEST(TileMap, Update) {
+    for (bool simd : {false, true}) {
+        TileEngine engine(simd);
+        engine.addCell(XY(0, 0));
+        engine.addCell(XY(100, 100));
+        engine.addCell(XY(200, 200));
+        engine.addCell(XY(202, 202));
+        engine.addCell(XY(204, 204));
+        EXPECT_EQ(engine.cellCount(), 5);
+        EXPECT_EQ(engine.tileCount(), 3);
+
+        engine.update();
+
+        EXPECT_EQ(engine.cellCount(), 0);
+        EXPECT_EQ(engine.tileCount(), 0);
+
+        engine.update();
+
+        EXPECT_EQ(engine.cellCount(), 0);
+
+        // Both L-trominoes become blocks, one of them across the plane corner
+        Coord MAX_M1 = MAX - 1;
+        Coord MIN_P1 = MIN + 1;
+        engine.addCell(XY(MAX_M1, MIN_P1));
+        engine.addCell(XY(MAX, MIN_P1));
+        engine.addCell(XY(MAX, MIN));
+        engine.addCell(XY(0, 0));
+        engine.addCell(XY(1, 0));
+        engine.addCell(XY(1, 1));
+
+        engine.update();
+
+        EXPECT_EQ(engine.cellCount(), 8);
+        EXPECT_TRUE(engine.getCell(XY(MAX_M1, MIN)));
+        EXPECT_TRUE(engine.getCell(XY(0, 1)));
+
+        engine.update();
+        EXPECT_EQ(engine.cellCount(), 8);
+    }
+}
+
+TEST(TileMap, Oscillator) {
+    for (bool simd : {false, true}) {
+        TileEngine engine(simd);
+        // Straddles the tile boundary at x = 0
+        engine.addCell(XY(-1, 0));
+        engine.addCell(XY(0, 0));
+        engine.addCell(XY(1, 0));
+
+        engine.update();
+
+        EXPECT_TRUE(engine.getCell(XY(0, 1)));
+        EXPECT_TRUE(engine.getCell(XY(0, 0)));
+        EXPECT_TRUE(engine.getCell(XY(0, -1)));
+        EXPECT_FALSE(engine.getCell(XY(-1, 0)));
+        EXPECT_EQ(engine.cellCount(), 3);
+    }
+}
+
+TEST(TileMap, MatchesQuadTree) {
+    for (bool simd : {false, true}) {
+        TileEngine tiles(simd);
+        CellTreeEngine quadtree;
+        // The gun sits across tile corners and its gliders cross tiles
+        for (auto& xy : kGosperGun) {
+            tiles.addCell(XY(xy[0] - 20, xy[1] + 60));
+            quadtree.addCell(XY(xy[0] - 20, xy[1] + 60));
+        }
+
+        for (int i = 0; i < 300; i++) {
+            tiles.update();
+            quadtree.update();
+        }
+        EXPECT_EQ(sortedCells(tiles), sortedCells(quadtree));
+    }
+}
+
+TEST(ThreadPool, ParallelFor) {
+    ThreadPool pool(4);
+    EXPECT_EQ(pool.threadCount(), 4);
+
+    std::vector<int> hits(10007, 0);
+    for (int round = 0; round < 3; round++) {
+        pool.parallelFor(hits.size(), 64, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                hits[i]++;
+            }
+        });
+    }
+    EXPECT_EQ(std::count(hits.begin(), hits.end(), 3), (long)hits.size());
+
+    EXPECT_THROW(pool.parallelFor(100, 1, [](size_t begin, size_t) {
+        if (begin == 50) {
+            throw std::runtime_error("chunk failed");
+        }
+    }), std::runtime_error);
+}
+
+TEST(TileMap, Parallel) {
+    TileEngine serial;
+    TileEngine parallel;
+    parallel.setThreadCount(4);
+    EXPECT_EQ(parallel.threadCount(), 4);
+
+    std::mt19937_64 rng(42);
+    for (int i = 0; i < 20000; i++) {
+        XY xy((Coord)(rng() % 512) - 256, (Coord)(rng() % 512) - 256);
+        serial.addCell(xy);
+        parallel.addCell(xy);
+    }
+
+    for (int i = 0; i < 50; i++) {
+        serial.update();
+        parallel.update();
+    }
+    EXPECT_EQ(sortedCells(serial), sortedCells(parallel));
+}
+
+TEST(LtlMap, Parse) {
+    LtlRule rule;
+    ASSERT_TRUE(ParseLtlRule("R5,C0,M1,S34..58,B34..45,NM", rule));
+    EXPECT_TRUE(rule == kBoscoRule);
+    EXPECT_EQ(rule.toString(), "R5,C0,M1,S34..58,B34..45,NM");
+    ASSERT_TRUE(ParseLtlRule("r1,c2,m0,s2..3,b3..3", rule));
+    EXPECT_TRUE(rule == LtlRule());
+    ASSERT_TRUE(ParseLtlRule("R2,B4..6,S", rule));
+    EXPECT_EQ(rule.toString(), "R2,C0,M0,S,B4..6,NM");
+
+    EXPECT_FALSE(ParseLtlRule("B3/S23", rule));
+    EXPECT_FALSE(ParseLtlRule("S2..3,B3..3", rule));
+    EXPECT_FALSE(ParseLtlRule("R11,C0,M0,S2..3,B3..3,NM", rule));
+    EXPECT_FALSE(ParseLtlRule("R1,C3,M0,S2..3,B3..3,NM", rule));
+    EXPECT_FALSE(ParseLtlRule("R1,C0,M0,S2..3,B3..3,NN", rule));
+    EXPECT_FALSE(ParseLtlRule("R1,C0,M0,S2..3,B0..3,NM", rule));
+    EXPECT_FALSE(ParseLtlRule("R1,C0,M0,S2..10,B3..3,NM", rule));
+    EXPECT_FALSE(ParseLtlRule("R1,C0,M0,S3..2,B3..3,NM", rule));
+
+    EngineKind kind;
+    ASSERT_TRUE(ParseEngineKind("ltl", kind));
+    EXPECT_EQ(kind, EngineKind::LargerThanLife);
+    EXPECT_NE(dynamic_cast<LtlEngine*>(CreateEngine(kind).get()), nullptr);
+
+    // B/S rules map onto range 1 when their counts are ranges
+    LtlEngine engine;
+    engine.setRule(kSeedsRule);
+    EXPECT_EQ(engine.ltlRule().toString(), "R1,C0,M0,S,B2..2,NM");
+    EXPECT_THROW(engine.setRule(kHighLifeRule), std::runtime_error);
+    EXPECT_THROW(engine.setRule(kBriansBrainRule), std::runtime_error);
+    ASSERT_TRUE(ParseLtlRule("R1,C0,M1,S3..4,B3..3,NM", rule));
+    engine.setLtlRule(rule);
+    EXPECT_EQ(engine.rule(), kConwayRule);
+    // Longer ranges have no B/S rule to report
+    engine.setLtlRule(kBoscoRule);
+    EXPECT_THROW(engine.rule(), std::runtime_error);
+    engine.setRule(kSeedsRule);
+    EXPECT_EQ(engine.rule(), kSeedsRule);
+}
+
+// Brute force generation under a Larger than Life rule
+static std::set<std::pair<Coord, Coord>> nextLtlGeneration(const std::set<std::pair<Coord, Coord>>& cells,
+                                                           const LtlRule& rule) {
+    std::map<std::pair<Coord, Coord>, int> counts;
+    for (auto& cell : cells) {
+        for (Coord dy = -rule.range; dy <= rule.range; dy++) {
+            for (Coord dx = -rule.range; dx <= rule.range; dx++) {
+                if (dx || dy || rule.middle) {
+                    counts[std::make_pair(cell.first + dx, cell.second + dy)]++;
+                }
+            }
+        }
+    }
+    std::set<std::pair<Coord, Coord>> result;
+    for (auto& count : counts) {
+        bool alive = cells.count(count.first) > 0;
+        if (alive ? count.second >= rule.survivalMin && count.second <= rule.survivalMax
+                  : count.second >= rule.birthMin && count.second <= rule.birthMax) {
+            result.insert(count.first);
+        }
+    }
+    return result;
+}
+
+TEST(LtlMap, MatchesBruteForce) {
+    LtlRule r2;
+    ASSERT_TRUE(ParseLtlRule("R2,C0,M0,S6..11,B8..10,NM", r2));
+    std::mt19937 rng(11);
+    std::set<std::pair<Coord, Coord>> soup;
+    for (Coord y = 0; y < 40; y++) {
+        for (Coord x = 0; x < 40; x++) {
+            if (rng() % 2 == 0) {
+                // Across tile corners
+                soup.insert(std::make_pair(x - 20, y + 44));
+            }
+        }
+    }
+
+    for (const LtlRule& rule : {kBoscoRule, r2}) {
+        std::set<std::pair<Coord, Coord>> expected = soup;
+        LtlEngine engine;
+        engine.setThreadCount(2);
+        engine.setLtlRule(rule);
+        for (auto& cell : soup) {
+            engine.addCell(XY(cell.first, cell.second));
+        }
+        for (int i = 0; i < 10; i++) {
+            expected = nextLtlGeneration(expected, rule);
+            engine.update();
+        }
+        std::vector<std::pair<Coord, Coord>> expectedCells(expected.begin(), expected.end());
+        EXPECT_EQ(sortedCells(engine), expectedCells) << rule.toString();
+        EXPECT_FALSE(expected.empty());
+    }
+
+    // Range 1 runs Conway's rule like the quadtree
+    LtlEngine ltl;
+    CellTreeEngine quadtree;
+    for (auto& xy : kGosperGun) {
+        ltl.addCell(XY(xy[0], xy[1]));
+        quadtree.addCell(XY(xy[0], xy[1]));
+    }
+    for (int i = 0; i < 200; i++) {
+        ltl.update();
+        quadtree.update();
+    }
+    EXPECT_EQ(sortedCells(ltl), sortedCells(quadtree));
+}
+
+TEST(Isotropic, Parse) {
+    IsotropicRule rule;
+    ASSERT_TRUE(ParseIsotropicRule("B3/S23", rule));
+    for (unsigned neighborhood = 0; neighborhood < kNeighborhoods; neighborhood++) {
+        bool alive = (neighborhood >> 4) & 1;
+        int neighbors = popcount64(neighborhood) - alive;
+        bool expected = ((alive ? kConwayRule.survival : kConwayRule.birth) >> neighbors) & 1;
+        EXPECT_EQ(rule.next(neighborhood), expected) << neighborhood;
+    }
+
+    // The letters of a count split its arrangements without overlap
+    const char* letters[] = {"", "ce", "cekain", "cekainyqjr", "cekainyqjrtwz", "cekainyqjr", "cekain", "ce"};
+    for (int count = 1; count <= 7; count++) {
+        int total = 0;
+        for (const char* letter = letters[count]; *letter; letter++) {
+            std::string text = "B" + std::to_string(count) + *letter + "/S";
+            ASSERT_TRUE(ParseIsotropicRule(text, rule)) << text;
+            for (uint64_t word : rule.table) {
+                total += popcount64(word);
+            }
+        }
+        int expected = 1;
+        for (int i = 0; i < count; i++) {
+            expected = expected * (8 - i) / (i + 1);
+        }
+        EXPECT_EQ(total, expected) << count;
+    }
+
+    // NW and N are 2a, NW and NE are 2c
+    ASSERT_TRUE(ParseIsotropicRule("s12/b2-a", rule));
+    EXPECT_EQ(rule.toString(), "B2-a/S12");
+    EXPECT_FALSE(rule.next(0b000000011));
+    EXPECT_TRUE(rule.next(0b000000101));
+    EXPECT_TRUE(rule.next(0b000010001));
+    ASSERT_TRUE(ParseIsotropicRule("B2a/S", rule));
+    EXPECT_TRUE(rule.next(0b000000011));
+    EXPECT_TRUE(rule.next(0b110000000));
+    EXPECT_FALSE(rule.next(0b000000101));
+
+    EXPECT_FALSE(ParseIsotropicRule("B2x/S23", rule));
+    EXPECT_FALSE(ParseIsotropicRule("B1k/S23", rule));
+    EXPECT_FALSE(ParseIsotropicRule("B8c/S23", rule));
+    EXPECT_FALSE(ParseIsotropicRule("B2-/S23", rule));
+    EXPECT_FALSE(ParseIsotropicRule("B9/S23", rule));
+    EXPECT_FALSE(ParseIsotropicRule("B0/S23", rule));
+    EXPECT_FALSE(ParseIsotropicRule("23/3", rule));
+}
+
+TEST(Isotropic, TileEngine) {
+    std::mt19937 rng(5);
+    std::set<std::pair<Coord, Coord>> soup;
+    for (Coord y = 0; y < 30; y++) {
+        for (Coord x = 0; x < 30; x++) {
+            if (rng() % 3 == 0) {
+                soup.insert(std::make_pair(x - 15, y + 50));
+            }
+        }
+    }
+
+    for (const char* text : {"B2-a/S12", "B2ei3cjkr4cektyz5-cnq6-a7c/S1c2-ai3aeijnqy4aeijkqtw5-aeiq6ace7e",
+                             "B34ak5-y/S2-c3-a4"}) {
+        IsotropicRule rule;
+        ASSERT_TRUE(ParseIsotropicRule(text, rule));
+        IsotropicKernel kernel(rule);
+        EXPECT_LE(kernel.size(), kMaxIsotropicOps);
+
+        std::set<std::pair<Coord, Coord>> expected = soup;
+        TileEngine engine;
+        engine.setIsotropicRule(rule);
+        ASSERT_NE(engine.isotropicRule(), nullptr);
+        for (auto& cell : soup) {
+            engine.addCell(XY(cell.first, cell.second));
+        }
+        for (int i = 0; i < 12; i++) {
+            // Brute force over the 3x3 neighborhoods around live cells
+            std::set<std::pair<Coord, Coord>> next;
+            for (auto& cell : expected) {
+                for (Coord y = cell.second - 1; y <= cell.second + 1; y++) {
+                    for (Coord x = cell.first - 1; x <= cell.first + 1; x++) {
+                        unsigned neighborhood = 0;
+                        for (int dy = 0; dy < 3; dy++) {
+                            for (int dx = 0; dx < 3; dx++) {
+                                if (expected.count(std::make_pair(x + dx - 1, y + dy - 1))) {
+                                    neighborhood |= 1u << (3 * dy + dx);
+                                }
+                            }
+                        }
+                        if (rule.next(neighborhood)) {
+                            next.insert(std::make_pair(x, y));
+                        }
+                    }
+                }
+            }
+            expected.swap(next);
+            engine.update();
+        }
+        std::vector<std::pair<Coord, Coord>> expectedCells(expected.begin(), expected.end());
+        EXPECT_EQ(sortedCells(engine), expectedCells) << text;
+        EXPECT_FALSE(expected.empty()) << text;
+    }
+
+    // An isotropic rule has no B/S form to report, a B/S rule drops it
+    TileEngine engine;
+    IsotropicRule rule;
+    ASSERT_TRUE(ParseIsotropicRule("B2-a/S12", rule));
+    engine.setIsotropicRule(rule);
+    EXPECT_THROW(engine.rule(), std::runtime_error);
+    engine.setRule(kHighLifeRule);
+    EXPECT_EQ(engine.isotropicRule(), nullptr);
+    EXPECT_EQ(engine.rule(), kHighLifeRule);
+
+    // The ltl engine would ignore one, so it refuses it
+    LtlEngine ltl;
+    ltl.setLtlRule(kBoscoRule);
+    EXPECT_THROW(ltl.setIsotropicRule(rule), std::runtime_error);
+    EXPECT_EQ(ltl.isotropicRule(), nullptr);
+    EXPECT_EQ(ltl.ltlRule(), kBoscoRule);
+}
+
+// nextGeneration in a width x height universe with its top left cell at
+// (left, top): a torus sees a copy of itself on every side, of which only
+// the cells next to its edges matter, a bounded universe drops what grows
+// past its edges
+static std::set<std::pair<Coord, Coord>> nextGridGeneration(const std::set<std::pair<Coord, Coord>>& cells,
+                                                            const Rule& rule, Coord left, Coord top,
+                                                            Coord width, Coord height, bool torus) {
+    std::set<std::pair<Coord, Coord>> tiled;
+    for (auto& cell : cells) {
+        for (Coord dy = -1; dy <= 1; dy++) {
+            for (Coord dx = -1; dx <= 1; dx++) {
+                Coord x = cell.first + dx * width;
+                Coord y = cell.second + dy * height;
+                if ((torus || (!dx && !dy)) && x >= left - 1 && x <= left + width && y >= top - 1 &&
+                    y <= top + height) {
+                    tiled.insert(std::make_pair(x, y));
+                }
+            }
+        }
+    }
+    std::set<std::pair<Coord, Coord>> result;
+    for (auto& cell : nextGeneration(tiled, rule)) {
+        if (cell.first >= left && cell.first < left + width && cell.second >= top && cell.second < top + height) {
+            result.insert(cell);
+        }
+    }
+    return result;
+}
+
+TEST(GridMap, MatchesBruteForce) {
+    Coord width, height;
+    EXPECT_TRUE(ParseGridSize("300x200", width, height));
+    EXPECT_EQ(width, 300);
+    EXPECT_EQ(height, 200);
+    EXPECT_FALSE(ParseGridSize("300", width, height));
+    EXPECT_FALSE(ParseGridSize("0x10", width, height));
+    EXPECT_FALSE(ParseGridSize("10x-1", width, height));
+    EXPECT_FALSE(ParseGridSize("99999999x10", width, height));
+
+    // Sides that fill whole words, end mid-word and fit in one word, with
+    // and without AVX2 and threads, under B3/S23, a constant rule and one
+    // going through the lookup table
+    Rule b36s125 = kConwayRule;
+    ASSERT_TRUE(ParseRule("B36/S125", b36s125));
+    const Coord sizes[][2] = {{128, 64}, {300, 37}, {45, 1}, {1, 20}};
+    for (const Rule& rule : {kConwayRule, kDayAndNightRule, b36s125}) {
+        for (auto& size : sizes) {
+            for (bool torus : {true, false}) {
+                Coord left = -(size[0] / 2), top = -(size[1] / 2);
+                std::mt19937 rng((unsigned)(size[0] * 7 + size[1]));
+                std::set<std::pair<Coord, Coord>> soup;
+                for (Coord y = 0; y < size[1]; y++) {
+                    for (Coord x = 0; x < size[0]; x++) {
+                        if (rng() % 3 == 0) {
+                            soup.insert(std::make_pair(x + left, y + top));
+                        }
+                    }
+                }
+                GridEngine simd(size[0], size[1], torus);
+                GridEngine scalar(size[0], size[1], torus, false);
+                scalar.setThreadCount(3);
+                simd.setRule(rule);
+                scalar.setRule(rule);
+                for (auto& cell : soup) {
+                    simd.addCell(XY(cell.first, cell.second));
+                    scalar.addCell(XY(cell.first, cell.second));
+                }
+                // Outside cells wrap in on a torus and are dropped otherwise
+                simd.addCell(XY(left + size[0], top));
+                scalar.addCell(XY(left + size[0], top));
+                EXPECT_EQ(simd.getCell(XY(left, top)), torus || soup.count(std::make_pair(left, top)) > 0);
+
+                std::set<std::pair<Coord, Coord>> expected;
+                std::vector<std::pair<Coord, Coord>> start = sortedCells(simd);
+                expected.insert(start.begin(), start.end());
+                for (int i = 0; i < 20; i++) {
+                    expected = nextGridGeneration(expected, rule, left, top, size[0], size[1], torus);
+                    simd.update();
+                    scalar.update();
+                }
+                std::vector<std::pair<Coord, Coord>> expectedCells(expected.begin(), expected.end());
+                EXPECT_EQ(sortedCells(simd), expectedCells)
+                    << rule.toString() << " " << size[0] << "x" << size[1] << " torus " << torus;
+                EXPECT_EQ(sortedCells(scalar), expectedCells)
+                    << rule.toString() << " " << size[0] << "x" << size[1] << " torus " << torus;
+                EXPECT_EQ(simd.cellCount(), expected.size());
+            }
+        }
+    }
+}
+
+TEST(GridMap, Torus) {
+    // A glider crosses every edge and comes back after 4 * lcm(100, 70)
+    // generations
+    const Coord glider[][2] = {{1, 0}, {2, 1}, {0, 2}, {1, 2}, {2, 2}};
+    GridEngine torus(100, 70, true);
+    GridEngine bounded(100, 70, false);
+    for (auto& xy : glider) {
+        torus.addCell(XY(xy[0], xy[1]));
+        bounded.addCell(XY(xy[0], xy[1]));
+    }
+    std::vector<std::pair<Coord, Coord>> start = sortedCells(torus);
+    for (int i = 0; i < 4 * 700; i++) {
+        torus.update();
+        bounded.update();
+        ASSERT_EQ(torus.cellCount(), 5u) << i;
+    }
+    EXPECT_EQ(sortedCells(torus), start);
+    // It turns into a block at a dead edge
+    EXPECT_EQ(bounded.cellCount(), 4u);
+
+    // B36/S23 through the same grid
+    GridEngine highLife(64, 64, true);
+    TileEngine tile;
+    highLife.setRule(kHighLifeRule);
+    tile.setRule(kHighLifeRule);
+    for (auto& xy : kGosperGun) {
+        highLife.addCell(XY(xy[0] - 18, xy[1] - 5));
+        tile.addCell(XY(xy[0] - 18, xy[1] - 5));
+    }
+    for (int i = 0; i < 10; i++) {
+        highLife.update();
+        tile.update();
+    }
+    EXPECT_EQ(sortedCells(highLife), sortedCells(tile));
+}
+
+TEST(MortonMap, MatchesQuadTree) {
+    MortonEngine morton;
+    CellTreeEngine quadtree;
+    for (auto& xy : kGosperGun) {
+        morton.addCell(XY(xy[0] - 20, xy[1] + 60));
+        quadtree.addCell(XY(xy[0] - 20, xy[1] + 60));
+    }
+    // A blinker across the corner where MAX wraps to MIN
+    XY blinker[3] = {XY(MAX, MIN), XY(MIN, MIN), XY(MIN + 1, MIN)};
+    for (auto& xy : blinker) {
+        morton.addCell(xy);
+        quadtree.addCell(xy);
+    }
+
+    for (int i = 0; i < 300; i++) {
+        morton.update();
+        quadtree.update();
+        EXPECT_EQ(morton.cellCount(), quadtree.cellCount());
+    }
+    EXPECT_EQ(sortedCells(morton), sortedCells(quadtree));
+    EXPECT_TRUE(morton.getCell(XY(MAX, MIN)));
+    EXPECT_FALSE(morton.getCell(XY(MIN, MAX)));
+    EXPECT_TRUE(std::is_sorted(morton.keys().begin(), morton.keys().end()));
+}
+
+TEST(MortonMap, Query) {
+    MortonEngine morton;
+    std::vector<XY> cells;
+    std::mt19937_64 rng(7);
+    for (int i = 0; i < 5000; i++) {
+        XY xy((Coord)(rng() % 300) - 150, (Coord)(rng() % 300) - 150);
+        morton.addCell(xy);
+        cells.push_back(xy);
+    }
+
+    for (int i = 0; i < 50; i++) {
+        Coord left = (Coord)(rng() % 400) - 200;
+        Coord top = (Coord)(rng() % 400) - 200;
+        AABB box(XY(0, 0), left, left + (Coord)(rng() % 100), top, top + (Coord)(rng() % 100));
+
+        std::vector<XY> expected;
+        for (auto& xy : cells) {
+            if (box.contains(xy)) {
+                expected.push_back(xy);
+            }
+        }
+        std::sort(expected.begin(), expected.end(), [](const XY& a, const XY& b) {
+            return a.x < b.x || (a.x == b.x && a.y < b.y);
+        });
+        expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+
+        std::vector<XY> found;
+        morton.query(box, found);
+        std::sort(found.begin(), found.end(), [](const XY& a, const XY& b) {
+            return a.x < b.x || (a.x == b.x && a.y < b.y);
+        });
+        EXPECT_EQ(found, expected);
+    }
+}
+
+TEST(CellTree, ActiveRegions) {
+    CellTreeEngine quadtree;
+    MortonEngine reference;
+    std::vector<XY> cells;
+    for (auto& xy : kGosperGun) {
+        cells.push_back(XY(xy[0], xy[1]));
+    }
+    // Blocks and blinkers out of the glider path, and a blinker on the
+    // corner where the plane wraps
+    for (Coord i = 0; i < 12; i++) {
+        XY corner(-100 + (i % 4) * 9, 60 + (i / 4) * 9);
+        cells.push_back(corner);
+        cells.push_back(XY(corner.x + 1, corner.y));
+        cells.push_back(XY(corner.x + (i % 2 ? 2 : 0), corner.y + (i % 2 ? 0 : 1)));
+        if (i % 2 == 0) {
+            cells.push_back(XY(corner.x + 1, corner.y + 1));
+        }
+    }
+    cells.push_back(XY(MAX, MIN));
+    cells.push_back(XY(MIN, MIN));
+    cells.push_back(XY(MIN + 1, MIN));
+    for (auto& xy : cells) {
+        quadtree.addCell(xy);
+        reference.addCell(xy);
+    }
+
+    for (int i = 0; i < 200; i++) {
+        quadtree.update();
+        reference.update();
+        ASSERT_EQ(sortedCells(quadtree), sortedCells(reference)) << "generation " << i;
+    }
+    // Only the gun, its gliders and the blinkers are still tracked
+    EXPECT_LT(quadtree.m_celltree->activeBlockCount(), 30);
+
+    // A cell dropped next to a settled block is picked up
+    quadtree.addCell(XY(-98, 60));
+    reference.addCell(XY(-98, 60));
+    for (int i = 0; i < 20; i++) {
+        quadtree.update();
+        reference.update();
+    }
+    EXPECT_EQ(sortedCells(quadtree), sortedCells(reference));
+}
+
+TEST(Simulation, TripleBuffer) {
+    TripleBuffer<int> buffer;
+    buffer.back() = 1;
+    buffer.publish();
+    EXPECT_TRUE(buffer.pending());
+    EXPECT_EQ(buffer.front(), 1);
+    EXPECT_FALSE(buffer.pending());
+
+    // The consumer only ever sees published values, newest last
+    constexpr int kValues = 100000;
+    std::thread producer([&] {
+        for (int i = 2; i <= kValues; i++) {
+            buffer.back() = i;
+            buffer.publish();
+        }
+    });
+    int last = 1;
+    while (last < kValues) {
+        int value = buffer.front();
+        ASSERT_GE(value, last);
+        last = value;
+    }
+    producer.join();
+}
+
+TEST(Simulation, Snapshots) {
+    CellTreeEngine engine;
+    engine.addCell(XY(-1, 0));
+    engine.addCell(XY(0, 0));
+    engine.addCell(XY(1, 0));
+    for (auto& xy : kGosperGun) {
+        engine.addCell(XY(xy[0] + 100, xy[1]));
+    }
+
+    // Only the blinker is in view
+    Simulation simulation(engine, AABB(XY(0, 0), -10, 10, -10, 10));
+    simulation.start();
+    while (simulation.snapshot().cells.size() != 3) {
+        std::this_thread::yield();
+    }
+    EXPECT_EQ(simulation.snapshot().generation, 0);
+
+    simulation.setRunning(true);
+    while (simulation.generation() < 100) {
+        const Snapshot& snapshot = simulation.snapshot();
+        ASSERT_EQ(snapshot.cells.size(), 3);
+    }
+    simulation.setRunning(false);
+    uint64_t generation = simulation.generation();
+    // Pausing publishes the last generation
+    while (simulation.snapshot().generation != simulation.generation()) {
+        std::this_thread::yield();
+    }
+    EXPECT_EQ(simulation.snapshot().cells.size(), 3);
+    simulation.stop();
+    EXPECT_GE(generation, 100);
+
+    CellTreeEngine reference;
+    reference.addCell(XY(-1, 0));
+    reference.addCell(XY(0, 0));
+    reference.addCell(XY(1, 0));
+    for (auto& xy : kGosperGun) {
+        reference.addCell(XY(xy[0] + 100, xy[1]));
+    }
+    for (uint64_t i = 0; i < simulation.generation(); i++) {
+        reference.update();
+    }
+    EXPECT_EQ(sortedCells(engine), sortedCells(reference));
+}
+
+TEST(Simulation, Step) {
+    HashLifeEngine engine;
+    for (auto& xy : kGosperGun) {
+        engine.addCell(XY(xy[0], xy[1]));
+    }
+
+    // Steps of 8 land on the generation to print
+    testing::internal::CaptureStdout();
+    Simulation simulation(engine, AABB(XY(0, 0), -100, 100, -100, 100), 10);
+    simulation.setStep(3);
+    simulation.start();
+    simulation.setRunning(true);
+    while (simulation.generation() < 40) {
+        std::this_thread::yield();
+    }
+    simulation.stop();
+    std::string printed = testing::internal::GetCapturedStdout();
+    EXPECT_NE(printed.find("#Life 1.06"), std::string::npos);
+    EXPECT_EQ((simulation.generation() - 10) % 8, 0);
+
+    CellTreeEngine reference;
+    for (auto& xy : kGosperGun) {
+        reference.addCell(XY(xy[0], xy[1]));
+    }
+    for (uint64_t i = 0; i < simulation.generation(); i++) {
+        reference.update();
+    }
+    EXPECT_EQ(sortedCells(engine), sortedCells(reference));
+
+    // A cheap pattern grows the adaptive step
+    simulation.setAdaptiveStep(50);
+    EXPECT_TRUE(simulation.adaptiveStep());
+    simulation.start();
+    while (simulation.step() < 6) {
+        std::this_thread::yield();
+    }
+    simulation.stop();
+    simulation.setStep(0);
+    EXPECT_FALSE(simulation.adaptiveStep());
+}
+
+TEST(CellMap, DirtyRects) {
+    constexpr int kWidth = 400;
+    constexpr int kHeight = 300;
+    constexpr int kCell = 5;
+    std::vector<uint8_t> pixels(kWidth * kHeight * 4);
+    SDL_Surface surface = {};
+    surface.pixels = pixels.data();
+    CellMap map(&surface, kWidth, kHeight, kCell, -1);
+    auto lit = [&](Coord x, Coord y) {
+        // The window is centered on the origin
+        int px = (int)(x + kWidth / kCell / 2) * kCell;
+        int py = (int)(y + kHeight / kCell / 2) * kCell;
+        return pixels[(py * kWidth + px) * 4] != 0;
+    };
+
+    // The first draw pushes the whole surface
+    std::vector<XY> horizontal = {XY(-1, 0), XY(0, 0), XY(1, 0), XY(-30, -20)};
+    map.draw(horizontal);
+    ASSERT_EQ(map.dirtyRects().size(), 1);
+    EXPECT_EQ(map.dirtyRects()[0].w, kWidth);
+    EXPECT_EQ(map.dirtyRects()[0].h, kHeight);
+    EXPECT_TRUE(lit(-1, 0));
+    EXPECT_TRUE(lit(-30, -20));
+
+    // A blinker flip only touches the tile around it
+    std::vector<XY> vertical = {XY(0, -1), XY(0, 0), XY(0, 1), XY(-30, -20)};
+    map.draw(vertical);
+    ASSERT_EQ(map.dirtyRects().size(), 1);
+    const SDL_Rect& rect = map.dirtyRects()[0];
+    EXPECT_LE(rect.w, kDirtyTileCells * kCell * 2);
+    EXPECT_LE(rect.h, kDirtyTileCells * kCell * 2);
+    EXPECT_FALSE(lit(-1, 0));
+    EXPECT_TRUE(lit(0, -1));
+    EXPECT_TRUE(lit(0, 0));
+    EXPECT_TRUE(lit(-30, -20));
+
+    // Nothing changed, nothing to push
+    map.draw(vertical);
+    EXPECT_TRUE(map.dirtyRects().empty());
+
+    // Rects stay on the surface and cover every change
+    std::vector<XY> column;
+    for (Coord y = -30; y < 30; y++) {
+        column.push_back(XY(39, y));
+    }
+    map.draw(column);
+    for (auto& dirty : map.dirtyRects()) {
+        EXPECT_GE(dirty.x, 0);
+        EXPECT_GE(dirty.y, 0);
+        EXPECT_LE(dirty.x + dirty.w, kWidth);
+        EXPECT_LE(dirty.y + dirty.h, kHeight);
+    }
+    EXPECT_LT(map.dirtyRects().size(), 4);
+    EXPECT_TRUE(lit(39, 29));
+    EXPECT_FALSE(lit(0, 0));
+
+    map.move(XY(1, 0));
+    map.draw(column);
+    ASSERT_EQ(map.dirtyRects().size(), 1);
+    EXPECT_EQ(map.dirtyRects()[0].w, kWidth);
+}
+
 int main(int argc, char *argv[])
 {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
 }
+
+TEST(Density, MatchesCells) {
+    std::mt19937_64 rng(11);
+    std::vector<XY> cells;
+    for (int i = 0; i < 20000; i++) {
+        cells.push_back(XY((Coord)(rng() % 600) - 300, (Coord)(rng() % 600) - 300));
+    }
+    // Around the corner where MAX wraps to MIN
+    for (Coord d = 0; d < 20; d++) {
+        cells.push_back(XY(MAX - d, MAX - 2 * d));
+        cells.push_back(XY(MIN + 3 * d, MIN + d));
+    }
+    std::sort(cells.begin(), cells.end(), [](const XY& a, const XY& b) {
+        return a.x < b.x || (a.x == b.x && a.y < b.y);
+    });
+    cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+
+    CellTreeEngine quadtree;
+    HashLifeEngine hashlife;
+    MortonEngine morton;
+    LifeEngine* engines[3] = {&quadtree, &hashlife, &morton};
+    for (auto& xy : cells) {
+        for (auto* engine : engines) {
+            engine->addCell(xy);
+        }
+    }
+
+    struct Case {
+        XY origin;
+        unsigned shift;
+        int columns;
+        int rows;
+    };
+    Case cases[] = {
+        {XY(-300, -300), 0, 600, 600},
+        {XY(-304, -304), 3, 76, 76},
+        // Not aligned to the squares
+        {XY(-291, -313), 5, 20, 17},
+        {XY(-(3 << 20), -(2 << 20)), 20, 6, 4},
+        // Straddles the Coord limits
+        {XY(MAX - 63, MAX - 63), 4, 8, 8},
+    };
+    for (auto& c : cases) {
+        DensityGrid expected;
+        expected.reset(c.origin, c.shift, c.columns, c.rows);
+        for (auto& xy : cells) {
+            expected.addCell(xy);
+        }
+        for (auto* engine : engines) {
+            DensityGrid grid;
+            grid.reset(c.origin, c.shift, c.columns, c.rows);
+            engine->queryDensity(grid);
+            EXPECT_EQ(grid.counts, expected.counts) << "shift " << c.shift;
+        }
+    }
+}
+
+TEST(CellMap, Zoom) {
+    constexpr int kWidth = 400;
+    constexpr int kHeight = 300;
+    std::vector<uint8_t> pixels(kWidth * kHeight * 4);
+    SDL_Surface surface = {};
+    surface.pixels = pixels.data();
+    CellMap map(&surface, kWidth, kHeight, 5, -1);
+    // A block far from the origin and a block at it
+    XY blocks[2] = {XY(1000, 600), XY(0, 0)};
+    for (auto& block : blocks) {
+        for (Coord i = 0; i < 4; i++) {
+            map.addCell(XY(block.x + i % 2, block.y + i / 2));
+        }
+    }
+
+    map.zoomIn();
+    EXPECT_EQ(map.pixelsPerCell(), 8);
+    map.zoomIn();
+    map.zoomIn();
+    EXPECT_EQ(map.pixelsPerCell(), kMaxPixelsPerCell);
+    for (int i = 0; i < 10; i++) {
+        map.zoomOut();
+    }
+    EXPECT_EQ(map.pixelsPerCell(), 1);
+    EXPECT_EQ(map.cellShift(), 6u);
+    // The center stays, the edges are aligned to the pixels
+    EXPECT_TRUE(map.view().contains(XY(0, 0)));
+    EXPECT_TRUE(map.view().contains(XY(1000, 600)));
+    EXPECT_EQ(map.view().left % 64, 0);
+    EXPECT_EQ(map.view().right - map.view().left + 1, (Coord)kWidth << 6);
+
+    map.update();
+    ASSERT_EQ(map.dirtyRects().size(), 1);
+    int lit = 0;
+    for (int i = 0; i < kWidth * kHeight; i++) {
+        lit += pixels[i * 4] != 0;
+    }
+    // Each block fits in one pixel or straddles a pixel edge
+    EXPECT_GE(lit, 2);
+    EXPECT_LE(lit, 8);
+
+    // Still lifes leave nothing to repaint
+    map.update();
+    EXPECT_TRUE(map.dirtyRects().empty());
+
+    for (int i = 0; i < 100; i++) {
+        map.zoomOut();
+    }
+    EXPECT_EQ(map.cellShift(), kMaxCellShift);
+    for (int i = 0; i < 100; i++) {
+        map.zoomIn();
+    }
+    EXPECT_EQ(map.cellShift(), 0u);
+    EXPECT_EQ(map.pixelsPerCell(), kMaxPixelsPerCell);
+    EXPECT_TRUE(map.view().contains(XY(0, 0)));
+}
+
+TEST(CellMap, PixelFormat) {
+    constexpr int kWidth = 150;
+    constexpr int kHeight = 40;
+    // Padded rows, the padding must stay untouched
+    constexpr int kPitch = kWidth + 10;
+    constexpr uint32_t kPadding = 0xdeadbeef;
+    SDL_PixelFormat format = {};
+    format.BytesPerPixel = 4;
+    format.Amask = 0xff000000;
+    format.Ashift = 24;
+    format.Rmask = 0x00ff0000;
+    format.Rshift = 16;
+    format.Gmask = 0x0000ff00;
+    format.Gshift = 8;
+    format.Bmask = 0x000000ff;
+    format.Bshift = 0;
+    std::vector<uint32_t> pixels(kPitch * kHeight, kPadding);
+    SDL_Surface surface = {};
+    surface.format = &format;
+    surface.pitch = kPitch * 4;
+    surface.pixels = pixels.data();
+    const uint32_t on = 0xff000000 | (kOnColor.r << 16) | (kOnColor.g << 8) | kOnColor.b;
+
+    // One pixel per cell goes through the row bitmaps
+    std::mt19937_64 rng(3);
+    std::vector<XY> cells;
+    for (int i = 0; i < 800; i++) {
+        cells.push_back(XY((Coord)(rng() % kWidth) - kWidth / 2, (Coord)(rng() % kHeight) - kHeight / 2));
+    }
+    for (int pixelsPerCell : {1, 3}) {
+        std::fill(pixels.begin(), pixels.end(), kPadding);
+        CellMap map(&surface, kWidth, kHeight, pixelsPerCell, -1);
+        int columns = kWidth / pixelsPerCell;
+        int rows = kHeight / pixelsPerCell;
+        std::vector<uint8_t> expected(columns * rows, 0);
+        for (auto& xy : cells) {
+            Coord x = xy.x + columns / 2;
+            Coord y = xy.y + rows / 2;
+            if (x >= 0 && x < columns && y >= 0 && y < rows) {
+                expected[y * columns + x] = 1;
+            }
+        }
+        map.draw(cells);
+        for (int y = 0; y < kHeight; y++) {
+            for (int x = 0; x < kPitch; x++) {
+                uint32_t pixel = pixels[y * kPitch + x];
+                if (x >= kWidth) {
+                    ASSERT_EQ(pixel, kPadding);
+                } else if (x / pixelsPerCell < columns && y / pixelsPerCell < rows &&
+                           expected[(y / pixelsPerCell) * columns + x / pixelsPerCell]) {
+                    ASSERT_EQ(pixel, on) << x << "," << y;
+                } else {
+                    ASSERT_EQ(pixel, 0u) << x << "," << y;
+                }
+            }
+        }
+    }
+}
+
+TEST(CellMap, ScaledOutput) {
+    constexpr int kWidth = 400;
+    constexpr int kHeight = 300;
+    std::vector<uint8_t> pixels(kWidth * kHeight * 4);
+    SDL_Surface surface = {};
+    surface.pixels = pixels.data();
+    surface.pitch = kWidth * 4;
+    CellMap map(&surface, kWidth, kHeight, 5, -1);
+    map.setScaledOutput(true);
+    EXPECT_EQ(map.outputScale(), 5);
+    EXPECT_EQ(map.drawArea().w, kWidth / 5);
+    EXPECT_EQ(map.drawArea().h, kHeight / 5);
+
+    // One pixel per cell in the top left, the rest is left alone
+    map.draw({XY(0, 0), XY(-40, -30)});
+    ASSERT_EQ(map.dirtyRects().size(), 1);
+    EXPECT_EQ(map.dirtyRects()[0].w, kWidth / 5);
+    auto lit = [&](int x, int y) {
+        return pixels[(y * kWidth + x) * 4] != 0;
+    };
+    EXPECT_TRUE(lit(40, 30));
+    EXPECT_TRUE(lit(0, 0));
+    EXPECT_FALSE(lit(41, 30));
+    EXPECT_FALSE(lit(40 * 5, 30 * 5));
+
+    map.zoomIn();
+    EXPECT_EQ(map.outputScale(), 8);
+    EXPECT_EQ(map.drawArea().w, kWidth / 8);
+    map.setScaledOutput(false);
+    EXPECT_EQ(map.outputScale(), 1);
+    EXPECT_EQ(map.drawArea().w, kWidth);
+}
+
+TEST(Rle, GosperGun) {
+    // Rows wrap over lines, one run is split by the line break
+    std::istringstream input(
+        "#N Gosper glider gun\n"
+        "#P 0 -4\n"
+        "x = 36, y = 9, rule = B3/S23\n"
+        "24bo$22bobo$12b2o6b2o12b2o$11bo3bo4b2o12b2o$2o8bo5bo3b2o$2o8bo3bob2o4b\r\n"
+        "obo$10bo5bo7bo$1\n1bo3bo$12b2o!\n"
+        "Anything after the end is ignored\n");
+    CellTreeEngine quadtree;
+    EXPECT_EQ(LoadRle(input, quadtree), 36);
+
+    CellTreeEngine expected;
+    for (auto& xy : kGosperGun) {
+        expected.addCell(XY(xy[0], xy[1]));
+    }
+    EXPECT_EQ(sortedCells(quadtree), sortedCells(expected));
+
+    std::istringstream small("x = 3, y = 2, rule = B36/S23\n3o$obo!");
+    RleReader header(small);
+    std::vector<XY> cells;
+    while (header.read(cells)) {
+    }
+    EXPECT_EQ(header.width(), 3);
+    EXPECT_EQ(header.height(), 2);
+    EXPECT_EQ(header.rule(), "B36/S23");
+    EXPECT_EQ(cells.size(), 5);
+
+    std::istringstream broken("x = 2, y = 1\n2o%!");
+    EXPECT_THROW(LoadRle(broken, quadtree), std::runtime_error);
+
+    // Isotropic and Larger than Life rules go to the engines that run them
+    std::istringstream isotropic("x = 3, y = 1, rule = B2-a/S12\n3o!");
+    EXPECT_EQ(ReadRleRule(isotropic), "B2-a/S12");
+    isotropic.clear();
+    isotropic.seekg(0);
+    TileEngine tiles;
+    EXPECT_EQ(LoadRle(isotropic, tiles), 3);
+    ASSERT_NE(tiles.isotropicRule(), nullptr);
+    EXPECT_EQ(tiles.isotropicRule()->toString(), "B2-a/S12");
+    std::istringstream ranged("x = 3, y = 1, rule = R5,C0,M1,S34..58,B34..45,NM\n3o!");
+    LtlEngine ltl;
+    EXPECT_EQ(LoadRle(ranged, ltl), 3);
+    EXPECT_EQ(ltl.ltlRule(), kBoscoRule);
+    isotropic.clear();
+    isotropic.seekg(0);
+    CellTreeEngine other;
+    EXPECT_THROW(LoadRle(isotropic, other), std::runtime_error);
+    // A caller with a rule of its own skips the header's
+    isotropic.clear();
+    isotropic.seekg(0);
+    EXPECT_EQ(LoadRle(isotropic, other, false), 3);
+    EXPECT_EQ(other.rule(), kConwayRule);
+}
+
+TEST(Rle, LargePattern) {
+    // Spans many chunks and batches
+    constexpr Coord kSide = 700;
+    std::mt19937_64 rng(5);
+    std::vector<XY> cells;
+    std::string text = "x = 700, y = 700\n";
+    std::string line;
+    for (Coord y = 0; y < kSide; y++) {
+        Coord x = 0;
+        while (x < kSide) {
+            bool alive = rng() % 3 == 0;
+            Coord run = 1 + (Coord)(rng() % 4);
+            run = std::min(run, kSide - x);
+            for (Coord i = 0; i < run; i++) {
+                if (alive) {
+                    cells.push_back(XY(x + i - 100, y + 50));
+                }
+            }
+            line += (run > 1 ? std::to_string(run) : "") + (alive ? "o" : "b");
+            x += run;
+            if (line.size() > 60) {
+                text += line + "\n";
+                line.clear();
+            }
+        }
+        line += y + 1 < kSide ? "$" : "!";
+    }
+    text += line + "\n";
+    ASSERT_GT(text.size(), kRleChunkSize * 2);
+    ASSERT_GT(cells.size(), kRleBatchCells * 2);
+
+    std::istringstream input("#P -100 50\n" + text);
+    CellTreeEngine quadtree;
+    EXPECT_EQ(LoadRle(input, quadtree), cells.size());
+    CellTreeEngine expected;
+    for (auto& xy : cells) {
+        expected.addCell(xy);
+    }
+    EXPECT_EQ(sortedCells(quadtree), sortedCells(expected));
+}
+
+TEST(JsonPattern, Stream) {
+    std::istringstream input(
+        "{\"name\": \"glider\", \"data\": [[1, 0], [2, 1], [0, 2], [1, 2], [2, 2],"
+        " [9223372036854775807, -9223372036854775808]], \"meta\": {\"data\": [[5, 5]]}}");
+    CellTreeEngine engine;
+    EXPECT_EQ(LoadJsonPattern(input, engine), 6);
+    std::vector<std::pair<Coord, Coord>> expected = {{0, 2}, {1, 0}, {1, 2}, {2, 1}, {2, 2}, {MAX, MIN}};
+    EXPECT_EQ(sortedCells(engine), expected);
+
+    // Batches of kJsonBatchCells, in file order
+    std::string big = "{\"data\": [";
+    size_t count = kJsonBatchCells * 2 + 7;
+    for (size_t i = 0; i < count; i++) {
+        big += (i ? ", [" : "[") + std::to_string(i) + ", -" + std::to_string(i) + "]";
+    }
+    big += "]}";
+    std::istringstream bigInput(big);
+    std::vector<size_t> batches;
+    Coord next = 0;
+    bool ordered = true;
+    EXPECT_EQ(ReadJsonPattern(bigInput, [&](const std::vector<XY>& cells) {
+        batches.push_back(cells.size());
+        for (auto& xy : cells) {
+            ordered = ordered && xy.x == next && xy.y == -next;
+            next++;
+        }
+    }), count);
+    EXPECT_TRUE(ordered);
+    EXPECT_EQ(batches, std::vector<size_t>({kJsonBatchCells, kJsonBatchCells, 7}));
+
+    for (const char* broken : {"{\"data\": [[1, 2, 3]]}", "{\"data\": [[1, \"2\"]]}",
+                               "{\"data\": [1, 2]}", "{\"data\": [[1, 2]"}) {
+        std::istringstream brokenInput(broken);
+        EXPECT_THROW(LoadJsonPattern(brokenInput, engine), std::runtime_error) << broken;
+    }
+}
+
+TEST(Points, Parse) {
+    // Signs and whitespace anywhere inside a point, text outside is skipped
+    std::istringstream input("(0, 0)\n(-1,2) (3,-4)\r\n( - 5 ,\t+6 )\nnot a point\n"
+                             "(9223372036854775807, -9223372036854775808)\n(7,\n8)");
+    CellTreeEngine engine;
+    EXPECT_EQ(LoadPoints(input, engine), 6);
+    std::vector<std::pair<Coord, Coord>> expected = {{-5, 6}, {-1, 2}, {0, 0}, {3, -4}, {7, 8}, {MAX, MIN}};
+    EXPECT_EQ(sortedCells(engine), expected);
+
+    // Points split across chunks and batches
+    std::string big;
+    size_t count = kPointBatchCells + 100;
+    for (size_t i = 0; i < count; i++) {
+        big += "(" + std::to_string(i) + ", -" + std::to_string(i * 3) + ")\n";
+    }
+    std::istringstream bigInput(big);
+    PointReader reader(bigInput);
+    std::vector<XY> cells;
+    EXPECT_TRUE(reader.read(cells));
+    EXPECT_EQ(cells.size(), kPointBatchCells);
+    EXPECT_TRUE(reader.read(cells));
+    EXPECT_FALSE(reader.read(cells));
+    ASSERT_EQ(cells.size(), count);
+    bool matches = true;
+    for (size_t i = 0; i < count; i++) {
+        matches = matches && cells[i] == XY((Coord)i, -(Coord)(i * 3));
+    }
+    EXPECT_TRUE(matches);
+
+    for (const char* broken : {"(1 2)", "(1, x)", "(1, 2", "(9223372036854775808, 0)", "(--1, 0)"}) {
+        std::istringstream brokenInput(broken);
+        EXPECT_THROW(LoadPoints(brokenInput, engine), std::runtime_error) << broken;
+    }
+}
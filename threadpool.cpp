@@ -0,0 +1,133 @@
+#include "threadpool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        m_queues.push_back(std::make_unique<TaskQueue>());
+    }
+    for (unsigned i = 1; i < threads; i++) {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+bool ThreadPool::runOne(unsigned index) {
+    std::pair<size_t, size_t> task;
+    bool found = false;
+
+    // Own queue first, newest task for locality
+    {
+        TaskQueue& own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+
+    // Steal the oldest task of another worker
+    for (size_t i = 1; !found && i < m_queues.size(); i++) {
+        TaskQueue& victim = *m_queues[(index + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            found = true;
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    try {
+        (*m_body)(task.first, task.second);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_error) {
+            m_error = std::current_exception();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_pending == 0) {
+        m_done.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_epoch != seen; });
+            if (m_stop) {
+                return;
+            }
+            seen = m_epoch;
+        }
+        while (runOne(index)) {
+        }
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+    grain = std::max<size_t>(grain, 1);
+
+    if (m_queues.size() == 1) {
+        for (size_t begin = 0; begin < count; begin += grain) {
+            body(begin, std::min(count, begin + grain));
+        }
+        return;
+    }
+
+    // Publish the body before any chunk becomes visible to stealers
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_body = &body;
+        m_pending = (count + grain - 1) / grain;
+        m_error = nullptr;
+    }
+
+    // Deal chunks round-robin so every worker starts with local work
+    size_t chunk = 0;
+    for (size_t begin = 0; begin < count; begin += grain, chunk++) {
+        TaskQueue& queue = *m_queues[chunk % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.emplace_back(begin, std::min(count, begin + grain));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_epoch++;
+    }
+    m_wake.notify_all();
+
+    while (runOne(0)) {
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&] { return m_pending == 0; });
+    m_body = nullptr;
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
+}
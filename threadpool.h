@@ -0,0 +1,56 @@
+#ifndef ThreadPool_H
+
+#define ThreadPool_H
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <cstdint>
+
+// Fixed-size work-stealing pool. Every worker owns a queue of index
+// ranges, pops from its back and steals from the front of the others once
+// it runs dry. The calling thread takes part as worker 0.
+class ThreadPool {
+public:
+    // threads counts the caller, 0 means one per hardware thread
+    explicit ThreadPool(unsigned threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned threadCount() const { return (unsigned)m_queues.size(); }
+
+    // Runs body(begin, end) over [0, count) in chunks of at most grain
+    // indices and returns once every chunk has finished
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+private:
+    class TaskQueue {
+    public:
+        std::mutex mutex;
+        std::deque<std::pair<size_t, size_t>> tasks;
+    };
+
+    void workerLoop(unsigned index);
+    bool runOne(unsigned index);
+
+    std::vector<std::unique_ptr<TaskQueue>> m_queues;
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(size_t, size_t)>* m_body = nullptr;
+    size_t m_pending = 0;
+    uint64_t m_epoch = 0;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+};
+
+#endif
@@ -0,0 +1,274 @@
+#include "tilemap.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+bool Tile::empty() const {
+    uint64_t any = 0;
+    for (int i = 0; i < kTileSize; i++) {
+        any |= rows[i];
+    }
+    return any == 0;
+}
+
+size_t Tile::population() const {
+    size_t result = 0;
+    for (int i = 0; i < kTileSize; i++) {
+        result += popcount64(rows[i]);
+    }
+    return result;
+}
+
+static void nextRowsScalar(const uint64_t* l, const uint64_t* c, const uint64_t* r, uint64_t* output) {
+    for (int i = 0; i < kTileSize; i++) {
+        output[i] = nextRow(l[i], c[i], r[i],
+                            l[i + 1], c[i + 1], r[i + 1],
+                            l[i + 2], c[i + 2], r[i + 2]);
+    }
+}
+
+// Any other rule, kernel is a StaticRule or RuleTable
+template<class Kernel>
+static void nextRowsRule(const Kernel& kernel, const uint64_t* l, const uint64_t* c, const uint64_t* r,
+                         uint64_t* output) {
+    uint32_t mask = kernel.sumMask();
+    for (int i = 0; i < kTileSize; i++) {
+        uint64_t bits[4];
+        sumRow(l[i], c[i], r[i], l[i + 1], c[i + 1], r[i + 1], l[i + 2], c[i + 2], r[i + 2], bits);
+        output[i] = selectSum(mask, bits, c[i + 1]);
+    }
+}
+
+#ifdef TILE_AVX2
+// Same adder network as nextRow, four rows per iteration
+AVX2_TARGET static void nextRowsAVX2(const uint64_t* l, const uint64_t* c, const uint64_t* r, uint64_t* output) {
+    for (int i = 0; i < kTileSize; i += 4) {
+        __m256i la = load4(l + i), ca = load4(c + i), ra = load4(r + i);
+        __m256i lm = load4(l + i + 1), cm = load4(c + i + 1), rm = load4(r + i + 1);
+        __m256i lb = load4(l + i + 2), cb = load4(c + i + 2), rb = load4(r + i + 2);
+
+        __m256i next = nextRow4(la, ca, ra, lm, cm, rm, lb, cb, rb);
+        _mm256_storeu_si256((__m256i*)(output + i), next);
+    }
+}
+#endif
+
+TileEngine::TileEngine(bool simd)
+    : m_simd(simd) {
+#ifdef TILE_AVX2
+    m_simd = m_simd && cpuHasAVX2();
+#else
+    m_simd = false;
+#endif
+}
+
+const Tile* TileEngine::findTile(const XY& txy) const {
+    auto it = m_tiles.find(txy);
+    return it == m_tiles.end() ? nullptr : &it->second;
+}
+
+void TileEngine::nextTile(const XY& txy, Tile& output) const {
+    static const Tile emptyTile;
+    const Tile* n[3][3];
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            const Tile* tile = findTile(XY(TileAddition(txy.x, dx), TileAddition(txy.y, dy)));
+            n[dy + 1][dx + 1] = tile ? tile : &emptyTile;
+        }
+    }
+
+    // Rows -1..64 of the 3x3 block, shifted so that bit i holds the west
+    // neighbor (l), the cell (c) and the east neighbor (r) of column i
+    uint64_t l[kTileSize + 2], c[kTileSize + 2], r[kTileSize + 2];
+    for (int i = 0; i < kTileSize + 2; i++) {
+        int band = i == 0 ? 0 : (i == kTileSize + 1 ? 2 : 1);
+        int row = (i - 1) & (kTileSize - 1);
+        uint64_t west = n[band][0]->rows[row];
+        uint64_t center = n[band][1]->rows[row];
+        uint64_t east = n[band][2]->rows[row];
+        c[i] = center;
+        l[i] = (center << 1) | (west >> (kTileSize - 1));
+        r[i] = (center >> 1) | (east << (kTileSize - 1));
+    }
+
+    if (m_isotropic) {
+        m_isotropic->nextRows(l, c, r, output.rows, kTileSize);
+        return;
+    }
+    if (m_rule != kConwayRule) {
+        DispatchRule(m_rule, [&](const auto& kernel) {
+            nextRowsRule(kernel, l, c, r, output.rows);
+        });
+        return;
+    }
+#ifdef TILE_AVX2
+    if (m_simd) {
+        nextRowsAVX2(l, c, r, output.rows);
+        return;
+    }
+#endif
+    nextRowsScalar(l, c, r, output.rows);
+}
+
+void TileEngine::setRule(const Rule& rule) {
+    LifeEngine::setRule(rule);
+    m_isotropic = nullptr;
+}
+
+void TileEngine::setIsotropicRule(const IsotropicRule& rule) {
+    m_isotropic = std::make_unique<IsotropicKernel>(rule);
+}
+
+const Rule& TileEngine::rule() const {
+    if (m_isotropic) {
+        throw std::runtime_error("Isotropic rule " + m_isotropic->rule().toString() + " has no B/S form");
+    }
+    return m_rule;
+}
+
+void TileEngine::setThreadCount(unsigned threads) {
+    if (threads == 1) {
+        m_pool = nullptr;
+    } else {
+        m_pool = std::make_unique<ThreadPool>(threads);
+    }
+}
+
+void TileEngine::addCell(const XY& xy) {
+    Tile& tile = m_tiles[XY(xy.x >> kTileShift, xy.y >> kTileShift)];
+    tile.rows[xy.y & (kTileSize - 1)] |= 1ULL << (xy.x & (kTileSize - 1));
+}
+
+bool TileEngine::getCell(const XY& xy) const {
+    const Tile* tile = findTile(XY(xy.x >> kTileShift, xy.y >> kTileShift));
+    if (!tile) {
+        return false;
+    }
+    return (tile->rows[xy.y & (kTileSize - 1)] >> (xy.x & (kTileSize - 1))) & 1;
+}
+
+void TileEngine::update() {
+    // 1. Collect live tiles and the empty neighbors their border cells
+    // reach, the buffers are kept from one generation to the next
+    int border = range();
+    uint64_t westMask = (1ULL << border) - 1;
+    uint64_t eastMask = westMask << (kTileSize - border);
+    m_candidates.clear();
+    m_reached.clear();
+    m_candidates.reserve(m_tiles.size());
+    for (auto& entry : m_tiles) {
+        const XY& txy = entry.first;
+        const Tile& tile = entry.second;
+        m_candidates.push_back(txy);
+
+        uint64_t westEdge = 0, eastEdge = 0;
+        for (int i = 0; i < kTileSize; i++) {
+            westEdge |= tile.rows[i] & westMask;
+            eastEdge |= tile.rows[i] & eastMask;
+        }
+        uint64_t top = 0, bottom = 0;
+        for (int i = 0; i < border; i++) {
+            top |= tile.rows[i];
+            bottom |= tile.rows[kTileSize - 1 - i];
+        }
+        bool reach[3][3] = {
+            {(top & westMask) != 0, top != 0, (top & eastMask) != 0},
+            {westEdge != 0, false, eastEdge != 0},
+            {(bottom & westMask) != 0, bottom != 0, (bottom & eastMask) != 0}
+        };
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if (!reach[dy + 1][dx + 1]) {
+                    continue;
+                }
+                XY neighbor(TileAddition(txy.x, dx), TileAddition(txy.y, dy));
+                if (m_tiles.find(neighbor) == m_tiles.end()) {
+                    m_reached.push_back(neighbor);
+                }
+            }
+        }
+    }
+    // Live tiles are unique, empty ones can be reached from several sides
+    std::sort(m_reached.begin(), m_reached.end(), [](const XY& a, const XY& b) {
+        return a.x < b.x || (a.x == b.x && a.y < b.y);
+    });
+    m_reached.erase(std::unique(m_reached.begin(), m_reached.end()), m_reached.end());
+    m_candidates.insert(m_candidates.end(), m_reached.begin(), m_reached.end());
+
+    // 2. Compute the next generation of every candidate in place in the
+    // map of two generations ago. Tiles still there keep their nodes, the
+    // ones no candidate overwrites are cleared and dropped below. Each
+    // tile only reads the current generation so the order does not matter.
+    for (auto& entry : m_next) {
+        entry.second = Tile();
+    }
+    m_next.reserve(m_candidates.size());
+    m_outputs.clear();
+    for (auto& txy : m_candidates) {
+        m_outputs.push_back(&m_next[txy]);
+    }
+    auto body = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            nextTile(m_candidates[i], *m_outputs[i]);
+        }
+    };
+    if (m_pool) {
+        m_pool->parallelFor(m_candidates.size(), kTileGrain, body);
+    } else {
+        body(0, m_candidates.size());
+    }
+
+    // 3. Keep the non-empty ones
+    for (auto it = m_next.begin(); it != m_next.end();) {
+        if (it->second.empty()) {
+            it = m_next.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    m_tiles.swap(m_next);
+}
+
+void TileEngine::query(const AABB& range, std::vector<XY>& output) {
+    for (auto& entry : m_tiles) {
+        Coord left = entry.first.x * kTileSize;
+        Coord top = entry.first.y * kTileSize;
+        AABB bbox(XY(left + kTileSize / 2, top + kTileSize / 2),
+                  left, left + kTileSize - 1, top, top + kTileSize - 1);
+        if (!bbox.intersect(range)) {
+            continue;
+        }
+        for (int j = 0; j < kTileSize; j++) {
+            uint64_t row = entry.second.rows[j];
+            while (row) {
+                int i = ctz64(row);
+                row &= row - 1;
+                XY xy(left + i, top + j);
+                if (range.contains(xy)) {
+                    output.push_back(xy);
+                }
+            }
+        }
+    }
+}
+
+void TileEngine::print(std::ostream& output) {
+    output << "#Life 1.06\n";
+    std::vector<XY> cells;
+    query(AABB(XY(0, 0),
+               std::numeric_limits<Coord>::min(), std::numeric_limits<Coord>::max(),
+               std::numeric_limits<Coord>::min(), std::numeric_limits<Coord>::max()),
+          cells);
+    for (auto& xy : cells) {
+        output << xy.x << " " << xy.y << std::endl;
+    }
+}
+
+size_t TileEngine::cellCount() {
+    size_t result = 0;
+    for (auto& entry : m_tiles) {
+        result += entry.second.population();
+    }
+    return result;
+}
@@ -0,0 +1,209 @@
+#ifndef TileMap_H
+
+#define TileMap_H
+#pragma once
+#include "cellmap.h"
+#include "threadpool.h"
+#include "isotropic.h"
+#include <unordered_map>
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TILE_AVX2 1
+#endif
+
+// Tiles handed to a worker at a time
+constexpr size_t kTileGrain = 16;
+// Width and height of a tile in cells, one row fits in a uint64_t
+constexpr int kTileSize = 64;
+constexpr int kTileShift = 6;
+
+// Tile coordinates span Coord >> kTileShift, wrap inside that range
+inline Coord TileAddition(Coord t, Coord d) {
+    return (Coord)((uint64_t)(t + d) << kTileShift) >> kTileShift;
+}
+
+inline int popcount64(uint64_t v) {
+#ifdef _MSC_VER
+    return (int)__popcnt64(v);
+#else
+    return __builtin_popcountll(v);
+#endif
+}
+
+// Index of the lowest set bit, v must not be 0
+inline int ctz64(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return (int)index;
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+// Bit-sliced sum of all nine cells around 64 cells, from the
+// west-shifted, centered and east-shifted words of the row above, the row
+// itself and the row below
+inline void sumRow(uint64_t la, uint64_t ca, uint64_t ra,
+                   uint64_t lm, uint64_t cm, uint64_t rm,
+                   uint64_t lb, uint64_t cb, uint64_t rb, uint64_t bits[4]) {
+    uint64_t a0 = la ^ ca ^ ra, b0 = (la & ca) | (ra & (la ^ ca));
+    uint64_t a1 = lm ^ cm ^ rm, b1 = (lm & cm) | (rm & (lm ^ cm));
+    uint64_t a2 = lb ^ cb ^ rb, b2 = (lb & cb) | (rb & (lb ^ cb));
+
+    uint64_t sLo = a0 ^ a1 ^ a2, sHi = (a0 & a1) | (a2 & (a0 ^ a1));
+    uint64_t tLo = b0 ^ b1 ^ b2, tHi = (b0 & b1) | (b2 & (b0 ^ b1));
+
+    uint64_t carry = sHi & tLo;
+    bits[0] = sLo;
+    bits[1] = sHi ^ tLo;
+    bits[2] = tHi ^ carry;
+    bits[3] = tHi & carry;
+}
+
+// Next state of 64 cells under B3/S23, a cell is alive next if the sum is
+// 3, or 4 and it is alive now
+inline uint64_t nextRow(uint64_t la, uint64_t ca, uint64_t ra,
+                        uint64_t lm, uint64_t cm, uint64_t rm,
+                        uint64_t lb, uint64_t cb, uint64_t rb) {
+    uint64_t bits[4];
+    sumRow(la, ca, ra, lm, cm, rm, lb, cb, rb, bits);
+    return ~bits[3] & ((bits[0] & bits[1] & ~bits[2]) | (cm & ~bits[0] & ~bits[1] & bits[2]));
+}
+
+// one where select is set, zero elsewhere
+inline uint64_t mux(uint64_t select, uint64_t one, uint64_t zero) {
+    return (select & one) | (~select & zero);
+}
+
+// All ones when bit i of mask is set
+inline uint64_t maskLanes(uint32_t mask, int i) {
+    return 0 - (uint64_t)((mask >> i) & 1);
+}
+
+// Lanes whose alive << 4 | sum has its bit set in a Rule::sumMask(), as a
+// tree of multiplexers over the sum bits. A constant mask folds the tree
+// down to a few operations.
+inline uint64_t selectSum(uint32_t mask, const uint64_t bits[4], uint64_t alive) {
+    uint64_t lanes[16];
+    for (int i = 0; i < 16; i++) {
+        lanes[i] = mux(bits[0], maskLanes(mask, 2 * i + 1), maskLanes(mask, 2 * i));
+    }
+    for (int bit = 1, count = 8; bit < 4; bit++, count /= 2) {
+        for (int i = 0; i < count; i++) {
+            lanes[i] = mux(bits[bit], lanes[2 * i + 1], lanes[2 * i]);
+        }
+    }
+    return mux(alive, lanes[1], lanes[0]);
+}
+
+#ifdef TILE_AVX2
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET inline __m256i load4(const uint64_t* p) {
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+
+AVX2_TARGET inline __m256i maj(__m256i a, __m256i b, __m256i c) {
+    return _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+}
+
+AVX2_TARGET inline __m256i xor3(__m256i a, __m256i b, __m256i c) {
+    return _mm256_xor_si256(_mm256_xor_si256(a, b), c);
+}
+
+// Same adder network as nextRow, on four words at a time
+AVX2_TARGET inline __m256i nextRow4(__m256i la, __m256i ca, __m256i ra,
+                                    __m256i lm, __m256i cm, __m256i rm,
+                                    __m256i lb, __m256i cb, __m256i rb) {
+    __m256i a0 = xor3(la, ca, ra), b0 = maj(la, ca, ra);
+    __m256i a1 = xor3(lm, cm, rm), b1 = maj(lm, cm, rm);
+    __m256i a2 = xor3(lb, cb, rb), b2 = maj(lb, cb, rb);
+
+    __m256i sLo = xor3(a0, a1, a2), sHi = maj(a0, a1, a2);
+    __m256i tLo = xor3(b0, b1, b2), tHi = maj(b0, b1, b2);
+
+    __m256i bit0 = sLo;
+    __m256i bit1 = _mm256_xor_si256(sHi, tLo);
+    __m256i carry = _mm256_and_si256(sHi, tLo);
+    __m256i bit2 = _mm256_xor_si256(tHi, carry);
+    __m256i bit3 = _mm256_and_si256(tHi, carry);
+
+    // andnot(a, b) computes ~a & b
+    __m256i three = _mm256_andnot_si256(bit2, _mm256_and_si256(bit0, bit1));
+    __m256i four = _mm256_andnot_si256(_mm256_or_si256(bit0, bit1), _mm256_and_si256(cm, bit2));
+    return _mm256_andnot_si256(bit3, _mm256_or_si256(three, four));
+}
+
+inline bool cpuHasAVX2() {
+    static const bool result = __builtin_cpu_supports("avx2");
+    return result;
+}
+#endif
+
+// 64x64 bit-packed block of cells. Bit i of rows[j] is the cell at
+// (tile.x * 64 + i, tile.y * 64 + j).
+class Tile {
+public:
+    uint64_t rows[kTileSize] = {};
+
+    bool empty() const;
+    size_t population() const;
+};
+
+// Sparse tile engine, a hash of non-empty tiles keyed by tile coordinate.
+// Each generation is computed 64 cells at a time with bitwise adders, using
+// AVX2 when the CPU supports it. Tiles are independent within a generation,
+// so they are spread over a work-stealing pool when more than one thread is
+// configured. Tile coordinates wrap around at the Coord limits like
+// big_int_addition does. Besides B/S rules it runs isotropic
+// non-totalistic ones through an IsotropicKernel.
+class TileEngine : public LifeEngine {
+public:
+    explicit TileEngine(bool simd = true);
+
+    void addCell(const XY& xy) override;
+    void update() override;
+    void query(const AABB& range, std::vector<XY>& output) override;
+    void print(std::ostream& output) override;
+    size_t cellCount() override;
+    void setThreadCount(unsigned threads) override;
+    // Both replace the rule the other set
+    void setRule(const Rule& rule) override;
+    virtual void setIsotropicRule(const IsotropicRule& rule);
+    const IsotropicRule* isotropicRule() const { return m_isotropic ? &m_isotropic->rule() : nullptr; }
+    // Throws while an isotropic rule runs, it has no B/S form
+    const Rule& rule() const override;
+
+    bool getCell(const XY& xy) const;
+    size_t tileCount() const { return m_tiles.size(); }
+    bool simd() const { return m_simd; }
+    unsigned threadCount() const { return m_pool ? m_pool->threadCount() : 1; }
+
+protected:
+    // Farthest a cell's neighbors are, in cells. Tiles within that many
+    // cells of a live one are computed by update().
+    virtual int range() const { return 1; }
+    const Tile* findTile(const XY& txy) const;
+    virtual void nextTile(const XY& txy, Tile& output) const;
+
+    std::unordered_map<XY, Tile> m_tiles;
+    bool m_simd;
+    std::unique_ptr<ThreadPool> m_pool;
+    std::unique_ptr<IsotropicKernel> m_isotropic;
+
+private:
+    // Reused by update(): the tiles to compute, the empty ones among them
+    // before deduplication, where each result goes, and the map of two
+    // generations ago the next one is computed into
+    std::vector<XY> m_candidates;
+    std::vector<XY> m_reached;
+    std::vector<Tile*> m_outputs;
+    std::unordered_map<XY, Tile> m_next;
+};
+
+#endif